@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Same comparison as `float_output.R`, but using the standalone program (see
+# `standalone/README.md`), so it doesn't need R.
+# Builds the program with and without `-DCLONEWARS_FLOAT_OUTPUT`, runs each
+# config in `float_output/` with both, and compares their output.
+#
+#     reports/float_output.sh > reports/float_output/standalone.csv
+#
+# Output is CSV with one row per scenario and type of output:
+#     scenario,output,n,max_abs_diff,max_rel_diff
+# where relative differences are divided by `max(abs(double), 1)`, like in
+# `float_output.R`.
+#
+# Uses the same CXX, CPPFLAGS, CXXFLAGS, and LIBS as `standalone/Makefile`.
+
+set -e
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2 -g}
+LIBS=${LIBS:--larmadillo -llapack -lblas}
+HERE=$(cd "$(dirname "$0")" && pwd)
+SRC="$HERE/../src"
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+for prec in double float; do
+    mkdir "$TMP/$prec"
+    flags=""
+    if [ $prec = float ]; then flags=-DCLONEWARS_FLOAT_OUTPUT; fi
+    for f in aphids patches simulations result_store ensemble_summary; do
+        $CXX -std=c++11 $CPPFLAGS $flags -DCLONEWARS_STANDALONE -I"$SRC" \
+            -I"$HERE/../inst/include" $CXXFLAGS -fopenmp -c "$SRC/$f.cpp" \
+            -o "$TMP/$prec/$f.o"
+    done
+    $CXX -std=c++11 $CPPFLAGS $flags -DCLONEWARS_STANDALONE -I"$SRC" \
+        -I"$HERE/../inst/include" $CXXFLAGS -fopenmp -o "$TMP/$prec/clonewars" \
+        "$HERE/../standalone/main.cpp" "$TMP/$prec"/*.o $LIBS
+done
+
+echo "scenario,output,n,max_abs_diff,max_rel_diff"
+
+for cfg in "$HERE"/float_output/*.cfg; do
+    scenario=$(basename "$cfg" .cfg)
+    "$TMP/double/clonewars" "$cfg" "$TMP/double/out"
+    "$TMP/float/clonewars" "$cfg" "$TMP/float/out"
+    # Rows are in the same order in both, so compare them line by line:
+    paste -d, "$TMP/double/out_aphids.csv" "$TMP/float/out_aphids.csv" |
+        awk -F, -v s="$scenario" 'NR > 1 { diffs__($6, $7, $14) }
+            function diffs__(type, d, f,   a, r) {
+                a = d - f; if (a < 0) a = -a
+                r = a / ((d < -1 || d > 1) ? (d < 0 ? -d : d) : 1)
+                n[type]++
+                if (a > max_abs[type]) max_abs[type] = a
+                if (r > max_rel[type]) max_rel[type] = r
+            }
+            END { for (t in n) printf "%s,%s,%d,%.6g,%.6g\n", s, t, n[t], max_abs[t], max_rel[t] }' |
+        sort
+    paste -d, "$TMP/double/out_wasps.csv" "$TMP/float/out_wasps.csv" |
+        awk -F, -v s="$scenario" 'NR > 1 {
+                a = $4 - $8; if (a < 0) a = -a
+                r = a / (($4 < -1 || $4 > 1) ? ($4 < 0 ? -$4 : $4) : 1)
+                n++
+                if (a > max_abs) max_abs = a
+                if (r > max_rel) max_rel = r
+            }
+            END { printf "%s,wasps,%d,%.6g,%.6g\n", s, n, max_abs, max_rel }'
+done
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Checks how much writing output to `store_file` holds up simulations, and
+# how much `store_compress` shrinks the file.
+# Runs `store_write/sims.cfg` through the standalone program (see
+# `standalone/README.md`) without a store, with one, and with a compressed
+# one, each using 1 and 2 threads.
+#
+#     reports/store_write.sh > reports/store_write/standalone.csv
+#
+# Output is CSV with one row per run:
+#     store,n_threads,wall_secs,sim_secs,store_secs,file_bytes
+# where `sim_secs` is the time from `profile` summed across phases and threads,
+# and `store_secs` is the part of that spent handing reps to the writer thread
+# (the `store` phase), including waiting when its queue was full.
+# Writing itself happens on the writer thread, so it's not in `sim_secs`.
+#
+# Uses the same CXX, CPPFLAGS, CXXFLAGS, and LIBS as `standalone/Makefile`.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+make -C "$HERE/../standalone" -s clonewars
+
+echo "store,n_threads,wall_secs,sim_secs,store_secs,file_bytes"
+
+for n_threads in 1 2; do
+    for store in none raw compressed; do
+        store_file=""
+        if [ $store != none ]; then store_file="$TMP/sims.clw"; fi
+        compress=0
+        if [ $store = compressed ]; then compress=1; fi
+        sed -e "s|^store_file.*|store_file $store_file|" \
+            -e "s|^store_compress.*|store_compress $compress|" \
+            -e "s|^n_threads.*|n_threads $n_threads|" \
+            "$HERE/store_write/sims.cfg" > "$TMP/sims.cfg"
+        t0=$(date +%s.%N)
+        "$HERE/../standalone/clonewars" "$TMP/sims.cfg" "$TMP/out" 2> "$TMP/phases.txt"
+        t1=$(date +%s.%N)
+        file_bytes=0
+        if [ -n "$store_file" ]; then file_bytes=$(wc -c < "$store_file"); fi
+        awk -v s=$store -v n=$n_threads -v t0=$t0 -v t1=$t1 -v b=$file_bytes '
+            { sim += $2; if ($1 == "store") st = $2 }
+            END { printf "%s,%d,%.3f,%.3f,%.4f,%d\n", s, n, t1 - t0, sim, st, b }' \
+            "$TMP/phases.txt"
+        rm -f "$store_file"
+    done
+done
@@ -0,0 +1,456 @@
+
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ Output columns returned to R without copying them.
+
+ Each column of the output data frames is an ALTREP vector that refers to
+ the C++ vector it came from.
+ Nothing is copied until R needs a pointer to the whole vector, and then
+ only that column is copied and its C++ vector freed.
+ Abundances are used directly when they're stored as doubles
+ (i.e., without `-DCLONEWARS_FLOAT_OUTPUT`), so they're never copied.
+ All columns share ownership of the output, so it's freed when the last of
+ them is garbage collected.
+
+ ALTREP needs R >= 3.6; with older versions, columns are copied as usual.
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include <RcppArmadillo.h>      // Rcpp
+#include <vector>               // vector class
+#include <string>               // string class
+#include <memory>               // shared_ptr
+#include <algorithm>            // copy
+#include <type_traits>          // is_same
+#include <sstream>              // ostringstream
+#include "clonewars_types.hpp"  // integer types
+#include "simulations.hpp"      // SimOutput
+#include "altrep_output.hpp"    // output_list__
+
+#include <Rversion.h>           // R_VERSION
+#if R_VERSION >= R_Version(3, 6, 0)
+#define CLONEWARS_ALTREP
+// (Older versions of this header use `class` as an argument name)
+#define class klass
+extern "C" {
+#include <R_ext/Altrep.h>
+}
+#undef class
+#endif
+
+
+using namespace Rcpp;
+
+
+
+
+#ifdef CLONEWARS_ALTREP
+
+
+typedef std::shared_ptr<SimOutput> OutputPtr;
+
+// What's stored (in an external pointer) in each column's `data1`:
+template <typename T>
+struct ColumnRef {
+    OutputPtr owner;
+    std::vector<T>& values;
+    ColumnRef(const OutputPtr& owner_, std::vector<T>& values_)
+        : owner(owner_), values(values_) {};
+};
+
+template <typename T>
+inline ColumnRef<T>& column_ref__(SEXP x) {
+    return *static_cast<ColumnRef<T>*>(R_ExternalPtrAddr(R_altrep_data1(x)));
+}
+
+template <typename T>
+void finalize_column_ref__(SEXP ptr) {
+    ColumnRef<T>* ref = static_cast<ColumnRef<T>*>(R_ExternalPtrAddr(ptr));
+    if (ref != nullptr) delete ref;
+    R_ClearExternalPtr(ptr);
+    return;
+}
+
+template <typename T>
+SEXP new_column__(const R_altrep_class_t& cls,
+                  const OutputPtr& owner,
+                  std::vector<T>& values) {
+    SEXP ptr = PROTECT(R_MakeExternalPtr(new ColumnRef<T>(owner, values),
+                                         R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(ptr, finalize_column_ref__<T>, TRUE);
+    SEXP out = R_new_altrep(cls, ptr, R_NilValue);
+    UNPROTECT(1);
+    return out;
+}
+
+
+
+// Differences between integer and double vectors:
+template <int RTYPE> struct RVec;
+template <> struct RVec<INTSXP> {
+    typedef int type;
+    static int* ptr(SEXP x) { return INTEGER(x); }
+    static R_altrep_class_t make_class(const char* name, DllInfo* dll) {
+        return R_make_altinteger_class(name, "clonewars", dll);
+    }
+    static void set_methods(R_altrep_class_t cls,
+                            int (*elt)(SEXP, R_xlen_t),
+                            R_xlen_t (*region)(SEXP, R_xlen_t, R_xlen_t, int*)) {
+        R_set_altinteger_Elt_method(cls, elt);
+        R_set_altinteger_Get_region_method(cls, region);
+    }
+};
+template <> struct RVec<REALSXP> {
+    typedef double type;
+    static double* ptr(SEXP x) { return REAL(x); }
+    static R_altrep_class_t make_class(const char* name, DllInfo* dll) {
+        return R_make_altreal_class(name, "clonewars", dll);
+    }
+    static void set_methods(R_altrep_class_t cls,
+                            double (*elt)(SEXP, R_xlen_t),
+                            R_xlen_t (*region)(SEXP, R_xlen_t, R_xlen_t, double*)) {
+        R_set_altreal_Elt_method(cls, elt);
+        R_set_altreal_Get_region_method(cls, region);
+    }
+};
+
+
+
+/*
+ Numeric column stored in C++ as type `T` and in R as type `RTYPE`.
+ When these are the same (`direct`), R uses the C++ vector's memory.
+ Otherwise, the column is copied into an R vector (stored in `data2`)
+ the first time R asks for a pointer to its data.
+ */
+template <typename T, int RTYPE>
+struct NumColumn {
+
+    typedef typename RVec<RTYPE>::type R_t;
+    static const bool direct = std::is_same<T, R_t>::value;
+    static R_altrep_class_t cls;
+
+    static SEXP make(const OutputPtr& owner, std::vector<T>& values) {
+        return new_column__<T>(cls, owner, values);
+    }
+
+    static SEXP materialize(SEXP x) {
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) return m;
+        std::vector<T>& values(column_ref__<T>(x).values);
+        m = PROTECT(Rf_allocVector(RTYPE, values.size()));
+        std::copy(values.begin(), values.end(), RVec<RTYPE>::ptr(m));
+        R_set_altrep_data2(x, m);
+        std::vector<T>().swap(values);
+        UNPROTECT(1);
+        return m;
+    }
+
+    static R_xlen_t length(SEXP x) {
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) return XLENGTH(m);
+        return column_ref__<T>(x).values.size();
+    }
+
+    static Rboolean inspect(SEXP x, int pre, int deep, int pvec,
+                            void (*inspect_sub)(SEXP, int, int, int)) {
+        Rprintf("clonewars output column (%s)\n",
+                R_altrep_data2(x) != R_NilValue ? "copied" : "not copied");
+        return TRUE;
+    }
+
+    static void* dataptr(SEXP x, Rboolean writeable) {
+        if (direct && R_altrep_data2(x) == R_NilValue) {
+            std::vector<T>& values(column_ref__<T>(x).values);
+            if (!values.empty()) return static_cast<void*>(values.data());
+        }
+        return static_cast<void*>(RVec<RTYPE>::ptr(materialize(x)));
+    }
+
+    static const void* dataptr_or_null(SEXP x) {
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) return static_cast<const void*>(RVec<RTYPE>::ptr(m));
+        if (direct) {
+            std::vector<T>& values(column_ref__<T>(x).values);
+            if (!values.empty()) return static_cast<const void*>(values.data());
+        }
+        return nullptr;
+    }
+
+    static R_t elt(SEXP x, R_xlen_t i) {
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) return RVec<RTYPE>::ptr(m)[i];
+        return static_cast<R_t>(column_ref__<T>(x).values[i]);
+    }
+
+    static R_xlen_t get_region(SEXP x, R_xlen_t i, R_xlen_t n, R_t* buf) {
+        R_xlen_t len = length(x);
+        if (i >= len) return 0;
+        if (n > len - i) n = len - i;
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) {
+            const R_t* p = RVec<RTYPE>::ptr(m) + i;
+            std::copy(p, p + n, buf);
+        } else {
+            const std::vector<T>& values(column_ref__<T>(x).values);
+            for (R_xlen_t j = 0; j < n; j++) buf[j] = static_cast<R_t>(values[i+j]);
+        }
+        return n;
+    }
+
+    static void init(const char* name, DllInfo* dll) {
+        cls = RVec<RTYPE>::make_class(name, dll);
+        R_set_altrep_Length_method(cls, length);
+        R_set_altrep_Inspect_method(cls, inspect);
+        R_set_altvec_Dataptr_method(cls, dataptr);
+        R_set_altvec_Dataptr_or_null_method(cls, dataptr_or_null);
+        RVec<RTYPE>::set_methods(cls, elt, get_region);
+        return;
+    }
+};
+template <typename T, int RTYPE>
+R_altrep_class_t NumColumn<T, RTYPE>::cls;
+
+
+
+/*
+ Character column.
+ Strings are made one at a time when R asks for elements, and the whole
+ column is only copied when R asks for a pointer to its data or changes it.
+ */
+struct StrColumn {
+
+    static R_altrep_class_t cls;
+
+    static SEXP make(const OutputPtr& owner, std::vector<std::string>& values) {
+        return new_column__<std::string>(cls, owner, values);
+    }
+
+    static SEXP mkchar__(const std::string& s) {
+        return Rf_mkCharLenCE(s.data(), s.size(), CE_UTF8);
+    }
+
+    static SEXP materialize(SEXP x) {
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) return m;
+        std::vector<std::string>& values(column_ref__<std::string>(x).values);
+        m = PROTECT(Rf_allocVector(STRSXP, values.size()));
+        for (R_xlen_t i = 0; i < static_cast<R_xlen_t>(values.size()); i++) {
+            SET_STRING_ELT(m, i, mkchar__(values[i]));
+        }
+        R_set_altrep_data2(x, m);
+        std::vector<std::string>().swap(values);
+        UNPROTECT(1);
+        return m;
+    }
+
+    static R_xlen_t length(SEXP x) {
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) return XLENGTH(m);
+        return column_ref__<std::string>(x).values.size();
+    }
+
+    static Rboolean inspect(SEXP x, int pre, int deep, int pvec,
+                            void (*inspect_sub)(SEXP, int, int, int)) {
+        Rprintf("clonewars output column (%s)\n",
+                R_altrep_data2(x) != R_NilValue ? "copied" : "not copied");
+        return TRUE;
+    }
+
+    static void* dataptr(SEXP x, Rboolean writeable) {
+        return DATAPTR(materialize(x));
+    }
+
+    static const void* dataptr_or_null(SEXP x) {
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) return DATAPTR(m);
+        return nullptr;
+    }
+
+    static SEXP elt(SEXP x, R_xlen_t i) {
+        SEXP m = R_altrep_data2(x);
+        if (m != R_NilValue) return STRING_ELT(m, i);
+        return mkchar__(column_ref__<std::string>(x).values[i]);
+    }
+
+    static void set_elt(SEXP x, R_xlen_t i, SEXP v) {
+        SET_STRING_ELT(materialize(x), i, v);
+        return;
+    }
+
+    static void init(const char* name, DllInfo* dll) {
+        cls = R_make_altstring_class(name, "clonewars", dll);
+        R_set_altrep_Length_method(cls, length);
+        R_set_altrep_Inspect_method(cls, inspect);
+        R_set_altvec_Dataptr_method(cls, dataptr);
+        R_set_altvec_Dataptr_or_null_method(cls, dataptr_or_null);
+        R_set_altstring_Elt_method(cls, elt);
+        R_set_altstring_Set_elt_method(cls, set_elt);
+        return;
+    }
+};
+R_altrep_class_t StrColumn::cls;
+
+
+// Integer columns in R (`rep`, `time`, `patch`):
+typedef NumColumn<uint32, INTSXP> UintIntColumn;
+// Double columns in R (`cage`, which has always been returned as a double):
+typedef NumColumn<uint32, REALSXP> UintDblColumn;
+// Abundances:
+typedef NumColumn<output_t, REALSXP> OutputColumn;
+
+
+#endif
+
+
+
+// [[Rcpp::init]]
+void init_altrep_classes(DllInfo* dll) {
+#ifdef CLONEWARS_ALTREP
+    UintIntColumn::init("clonewars_uint_int", dll);
+    UintDblColumn::init("clonewars_uint_dbl", dll);
+    OutputColumn::init("clonewars_output", dll);
+    StrColumn::init("clonewars_str", dll);
+#endif
+    return;
+}
+
+
+
+// Set attributes to make a list a data frame (without copying its columns):
+List data_frame__(List columns, const R_xlen_t& n_rows) {
+    columns.attr("row.names") = IntegerVector::create(NA_INTEGER, -n_rows);
+    columns.attr("class") = "data.frame";
+    return columns;
+}
+
+
+
+/*
+ "summary" data frame from summaries across reps (see `EnsembleSummary`),
+ with one column per quantile (named like `q2.5` for `0.025`).
+ It's small, so it's just copied.
+ */
+List summary_data_frame__(SimOutput& output) {
+    const R_xlen_t n = output.summary_time.size();
+    const uint32 n_probs = output.summary_probs.size();
+    List summary(6 + n_probs);
+    CharacterVector names(6 + n_probs);
+    summary[0] = output.summary_time;
+    summary[1] = output.summary_cage;
+    summary[2] = output.summary_line;
+    summary[3] = output.summary_type;
+    summary[4] = output.summary_n;
+    summary[5] = output.summary_mean;
+    names[0] = "time";
+    names[1] = "cage";
+    names[2] = "line";
+    names[3] = "type";
+    names[4] = "n";
+    names[5] = "mean";
+    for (uint32 i = 0; i < n_probs; i++) {
+        summary[6 + i] = output.summary_quantiles[i];
+        std::ostringstream name;
+        name << 'q' << output.summary_probs[i] * 100;
+        names[6 + i] = name.str();
+    }
+    summary.names() = names;
+    return data_frame__(summary, n);
+}
+
+
+List output_list__(SimOutput& output) {
+
+    const R_xlen_t n = output.N.size();
+    const R_xlen_t nw = output.wasp_N.size();
+    const R_xlen_t ne = output.event_time.size();
+    const bool sparse = output.sparse;
+    const bool ensemble = !output.summary_probs.empty();
+    List summary;
+    if (ensemble) summary = summary_data_frame__(output);
+
+#ifdef CLONEWARS_ALTREP
+
+    OutputPtr owner = std::make_shared<SimOutput>();
+    SimOutput& o(*owner);
+    o.rep.swap(output.rep);
+    o.time.swap(output.time);
+    o.cage.swap(output.cage);
+    o.patch.swap(output.patch);
+    o.line.swap(output.line);
+    o.type.swap(output.type);
+    o.N.swap(output.N);
+    o.wasp_rep.swap(output.wasp_rep);
+    o.wasp_time.swap(output.wasp_time);
+    o.wasp_cage.swap(output.wasp_cage);
+    o.wasp_N.swap(output.wasp_N);
+    o.event_rep.swap(output.event_rep);
+    o.event_time.swap(output.event_time);
+    o.event_cage.swap(output.event_cage);
+    o.event_patch.swap(output.event_patch);
+    o.event_line.swap(output.event_line);
+    o.event_type.swap(output.event_type);
+
+    // (assigned one at a time so each is protected before the next is made)
+    List aphids(7);
+    aphids[0] = UintIntColumn::make(owner, o.rep);
+    aphids[1] = UintIntColumn::make(owner, o.time);
+    aphids[2] = UintDblColumn::make(owner, o.cage);
+    aphids[3] = UintIntColumn::make(owner, o.patch);
+    aphids[4] = StrColumn::make(owner, o.line);
+    aphids[5] = StrColumn::make(owner, o.type);
+    aphids[6] = OutputColumn::make(owner, o.N);
+    aphids.names() = CharacterVector::create("rep", "time", "cage", "patch",
+                                             "line", "type", "N");
+    List wasps(4);
+    wasps[0] = UintIntColumn::make(owner, o.wasp_rep);
+    wasps[1] = UintIntColumn::make(owner, o.wasp_time);
+    wasps[2] = UintDblColumn::make(owner, o.wasp_cage);
+    wasps[3] = OutputColumn::make(owner, o.wasp_N);
+    wasps.names() = CharacterVector::create("rep", "time", "cage", "wasps");
+    List events(6);
+    events[0] = UintIntColumn::make(owner, o.event_rep);
+    events[1] = UintIntColumn::make(owner, o.event_time);
+    events[2] = UintDblColumn::make(owner, o.event_cage);
+    events[3] = UintIntColumn::make(owner, o.event_patch);
+    events[4] = StrColumn::make(owner, o.event_line);
+    events[5] = StrColumn::make(owner, o.event_type);
+    events.names() = CharacterVector::create("rep", "time", "cage", "patch",
+                                             "line", "event");
+
+#else
+
+    List aphids = List::create(_["rep"] = output.rep,
+                               _["time"] = output.time,
+                               _["cage"] = output.cage,
+                               _["patch"] = output.patch,
+                               _["line"] = output.line,
+                               _["type"] = output.type,
+                               _["N"] = output.N);
+    List wasps = List::create(_["rep"] = output.wasp_rep,
+                              _["time"] = output.wasp_time,
+                              _["cage"] = output.wasp_cage,
+                              _["wasps"] = output.wasp_N);
+    List events = List::create(_["rep"] = output.event_rep,
+                               _["time"] = output.event_time,
+                               _["cage"] = output.event_cage,
+                               _["patch"] = output.event_patch,
+                               _["line"] = output.event_line,
+                               _["event"] = output.event_type);
+    SimOutput empty;
+    empty.snapshots.swap(output.snapshots);
+    empty.phase_times.swap(output.phase_times);
+    std::swap(output, empty);
+
+#endif
+
+    List out = List::create(_["aphids"] = data_frame__(aphids, n),
+                            _["wasps"] = data_frame__(wasps, nw));
+    if (sparse) out.push_back(data_frame__(events, ne), "events");
+    if (ensemble) out.push_back(summary, "summary");
+
+    return out;
+}
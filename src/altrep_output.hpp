@@ -0,0 +1,21 @@
+# ifndef __CLONEWARS_ALTREP_OUTPUT_H
+# define __CLONEWARS_ALTREP_OUTPUT_H
+
+
+#include <RcppArmadillo.h>      // Rcpp
+#include "simulations.hpp"      // SimOutput
+
+
+/*
+ List of "aphids" and "wasps" data frames (plus "events" for sparse output
+ and "summary" for summaries across reps) from the columns in `output`,
+ which are moved out of it (`output` is left with empty columns).
+
+ In R >= 3.6, the columns are ALTREP vectors that keep using the C++ vectors
+ instead of being copied into R (see `altrep_output.cpp`).
+ */
+Rcpp::List output_list__(SimOutput& output);
+
+
+
+#endif
@@ -1,13 +1,17 @@
 
-#include <RcppArmadillo.h>      // arma namespace
+#include "rcpp_compat.hpp"      // arma namespace
 #include <vector>               // vector class
 #include <random>               // normal distribution
+#include <algorithm>            // copy
 #include <pcg/pcg_random.hpp>   // pcg prng
 #include "clonewars_types.hpp"  // integer types
 #include "aphids.hpp"           // aphid classes
 #include "wasps.hpp"            // wasp classes
 #include "patches.hpp"          // patch classes
 #include "pcg.hpp"              // runif_ fxns
+#include "arena.hpp"            // arena_vector, ArenaBuffer
+#include "stages.hpp"           // stage kernels
+#include "phase_timer.hpp"      // PhaseScope
 
 
 
@@ -29,14 +33,29 @@ void AphidTypePop::process_error(const double& z,
 
     uint32 n_stages = X.n_elem;
 
-    arma::mat Se(n_stages, n_stages, arma::fill::zeros);
-
-    Se = (sigma_x*sigma_x + demog_mult * std::min(0.5, 1 / std::abs(1 + z))) *
-        (rho * arma::mat(n_stages,n_stages,arma::fill::ones) +
-        (1-rho) * arma::mat(n_stages,n_stages,arma::fill::eye));
+    /*
+     This runs every day for every line, so the matrices below use scratch
+     memory from this thread's `RepArena` instead of allocating their own
+     (see `ArenaBuffer` in `arena.hpp`).
+     */
+    ArenaBuffer<double> Se_mem(n_stages * n_stages);
+    arma::mat Se(Se_mem.data(), n_stages, n_stages, false, true);
+
+    // Same values as `var * (rho * ones + (1-rho) * eye)`:
+    const double var = sigma_x*sigma_x + demog_mult * std::min(0.5, 1 / std::abs(1 + z));
+    for (uint32 j = 0; j < n_stages; j++) {
+        for (uint32 i = 0; i < n_stages; i++) {
+            Se(i,j) = var * ((i == j) ? (rho + (1-rho)) : rho);
+        }
+    }
 
     // chol doesn't work with zeros on diagonal
-    arma::uvec non_zero = arma::find(Se.diag() > 0);
+    ArenaBuffer<arma::uword> non_zero_mem(n_stages);
+    uint32 n_nz = 0;
+    for (uint32 i = 0; i < n_stages; i++) {
+        if (Se(i,i) > 0) non_zero_mem.data()[n_nz++] = i;
+    }
+    arma::uvec non_zero(non_zero_mem.data(), n_nz, false, true);
 
     /*
      Cholesky decomposition of Se so output has correct variance-covariance
@@ -44,28 +63,37 @@ void AphidTypePop::process_error(const double& z,
        "a vector of independent normal random variables,
        when multiplied by the transpose of the Cholesky deposition of [Se] will
        have covariance matrix equal to [Se]."
+     This stays in Armadillo (i.e., LAPACK) so that results are the same as
+     they've always been; `check_args` makes sure `Se` is positive definite.
      */
-    arma::mat chol_decomp = arma::chol(Se(non_zero,non_zero)).t();
+    ArenaBuffer<double> chol_mem(n_nz * n_nz);
+    arma::mat chol_decomp(chol_mem.data(), n_nz, n_nz, false, true);
+    chol_decomp = Se(non_zero,non_zero);
+    if (!arma::chol(chol_decomp, chol_decomp)) stop("chol(): decomposition failed");
+    arma::inplace_trans(chol_decomp);
 
     // Random numbers from distribution N(0,1)
-    arma::vec E(non_zero.n_elem);
+    ArenaBuffer<double> E_mem(n_nz);
+    arma::vec E(E_mem.data(), n_nz, false, true);
     for (uint32 i = 0; i < E.n_elem; i++) E(i) = norm_distr(eng);
 
     // Making each element of E have correct variance-covariance matrix
-    E = chol_decomp * E;
+    ArenaBuffer<double> E_cov_mem(n_nz);
+    arma::vec E_cov(E_cov_mem.data(), n_nz, false, true);
+    E_cov = chol_decomp * E;
 
     // Plugging in errors into the X[t+1] vector
     for (uint32 i = 0; i < non_zero.n_elem; i++) {
-        X(non_zero(i)) *= std::exp(E(i));
+        X(non_zero(i)) *= std::exp(E_cov(i));
     }
 
     return;
 
 }
 
-void AphidPop::process_error(const arma::vec& apterous_Xt,
-                             const arma::vec& alates_Xt,
-                             const arma::vec& paras_Xt,
+void AphidPop::process_error(const double* apterous_Xt,
+                             const double* alates_Xt,
+                             const double* paras_Xt,
                              const double& z,
                              pcg32& eng) {
 
@@ -81,15 +109,9 @@ void AphidPop::process_error(const arma::vec& apterous_Xt,
      on day t was not allowed to exceed the number in the preceding age class on
      day t – 1.
     */
-    for (uint32 i = 1; i < apterous.X.n_elem; i++) {
-        if (apterous.X(i) > apterous_Xt(i-1)) apterous.X(i) = apterous_Xt(i-1);
-    }
-    for (uint32 i = 1; i < alates.X.n_elem; i++) {
-        if (alates.X(i) > alates_Xt(i-1)) alates.X(i) = alates_Xt(i-1);
-    }
-    for (uint32 i = 1; i < paras.X.n_elem; i++) {
-        if (paras.X(i) > paras_Xt(i-1)) paras.X(i) = paras_Xt(i-1);
-    }
+    apterous.N_ = cap_stages__(apterous.X.memptr(), apterous_Xt, apterous.X.n_elem);
+    alates.N_ = cap_stages__(alates.X.memptr(), alates_Xt, alates.X.n_elem);
+    paras.N_ = cap_stages__(paras.X.memptr(), paras_Xt, paras.X.n_elem);
 
     return;
 
@@ -127,7 +149,8 @@ double ApterousPop::alate_prop(const OnePatch* patch) const {
  are patches.
  */
 
-void AphidPop::calc_dispersal(const OnePatch* patch,
+template <bool disp_error>
+bool AphidPop::calc_dispersal(const OnePatch* patch,
                               arma::mat& emigrants,
                               arma::mat& immigrants,
                               pcg32& eng) const {
@@ -135,18 +158,21 @@ void AphidPop::calc_dispersal(const OnePatch* patch,
     const uint32& this_j(patch->this_j);
     const uint32& n_patches(patch->n_patches);
 
-    if (arma::accu(alates.X) == 0 || n_patches == 1 || alates.disp_rate() <= 0) return;
+    if (alates.total_aphids() == 0 || n_patches == 1 || alates.disp_rate() <= 0) {
+        return false;
+    }
 
     // Abundance for alates. (Only adult alates can disperse.)
     const arma::vec& X_disp(alates.X);
 
     arma::rowvec n_leaving(n_patches);
-    arma::rowvec n_leaving_alive(n_patches);
 
-    // Sample dispersal for each dispersing stage:
+    // Dispersal for each dispersing stage:
     for (uint32 i = alates.disp_start(); i < X_disp.n_elem; i++) {
 
-        if (X_disp(i) < 1) continue;
+        if (disp_error) {
+            if (X_disp(i) < 1) continue;
+        } else if (X_disp(i) == 0) continue;
 
         /*
          Calculate emigration, or the # aphids that leave the patch:
@@ -154,34 +180,40 @@ void AphidPop::calc_dispersal(const OnePatch* patch,
         // Calculate lambda. (We're splitting dispersers over # of other patches.)
         double lambda_ = alates.disp_rate() * X_disp(i) /
             static_cast<double>(n_patches - 1);
-        pois_distr.param(std::poisson_distribution<uint32>::param_type(lambda_));
-        for (uint32 j = 0; j < n_patches; j++) {
-            if (j == this_j) {
-                n_leaving(j) = 0;
-            } else n_leaving(j) = pois_distr(eng);
-        }
-        // Making absolutely sure that dispersal never exceeds the number possible:
-        double total_emigrants = arma::accu(n_leaving);
-        if (total_emigrants > X_disp(i)) {
-            double extras = total_emigrants - X_disp(i);
-            std::vector<uint32> extra_inds;
-            extra_inds.reserve(n_patches);
+
+        if (disp_error) {
+            pois_distr.param(std::poisson_distribution<uint32>::param_type(lambda_));
             for (uint32 j = 0; j < n_patches; j++) {
-                if (n_leaving(j) > 0) extra_inds.push_back(j);
+                if (j == this_j) {
+                    n_leaving(j) = 0;
+                } else n_leaving(j) = pois_distr(eng);
             }
-            while (extras > 0) {
-                uint32 rnd = runif_01(eng) * extra_inds.size();
-                n_leaving(extra_inds[rnd])--;
-                if (n_leaving(extra_inds[rnd]) == 0) {
-                    extra_inds.erase(extra_inds.begin() + rnd);
+            // Making absolutely sure that dispersal never exceeds the number possible:
+            double total_emigrants = arma::accu(n_leaving);
+            if (total_emigrants > X_disp(i)) {
+                double extras = total_emigrants - X_disp(i);
+                arena_vector<uint32> extra_inds;
+                extra_inds.reserve(n_patches);
+                for (uint32 j = 0; j < n_patches; j++) {
+                    if (n_leaving(j) > 0) extra_inds.push_back(j);
+                }
+                while (extras > 0) {
+                    uint32 rnd = runif_01(eng) * extra_inds.size();
+                    n_leaving(extra_inds[rnd])--;
+                    if (n_leaving(extra_inds[rnd]) == 0) {
+                        extra_inds.erase(extra_inds.begin() + rnd);
+                    }
+                    extras--;
+                    total_emigrants--;
                 }
-                extras--;
-                total_emigrants--;
             }
+            emigrants(i, this_j) = total_emigrants;
+        } else {
+            n_leaving.fill(lambda_);
+            n_leaving(this_j) = 0;
+            emigrants(i, this_j) = arma::accu(n_leaving);
         }
 
-        emigrants(i, this_j) = total_emigrants;
-
         /*
          Calculate immigration, or the number leaving that stay alive to get to
          another patch.
@@ -192,63 +224,22 @@ void AphidPop::calc_dispersal(const OnePatch* patch,
             // If mortality is zero, then all emigrants survive:
             immigrants.row(i) += n_leaving;
         } else if (alates.disp_mort() < 1) {
-            // If mortality is >0 and <1, then we have to sample for the # that survive:
-            for (uint32 j = 0; j < n_patches; j++) {
-                if (j == this_j || n_leaving(j) == 0) continue;
-                // Sample number leaving that stay alive to immigrate:
-                bino_distr.param(std::binomial_distribution<uint32>::param_type(
-                        n_leaving(j), 1 - alates.disp_mort()));
-                immigrants(i,j) += static_cast<double>(bino_distr(eng));
-            }
-        }
-
-    }
-
-
-    return;
-}
-
-
-
-
-// Same as above, but with no stochasticity
-void AphidPop::calc_dispersal(const OnePatch* patch,
-                              arma::mat& emigrants,
-                              arma::mat& immigrants) const {
-
-    const uint32& this_j(patch->this_j);
-    const uint32& n_patches(patch->n_patches);
-
-    if (arma::accu(alates.X) == 0 || n_patches == 1 || alates.disp_rate() <= 0) return;
-
-
-    // Abundance for alates. (Only adult alates can disperse.)
-    const arma::vec& X_disp(alates.X);
-
-    arma::rowvec n_leaving(n_patches);
-    arma::rowvec n_leaving_alive(n_patches);
-
-    // Dispersal for each dispersing stage:
-    for (uint32 i = alates.disp_start(); i < X_disp.n_elem; i++) {
-
-        if (X_disp(i) == 0) continue;
-
-        double lambda_ = alates.disp_rate() * X_disp(i) /
-            static_cast<double>(n_patches - 1);
-        n_leaving.fill(lambda_);
-        n_leaving(this_j) = 0;
-        emigrants(i, this_j) = arma::accu(n_leaving);
-
-        if (alates.disp_mort() <= 0) {
-            immigrants.row(i) += n_leaving;
-        } else if (alates.disp_mort() < 1) {
-            immigrants.row(i) += n_leaving * (1 - alates.disp_mort());
+            if (disp_error) {
+                // If mortality is >0 and <1, then we have to sample for the # that survive:
+                for (uint32 j = 0; j < n_patches; j++) {
+                    if (j == this_j || n_leaving(j) == 0) continue;
+                    // Sample number leaving that stay alive to immigrate:
+                    bino_distr.param(std::binomial_distribution<uint32>::param_type(
+                            n_leaving(j), 1 - alates.disp_mort()));
+                    immigrants(i,j) += static_cast<double>(bino_distr(eng));
+                }
+            } else immigrants.row(i) += n_leaving * (1 - alates.disp_mort());
         }
 
     }
 
 
-    return;
+    return true;
 }
 
 
@@ -260,6 +251,7 @@ void AphidPop::calc_dispersal(const OnePatch* patch,
  to be added to the wasps.
  */
 
+template <bool proc_error, uint32 max_stages>
 double AphidPop::update(const OnePatch* patch,
                         const WaspPop* wasps,
                         const arma::vec& emigrants,
@@ -268,129 +260,136 @@ double AphidPop::update(const OnePatch* patch,
 
 
     // First subtract emigrants and add immigrants:
-    alates.X -= emigrants;
-    alates.X += immigrants;
+    alates.disperse(emigrants, immigrants);
 
     double nm = 0; // newly mummified
 
     if (total_aphids() > 0) {
 
-        const double& z(patch->z);
+        const uint32 n = apterous.X.n_elem;
+        const uint32 n_paras = paras.X.n_elem;
+
         const double& S(patch->S);
         const double& S_y(patch->S_y);
-        arma::vec A = wasps->A(attack_surv);
+        StageBuffer<max_stages> A(n);
+        wasps->A(attack_surv, A.data);
         double pred_surv = 1 - patch->pred_rate;
 
         // Starting abundances (used in `process_error`):
-        arma::vec apterous_Xt = apterous.X;
-        arma::vec alates_Xt = alates.X;
-        arma::vec paras_Xt = paras.X;
+        StageBuffer<max_stages> apterous_Xt(proc_error ? n : 0);
+        StageBuffer<max_stages> alates_Xt(proc_error ? n : 0);
+        StageBuffer<0> paras_Xt(proc_error ? n_paras : 0);
+        if (proc_error) {
+            std::copy(apterous.X.begin(), apterous.X.end(), apterous_Xt.data);
+            std::copy(alates.X.begin(), alates.X.end(), alates_Xt.data);
+            std::copy(paras.X.begin(), paras.X.end(), paras_Xt.data);
+        }
 
 
         // Basic updates for non-parasitized aphids:
-        arma::mat LX_apt = apterous.leslie_ * apterous.X;
-        arma::mat LX_ala = alates.leslie_ * alates.X;
-        apterous.X = pred_surv * S * A % LX_apt;
-        alates.X = pred_surv * S * A % LX_ala;
+        StageBuffer<max_stages> LX_apt(n);
+        StageBuffer<max_stages> LX_ala(n);
+        leslie_step__(apterous.leslie_.memptr(), apterous.X.memptr(),
+                      LX_apt.data, n);
+        leslie_step__(alates.leslie_.memptr(), alates.X.memptr(),
+                      LX_ala.data, n);
+        apterous.N_ = survive_attack__(apterous.X.memptr(), A.data,
+                                       LX_apt.data, pred_surv * S, n);
+        alates.N_ = survive_attack__(alates.X.memptr(), A.data,
+                                     LX_ala.data, pred_surv * S, n);
 
         double np = 0; // newly parasitized
-        np += pred_surv * S_y * arma::as_scalar((1 - A).t() * LX_apt);
-        np += pred_surv * S_y * arma::as_scalar((1 - A).t() * LX_ala);
+        np += pred_surv * S_y * parasitized__(A.data, LX_apt.data, n);
+        np += pred_surv * S_y * parasitized__(A.data, LX_ala.data, n);
 
         nm += pred_surv * paras.X.back();  // newly mummified
 
         // alive but parasitized
-        if (paras.X.n_elem > 1) {
-            for (uint32 i = paras.X.n_elem - 1; i > 0; i--) {
-                paras.X(i) = pred_surv * paras.s(i) * S_y * paras.X(i-1);
-            }
+        paras.N_ = np;
+        if (n_paras > 1) {
+            paras.N_ += shift_parasitized__(paras.X.memptr(), paras.s.memptr(),
+                                            pred_surv, S_y, n_paras);
         }
         paras.X.front() = np;
 
 
-        // Process error
-        process_error(apterous_Xt, alates_Xt, paras_Xt, z, eng);
-
-
-        // Sample for # offspring from apterous aphids that are alates:
+        // # offspring from apterous aphids that are alates:
         double new_alates = 0;
         double alate_prop = apterous.alate_prop(patch);
-        if (alate_prop > 0 && apterous.X.front() > 0) {
-            double lambda_ = alate_prop * apterous.X.front();
-            pois_distr.param(std::poisson_distribution<uint32>::param_type(lambda_));
-            new_alates = static_cast<double>(pois_distr(eng));
-            if (new_alates > apterous.X.front()) new_alates = apterous.X.front();
-        }
 
-        /*
-         All alate offspring are assumed to be apterous,
-         so the only way to get new alates is from apterous aphids.
-         */
-        apterous.X.front() -= new_alates;
-        apterous.X.front() += alates.X.front(); // <-- we assume alates make apterous
-        alates.X.front() = new_alates;
-
-    }
-
-    return nm;
-}
+        if (proc_error) {
 
-// Same as above, but no randomness in alate production:
-double AphidPop::update(const OnePatch* patch,
-                        const WaspPop* wasps,
-                        const arma::vec& emigrants,
-                        const arma::vec& immigrants) {
-
-    // First subtract emigrants and add immigrants:
-    alates.X -= emigrants;
-    alates.X += immigrants;
-
-    double nm = 0; // newly mummified
-
-    if (total_aphids() > 0) {
-
-        const double& S(patch->S);
-        const double& S_y(patch->S_y);
-        arma::vec A = wasps->A(attack_surv);
-        double pred_surv = 1 - patch->pred_rate;
-
-        // Basic updates for unparasitized aphids:
-        arma::mat LX_apt = apterous.leslie_ * apterous.X;
-        arma::mat LX_ala = alates.leslie_ * alates.X;
-        apterous.X = (pred_surv * S * A) % LX_apt;
-        alates.X = (pred_surv * S * A) % LX_ala;
-
-        double np = 0; // newly parasitized
-        np += pred_surv * S_y * arma::as_scalar((1 - A).t() * LX_apt);
-        np += pred_surv * S_y * arma::as_scalar((1 - A).t() * LX_ala);
-
-        nm += pred_surv * paras.X.back();  // newly mummified
-
-        // alive but parasitized
-        if (paras.X.n_elem > 1) {
-            for (uint32 i = paras.X.n_elem - 1; i > 0; i--) {
-                paras.X(i) = pred_surv * paras.s(i) * S_y * paras.X(i-1);
+            // Process error
+            {
+                PhaseScope timer(phase::process_error);
+                process_error(apterous_Xt.data, alates_Xt.data,
+                              paras_Xt.data, patch->z, eng);
             }
-        }
-        paras.X.front() = np;
 
-        // # offspring from apterous aphids that are alates:
-        double new_alates = apterous.alate_prop(patch);
-        new_alates *= apterous.X.front();
+            // Sample for # offspring from apterous aphids that are alates:
+            if (alate_prop > 0 && apterous.X.front() > 0) {
+                double lambda_ = alate_prop * apterous.X.front();
+                pois_distr.param(std::poisson_distribution<uint32>::param_type(lambda_));
+                new_alates = static_cast<double>(pois_distr(eng));
+                if (new_alates > apterous.X.front()) new_alates = apterous.X.front();
+            }
 
+        } else new_alates = alate_prop * apterous.X.front();
 
         /*
          All alate offspring are assumed to be apterous,
          so the only way to get new alates is from apterous aphids.
          */
+        const double apterous_0 = apterous.X.front();
+        const double alates_0 = alates.X.front();
         apterous.X.front() -= new_alates;
-        apterous.X.front() += alates.X.front(); // <-- we assume alates make apterous
+        apterous.X.front() += alates_0; // <-- we assume alates make apterous
         alates.X.front() = new_alates;
+        apterous.N_ += (apterous.X.front() - apterous_0);
+        alates.N_ += (new_alates - alates_0);
 
     }
 
-
     return nm;
 }
 
 
+
+template bool AphidPop::calc_dispersal<true>(const OnePatch* patch,
+                                             arma::mat& emigrants,
+                                             arma::mat& immigrants,
+                                             pcg32& eng) const;
+template bool AphidPop::calc_dispersal<false>(const OnePatch* patch,
+                                              arma::mat& emigrants,
+                                              arma::mat& immigrants,
+                                              pcg32& eng) const;
+template double AphidPop::update<true, 0>(const OnePatch* patch,
+                                          const WaspPop* wasps,
+                                          const arma::vec& emigrants,
+                                          const arma::vec& immigrants,
+                                          pcg32& eng);
+template double AphidPop::update<true, stage_limits::up_to_32>(const OnePatch* patch,
+                                                               const WaspPop* wasps,
+                                                               const arma::vec& emigrants,
+                                                               const arma::vec& immigrants,
+                                                               pcg32& eng);
+template double AphidPop::update<true, stage_limits::up_to_64>(const OnePatch* patch,
+                                                               const WaspPop* wasps,
+                                                               const arma::vec& emigrants,
+                                                               const arma::vec& immigrants,
+                                                               pcg32& eng);
+template double AphidPop::update<false, 0>(const OnePatch* patch,
+                                           const WaspPop* wasps,
+                                           const arma::vec& emigrants,
+                                           const arma::vec& immigrants,
+                                           pcg32& eng);
+template double AphidPop::update<false, stage_limits::up_to_32>(const OnePatch* patch,
+                                                                const WaspPop* wasps,
+                                                                const arma::vec& emigrants,
+                                                                const arma::vec& immigrants,
+                                                                pcg32& eng);
+template double AphidPop::update<false, stage_limits::up_to_64>(const OnePatch* patch,
+                                                                const WaspPop* wasps,
+                                                                const arma::vec& emigrants,
+                                                                const arma::vec& immigrants,
+                                                                pcg32& eng);
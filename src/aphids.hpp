@@ -1,13 +1,15 @@
 # ifndef __CLONEWARS_APHIDS_H
 # define __CLONEWARS_APHIDS_H
 
-#include <RcppArmadillo.h>      // arma namespace
+#include "rcpp_compat.hpp"      // arma namespace
 #include <vector>               // vector class
 #include <random>               // normal distribution
 #include <pcg/pcg_random.hpp>   // pcg prng
 #include "clonewars_types.hpp"  // integer types
+#include "serialize.hpp"        // StateWriter, StateReader
 #include "wasps.hpp"            // wasp classes
 #include "math.hpp"             // inv_logit__
+#include "stages.hpp"           // stage kernels
 
 
 
@@ -28,6 +30,12 @@ protected:
 
     arma::mat leslie_;       // Leslie matrix with survival and reproduction
     arma::vec X_0_;          // initial aphid abundances by stage
+    /*
+     Total of `X`. This is updated whenever this class (or `AphidPop`) changes `X`,
+     so that `total_aphids()` doesn't have to sum over stages every time.
+     Anything else that changes `X` needs to call `refresh_total()` afterward.
+     */
+    double N_;
 
 
 public:
@@ -37,21 +45,24 @@ public:
     /*
      Constructors
      */
-    AphidTypePop() : leslie_(), X_0_(), X() {};
+    AphidTypePop() : leslie_(), X_0_(), N_(0), X() {};
     AphidTypePop(const arma::mat& leslie_mat,
                  const arma::vec& aphid_density_0)
         : leslie_(leslie_mat),
           X_0_(aphid_density_0),
+          N_(arma::accu(aphid_density_0)),
           X(aphid_density_0) {};
 
     AphidTypePop(const AphidTypePop& other)
         : leslie_(other.leslie_),
           X_0_(other.X_0_),
+          N_(other.N_),
           X(other.X) {};
 
     AphidTypePop& operator=(const AphidTypePop& other) {
         leslie_ = other.leslie_;
         X_0_ = other.X_0_;
+        N_ = other.N_;
         X = other.X;
         return *this;
     }
@@ -61,17 +72,24 @@ public:
      Total aphids
      */
     inline double total_aphids() const {
-        return arma::accu(X);
+        return N_;
+    }
+    // Re-calculate total after `X` was changed from outside this class
+    inline void refresh_total() {
+        N_ = arma::accu(X);
+        return;
     }
 
     // Kill all aphids
     inline void clear() {
         X.fill(0);
+        N_ = 0;
         return;
     }
     // Kill some of aphids
     inline void clear(const double& surv) {
         X *= surv;
+        N_ *= surv;
         return;
     }
 
@@ -87,6 +105,18 @@ public:
     const arma::mat& leslie() const {return leslie_;}
     const arma::vec& X_0() const {return X_0_;}
 
+    // Save and restore state (see `serialize.hpp`)
+    void save_state(StateWriter& out) const {
+        out.write(X);
+        out.write(N_);
+        return;
+    }
+    void load_state(StateReader& in) {
+        in.read(X);
+        in.read(N_);
+        return;
+    }
+
 
 };
 
@@ -164,6 +194,27 @@ public:
         return *this;
     }
 
+    // Add alates by stage (e.g., from another cage)
+    inline void add(const arma::vec& D) {
+        N_ = 0;
+        for (uint32 i = 0; i < X.n_elem; i++) {
+            X(i) += D(i);
+            N_ += X(i);
+        }
+        return;
+    }
+
+    // Subtract emigrants and add immigrants (both by stage)
+    inline void disperse(const arma::vec& emigrants,
+                         const arma::vec& immigrants) {
+        N_ = 0;
+        for (uint32 i = 0; i < X.n_elem; i++) {
+            X(i) -= emigrants(i);
+            X(i) += immigrants(i);
+            N_ += X(i);
+        }
+        return;
+    }
 
 
 };
@@ -226,9 +277,9 @@ class AphidPop {
 
     // Process error for all stages, plus checks so that they don't exceed
     // what's possible
-    void process_error(const arma::vec& apterous_Xt,
-                       const arma::vec& alates_Xt,
-                       const arma::vec& paras_Xt,
+    void process_error(const double* apterous_Xt,
+                       const double* alates_Xt,
+                       const double* paras_Xt,
                        const double& z,
                        pcg32& eng);
 
@@ -317,24 +368,47 @@ public:
         return ta;
     }
 
+    // Save and restore state (see `serialize.hpp`)
+    void save_state(StateWriter& out) const {
+        out.write_stream(norm_distr);
+        out.write_stream(pois_distr);
+        out.write_stream(bino_distr);
+        out.write(extinct);
+        apterous.save_state(out);
+        alates.save_state(out);
+        paras.save_state(out);
+        return;
+    }
+    void load_state(StateReader& in) {
+        in.read_stream(norm_distr);
+        in.read_stream(pois_distr);
+        in.read_stream(bino_distr);
+        in.read(extinct);
+        apterous.load_state(in);
+        alates.load_state(in);
+        paras.load_state(in);
+        return;
+    }
+
     /*
      Returns vector of abundances of adults that would be moved between cages,
      given that `disp_prop` is the proportion of winged adults that will be
      moved.
      */
     arma::vec remove_dispersers(const double& disp_prop) {
-        arma::vec D = alates.X;
+        arma::vec D(alates.X.n_elem, arma::fill::zeros);
         uint32 ds = alates.disp_start();
-        D.head(ds).fill(0);
         /*
-         Uncomment below if you want to assume that only young adult alates
-         are moved.
+         Change `D.n_elem` below to `std::min(ds + 7, D.n_elem)` if you want to
+         assume that only young adult alates are moved.
          This could be because older ones are already settled on plants, and
          so that the same alates aren't being moved back and forth.
          */
-        // for (uint32 i = (ds + 7); i < D.n_elem; i++) D(i) = 0;
-        D *= disp_prop;
-        alates.X -= D;
+        for (uint32 i = ds; i < D.n_elem; i++) {
+            D(i) = alates.X(i) * disp_prop;
+            alates.X(i) -= D(i);
+            alates.N_ -= D(i);
+        }
         return D;
     }
 
@@ -359,27 +433,29 @@ public:
     /*
      Calculate dispersal of this line to all other patches.
      Emigration doesn't necessarily == immigration due to disperser mortality.
+     If `disp_error` is false, there's no stochasticity and `eng` isn't used.
+     Returns false if this line can't have written anything to
+     `emigrants` or `immigrants`.
     */
-    void calc_dispersal(const OnePatch* patch,
+    template <bool disp_error>
+    bool calc_dispersal(const OnePatch* patch,
                         arma::mat& emigrants,
                         arma::mat& immigrants,
                         pcg32& eng) const;
-    // Same, but with no stochasticity
-    void calc_dispersal(const OnePatch* patch,
-                        arma::mat& emigrants,
-                        arma::mat& immigrants) const;
 
-    // Update new aphid abundances, return the # newly mummified aphids
+    /*
+     Update new aphid abundances, return the # newly mummified aphids.
+     If `proc_error` is false, there's no randomness in alate production
+     or abundances, and `eng` isn't used.
+     `max_stages` is the most stages there can be, or 0 for no limit
+     (see `stages.hpp`).
+     */
+    template <bool proc_error, uint32 max_stages>
     double update(const OnePatch* patch,
                   const WaspPop* wasps,
                   const arma::vec& emigrants,
                   const arma::vec& immigrants,
                   pcg32& eng);
-    // Same as above, but no randomness in alate production:
-    double update(const OnePatch* patch,
-                  const WaspPop* wasps,
-                  const arma::vec& emigrants,
-                  const arma::vec& immigrants);
 
 };
 
@@ -0,0 +1,255 @@
+# ifndef __CLONEWARS_ARENA_H
+# define __CLONEWARS_ARENA_H
+
+
+#include <vector>               // vector class
+#include <deque>                // deque
+#include <cstdlib>              // malloc, free
+#include <cstddef>              // size_t
+#include <new>                  // bad_alloc
+#include "clonewars_types.hpp"  // integer types
+
+
+
+/*
+ Bump ("arena") allocator for objects that only live for one rep.
+
+ Every thread has its own arena (from `RepArena::local()`).
+ Allocating just moves a pointer forward inside the current block, and
+ `deallocate` only does anything when it's for the most recent allocation.
+ Once a rep is done and all its objects are destroyed, `reset()` makes all
+ blocks available again without freeing them, so the next rep on that
+ thread re-uses the same memory instead of going back to the global heap.
+
+ Armadillo objects that are only needed inside one function (the daily
+ temporaries in process error and carrying capacity) get their memory from
+ here too, using `ArenaBuffer` below.
+ Armadillo objects that hold a rep's state (abundances, Leslie matrices)
+ still use Armadillo's own allocation: they're made once per rep when the
+ cages are built, which `standalone/alloc_stats.cpp` shows is a small part of
+ all allocations.
+ */
+class RepArena {
+
+    struct Block {
+        char* mem;
+        size_t size;
+        Block(char* mem_, const size_t& size_) : mem(mem_), size(size_) {};
+    };
+
+    std::vector<Block> blocks;
+    size_t current;             // index for the block being filled
+    size_t offset;              // position inside `blocks[current]`
+    size_t block_size;          // minimum size of new blocks
+
+    // Make a new block big enough for `n` bytes and put it after `current`
+    void add_block(const size_t& n) {
+        size_t size = (n > block_size) ? n : block_size;
+        char* mem = static_cast<char*>(std::malloc(size));
+        if (mem == nullptr) throw std::bad_alloc();
+        if (blocks.empty()) {
+            blocks.push_back(Block(mem, size));
+            current = 0;
+        } else {
+            blocks.insert(blocks.begin() + current + 1, Block(mem, size));
+            current++;
+        }
+        offset = 0;
+        return;
+    }
+
+public:
+
+    RepArena(const size_t& block_size_ = 65536)
+        : blocks(), current(0), offset(0), block_size(block_size_) {};
+    // Copying would free blocks twice, so don't allow it:
+    RepArena(const RepArena& other) = delete;
+    RepArena& operator=(const RepArena& other) = delete;
+
+    ~RepArena() {
+        release();
+    }
+
+    void* allocate(const size_t& n, const size_t& align) {
+
+        if (!blocks.empty()) {
+            // Check current block, then any blocks left over from previous reps:
+            for (; current < blocks.size(); current++) {
+                size_t start = (offset + align - 1) & ~(align - 1);
+                if (start + n <= blocks[current].size) {
+                    offset = start + n;
+                    return static_cast<void*>(blocks[current].mem + start);
+                }
+                offset = 0;
+            }
+            current = blocks.size() - 1;
+        }
+
+        // (`malloc` returns memory aligned for any built-in type)
+        add_block(n);
+        offset = n;
+        return static_cast<void*>(blocks[current].mem);
+    }
+
+    /*
+     Memory is only given back when it's the most recent allocation
+     (e.g., a vector that just grew); everything else waits for `reset`.
+     */
+    void deallocate(void* p, const size_t& n) noexcept {
+        if (blocks.empty()) return;
+        char* cp = static_cast<char*>(p);
+        if (cp + n == blocks[current].mem + offset) offset -= n;
+        return;
+    }
+
+    // Make all memory available again. Only call this once everything
+    // allocated from here has been destroyed.
+    inline void reset() noexcept {
+        current = 0;
+        offset = 0;
+        return;
+    }
+
+    // Give all memory back to the system.
+    void release() noexcept {
+        for (Block& b : blocks) std::free(b.mem);
+        blocks.clear();
+        current = 0;
+        offset = 0;
+        return;
+    }
+
+    // Total bytes held by this arena
+    size_t capacity() const noexcept {
+        size_t cap = 0;
+        for (const Block& b : blocks) cap += b.size;
+        return cap;
+    }
+
+    // Arena for the calling thread
+    static RepArena& local() {
+        thread_local RepArena arena;
+        return arena;
+    }
+
+};
+
+
+
+
+/*
+ Standard-library allocator that draws from a `RepArena`.
+ Default construction (and copying a container) uses the calling thread's
+ arena, so containers made inside a rep always use that thread's memory.
+ */
+template <typename T>
+class ArenaAllocator {
+
+public:
+
+    typedef T value_type;
+
+    RepArena* arena;
+
+    ArenaAllocator() noexcept : arena(&RepArena::local()) {};
+    explicit ArenaAllocator(RepArena* arena_) noexcept : arena(arena_) {};
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) {};
+
+    T* allocate(const size_t& n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, const size_t& n) noexcept {
+        arena->deallocate(static_cast<void*>(p), n * sizeof(T));
+    }
+
+    ArenaAllocator<T> select_on_container_copy_construction() const {
+        return ArenaAllocator<T>();
+    }
+
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena == b.arena;
+}
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena != b.arena;
+}
+
+
+/*
+ Scratch memory from the calling thread's arena for Armadillo objects that
+ are only needed inside one function.
+ It's meant for Armadillo's advanced constructors, e.g.,
+     ArenaBuffer<double> L_mem(n * n);
+     arma::mat L(L_mem.data(), n, n, false, true);
+ With `strict = true`, assigning L a result of the same size writes into
+ this memory instead of allocating more.
+ The memory is given back when this goes out of scope, and the arena can
+ re-use it right away because local variables are destroyed in the reverse
+ order they were made in.
+ */
+template <typename T>
+class ArenaBuffer {
+
+    T* mem;
+    size_t n_bytes;
+
+public:
+
+    /*
+     Sizes are rounded up to a multiple of the alignment so that there's no
+     padding between buffers, which would stop `deallocate` from reclaiming
+     the earlier ones.
+     */
+    explicit ArenaBuffer(const size_t& n)
+        : mem(nullptr), n_bytes((n * sizeof(T) + 15) & ~static_cast<size_t>(15)) {
+#ifndef CLONEWARS_NO_ARENA
+        mem = static_cast<T*>(RepArena::local().allocate(n_bytes, 16));
+#else
+        mem = static_cast<T*>(std::malloc(n_bytes > 0 ? n_bytes : 1));
+        if (mem == nullptr) throw std::bad_alloc();
+#endif
+    }
+    ArenaBuffer(const ArenaBuffer<T>& other) = delete;
+    ArenaBuffer<T>& operator=(const ArenaBuffer<T>& other) = delete;
+
+    ~ArenaBuffer() {
+#ifndef CLONEWARS_NO_ARENA
+        RepArena::local().deallocate(static_cast<void*>(mem), n_bytes);
+#else
+        std::free(mem);
+#endif
+    }
+
+    T* data() noexcept { return mem; }
+
+};
+
+
+
+/*
+ Containers for objects that only live for one rep.
+ Compiling with `-DCLONEWARS_NO_ARENA` makes them use the global heap
+ instead, which is only useful for measuring what the arena saves
+ (see `standalone/alloc_stats.cpp`).
+ */
+#ifndef CLONEWARS_NO_ARENA
+template <typename T>
+using arena_vector = std::vector<T, ArenaAllocator<T>>;
+template <typename T>
+using arena_deque = std::deque<T, ArenaAllocator<T>>;
+#else
+template <typename T>
+using arena_vector = std::vector<T>;
+template <typename T>
+using arena_deque = std::deque<T>;
+#endif
+
+
+
+
+
+#endif
@@ -17,6 +17,31 @@ typedef int_fast32_t sint32;
 typedef uint_fast64_t uint64;
 typedef int_fast64_t sint64;
 
+/*
+ ********************************************************
+ Precision of stored output
+ ********************************************************
+ Output abundances are stored as `float` if compiled with
+ `-DCLONEWARS_FLOAT_OUTPUT` (see `src/Makevars`), which halves the memory
+ they take up while a simulation runs.
+ All calculations still use `double`, and they're returned to R as doubles.
+
+ The state of a rep (abundances by stage) stays `double` in both builds.
+ It's a few hundred values per patch, so it already fits in cache, while
+ output grows with the number of days and reps.
+ Rounding abundances to `float` every day would also change when lines
+ cross `extinct_N` and when patches are cleared, so results would no
+ longer match the `double` build, and the Cholesky and eigenvalue
+ calculations need `double` for LAPACK anyway.
+ `reports/float_output.sh` compares output from the two builds.
+ */
+#ifdef CLONEWARS_FLOAT_OUTPUT
+typedef float output_t;
+#else
+typedef double output_t;
+#endif
+
+
 /*
  For the following usage of the below code...
  ```
@@ -0,0 +1,139 @@
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ Summaries across reps (see `ensemble_summary.hpp`).
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include <vector>               // vector class
+#include <string>               // string class
+
+#include "clonewars_types.hpp"  // integer types
+#include "ensemble_summary.hpp" // EnsembleSummary
+#include "tdigest.hpp"          // TDigest
+#include "simulations.hpp"      // SimOutput
+#include "rep_summary.hpp"      // RepSummary
+
+
+
+const uint32 EnsembleSummary::none;
+
+
+EnsembleSummary::EnsembleSummary(const uint32& max_t,
+                                 const uint32& n_cages_,
+                                 const uint32& n_patches_,
+                                 const std::vector<std::string>& aphid_name_)
+    : n_cages(n_cages_), n_patches(n_patches_), n_lines(aphid_name_.size()),
+      per_cage(aphid_name_.size() + 2),
+      rows_per_cage(n_patches_ * (2 * aphid_name_.size() + 1)),
+      aphid_name(aphid_name_), blocks(max_t + 1, none), digests(),
+      values(aphid_name_.size() + 2) {}
+
+
+uint32 EnsembleSummary::block__(const uint32& t) {
+    if (blocks[t] == none) {
+        blocks[t] = digests.size();
+        digests.resize(digests.size() + n_cages * per_cage);
+    }
+    return blocks[t];
+}
+
+
+bool EnsembleSummary::add(const RepSummary& summary, const double& weight) {
+
+    const uint32 nw = summary.wasp_N.size();
+    if (summary.N.size() != nw * rows_per_cage) return false;
+
+    for (uint32 w = 0; w < nw; w++) {
+
+        const uint32& t(summary.wasp_time[w]);
+        const uint32& k(summary.wasp_cage[w]);
+        if (t >= blocks.size() || k >= n_cages) return false;
+
+        // Rows for this time and cage, in the order from `RepSummary::push_back`:
+        const output_t* N = summary.N.data() + w * rows_per_cage;
+        for (double& v : values) v = 0;
+        for (uint32 j = 0; j < n_patches; j++) {
+            for (uint32 i = 0; i < n_lines; i++) {
+                values[i] += N[2 * i] + N[2 * i + 1];
+            }
+            values[n_lines] += N[2 * n_lines];
+            N += 2 * n_lines + 1;
+        }
+        values[n_lines + 1] = summary.wasp_N[w];
+
+        TDigest* digest = &digests[block__(t) + k * per_cage];
+        for (uint32 l = 0; l < per_cage; l++) digest[l].add(values[l], weight);
+    }
+
+    return true;
+}
+
+
+void EnsembleSummary::merge(const EnsembleSummary& other) {
+    for (uint32 t = 0; t < other.blocks.size(); t++) {
+        if (other.blocks[t] == none) continue;
+        const uint32 b = block__(t);
+        const uint32& ob(other.blocks[t]);
+        for (uint32 i = 0; i < n_cages * per_cage; i++) {
+            digests[b + i].merge(other.digests[ob + i]);
+        }
+    }
+    return;
+}
+
+
+void EnsembleSummary::move_to(SimOutput& out, const std::vector<double>& probs) {
+
+    const uint32 n_rows = digests.size();
+
+    out.summary_time.clear();
+    out.summary_cage.clear();
+    out.summary_line.clear();
+    out.summary_type.clear();
+    out.summary_n.clear();
+    out.summary_mean.clear();
+    out.summary_time.reserve(n_rows);
+    out.summary_cage.reserve(n_rows);
+    out.summary_line.reserve(n_rows);
+    out.summary_type.reserve(n_rows);
+    out.summary_n.reserve(n_rows);
+    out.summary_mean.reserve(n_rows);
+    out.summary_probs = probs;
+    out.summary_quantiles.assign(probs.size(), std::vector<double>());
+    for (std::vector<double>& q : out.summary_quantiles) q.reserve(n_rows);
+
+    for (uint32 t = 0; t < blocks.size(); t++) {
+        if (blocks[t] == none) continue;
+        for (uint32 k = 0; k < n_cages; k++) {
+            for (uint32 l = 0; l < per_cage; l++) {
+                TDigest& digest(digests[blocks[t] + k * per_cage + l]);
+                out.summary_time.push_back(t);
+                out.summary_cage.push_back(k);
+                if (l < n_lines) {
+                    out.summary_line.push_back(aphid_name[l]);
+                    out.summary_type.push_back("aphid");
+                } else {
+                    out.summary_line.push_back("");
+                    out.summary_type.push_back(l == n_lines ? "mummy" : "wasp");
+                }
+                out.summary_n.push_back(digest.weight());
+                out.summary_mean.push_back(digest.mean());
+                for (uint32 p = 0; p < probs.size(); p++) {
+                    out.summary_quantiles[p].push_back(digest.quantile(probs[p]));
+                }
+                // (digests aren't needed after this)
+                digest = TDigest();
+            }
+        }
+    }
+
+    blocks.assign(blocks.size(), none);
+    digests.clear();
+    digests.shrink_to_fit();
+
+    return;
+}
@@ -0,0 +1,72 @@
+# ifndef __CLONEWARS_ENSEMBLE_SUMMARY_H
+# define __CLONEWARS_ENSEMBLE_SUMMARY_H
+
+
+#include <vector>               // vector class
+#include <string>               // string class
+#include <limits>               // numeric_limits
+#include "clonewars_types.hpp"  // integer types
+#include "tdigest.hpp"          // TDigest
+#include "simulations.hpp"      // SimOutput
+#include "rep_summary.hpp"      // RepSummary
+
+
+
+/*
+ Summaries across reps of abundances at each saved time, without keeping each
+ rep's output.
+
+ For each time and cage, there's a `TDigest` for each aphid line's total
+ abundance (alates plus apterous, summed across patches), one for total
+ mummies, and one for adult wasps.
+ Each thread adds its reps to its own `EnsembleSummary` as they finish, and
+ these are merged at the end, so memory depends on the number of saved times
+ but not on the number of reps.
+ Reps don't all have to have the same times (e.g., with `save_change` or
+ when all cages go extinct), so the number of reps summarized is kept for
+ each time.
+ */
+class EnsembleSummary {
+
+    static const uint32 none = std::numeric_limits<uint32>::max();
+
+    uint32 n_cages;
+    uint32 n_patches;
+    uint32 n_lines;
+    uint32 per_cage;        // # digests per cage per time
+    uint32 rows_per_cage;   // # rows in `RepSummary` per cage per time
+    std::vector<std::string> aphid_name;
+    std::vector<uint32> blocks;     // for each day, where its digests start (or `none`)
+    std::vector<TDigest> digests;
+    std::vector<double> values;     // used in `add`
+
+    uint32 block__(const uint32& t);
+
+public:
+
+    EnsembleSummary(const uint32& max_t,
+                    const uint32& n_cages_,
+                    const uint32& n_patches_,
+                    const std::vector<std::string>& aphid_name_);
+
+    /*
+     Add one rep's output, counting it as `weight` reps.
+     `summary` must not be sparse.
+     Returns false if it doesn't have the rows this expects.
+     */
+    bool add(const RepSummary& summary, const double& weight);
+
+    // Add everything from `other` (which must have the same dimensions).
+    void merge(const EnsembleSummary& other);
+
+    /*
+     Fill the `summary_*` columns in `out` with the mean and the quantiles in
+     `probs` for each time, cage, and line (in that order).
+     */
+    void move_to(SimOutput& out, const std::vector<double>& probs);
+
+};
+
+
+
+#endif
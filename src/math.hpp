@@ -2,7 +2,7 @@
 # define __CLONEWARS_MATH_H
 
 
-#include <RcppArmadillo.h>
+#include "rcpp_compat.hpp"
 #include <cmath>
 #include <random>
 
@@ -109,6 +109,16 @@ public:
         return z;
     }
 
+    // For saving and restoring state (see `serialize.hpp`):
+    friend std::ostream& operator<<(std::ostream& os, const beta_distribution& bd) {
+        os << bd.X << ' ' << bd.Y;
+        return os;
+    }
+    friend std::istream& operator>>(std::istream& is, beta_distribution& bd) {
+        is >> bd.X >> bd.Y;
+        return is;
+    }
+
 
 };
 
@@ -1,5 +1,5 @@
 
-#include <RcppArmadillo.h>      // arma namespace
+#include "rcpp_compat.hpp"      // arma namespace
 #include <vector>               // vector class
 #include <functional>           // std::greater
 #include <random>               // normal distribution
@@ -8,6 +8,9 @@
 #include "patches.hpp"          // patch classes
 #include "math.hpp"             // combine_leslies fxn
 #include "pcg.hpp"              // runif_ fxns
+#include "arena.hpp"            // arena_vector, ArenaBuffer
+#include "stages.hpp"           // stage_limits
+#include "phase_timer.hpp"      // PhaseScope
 
 
 
@@ -46,22 +49,35 @@ void OnePatch::extinct_colonize(const uint32& i) {
  It depends on the Leslie matrix for each line's apterous and alates.
  (I'm not including parasitized aphids because they shouldn't be too numerous.)
  The overall carrying capacity is weighted based on each line's abundance.
+ Lines with no aphids have no weight, so they're skipped unless there are no
+ aphids at all (then it's the mean across lines, which is stored until `K` changes).
  */
 double OnePatch::carrying_capacity() const {
 
-    arma::vec cc(aphids.size());
+    if (total_N_ == 0 && empty_cc_set_) return empty_cc_;
+
+    PhaseScope timer(phase::carrying_capacity);
+
+    arma::vec cc(aphids.size(), arma::fill::zeros);
     arma::vec Ns(aphids.size());
     double total_N = 0;
 
-    arma::mat L;
-    arma::cx_vec eigval;
+    for (uint32 i = 0; i < aphids.size(); i++) {
+        Ns[i] = aphids[i].total_aphids();
+        total_N += Ns[i];
+    }
+
+    // (These use scratch memory from this thread's `RepArena`; see `arena.hpp`)
+    const uint32 n_L = 2 * aphids.front().apterous.leslie().n_rows;
+    ArenaBuffer<double> L_mem(n_L * n_L);
+    arma::mat L(L_mem.data(), n_L, n_L, false, true);
+    ArenaBuffer<arma::cx_double> eigval_mem(n_L);
+    arma::cx_vec eigval(eigval_mem.data(), n_L, false, true);
     double ev;
 
     for (uint32 i = 0; i < aphids.size(); i++) {
 
-        Ns[i] = aphids[i].total_aphids();
-
-        total_N += Ns[i];
+        if (total_N > 0 && Ns[i] == 0) continue;
 
         combine_leslies(L,
                         aphids[i].apterous.leslie(),
@@ -71,7 +87,7 @@ double OnePatch::carrying_capacity() const {
                         aphids[i].alates.disp_mort(),
                         aphids[i].alates.disp_start());
 
-        eigval = arma::eig_gen( L );
+        if (!arma::eig_gen(eigval, L)) stop("eig_gen(): decomposition failed");
         ev = eigval.max().real();
         cc[i] = (ev - 1) * K;
     }
@@ -80,7 +96,11 @@ double OnePatch::carrying_capacity() const {
 
     if (total_N > 0) {
         avg_cc = arma::accu(cc % Ns / total_N);
-    } else avg_cc = arma::mean(cc);
+    } else {
+        avg_cc = arma::mean(cc);
+        empty_cc_ = avg_cc;
+        empty_cc_set_ = true;
+    }
 
     return avg_cc;
 }
@@ -105,8 +125,10 @@ void OnePatch::update_z_wilted() {
 /*
  Iterate one time step, after calculating dispersal numbers
  */
+template <bool proc_error, uint32 max_stages>
 void OnePatch::update(const arma::cube& emigrants,
                       const arma::cube& immigrants,
+                      const arena_vector<uint32>& disp_lines,
                       const WaspPop* wasps,
                       pcg32& eng) {
 
@@ -116,74 +138,67 @@ void OnePatch::update(const arma::cube& emigrants,
     S_y = 1 / (1 + z / K_y);
 
     empty = true;
+    total_N_ = 0;
+    total_unpar_N_ = 0;
 
     double nm = 0; // newly mummified
 
-    for (uint32 i = 0; i < aphids.size(); i++) {
-
+    /*
+     Only active lines and lines with dispersers are updated (others have no aphids).
+     Going through both lists in order of line keeps random numbers in the
+     same order as updating all lines.
+     */
+    next_active_.clear();
+    uint32 a = 0, d = 0;
+    while (a < active_lines_.size() || d < disp_lines.size()) {
+
+        uint32 i;
+        if (d == disp_lines.size() ||
+            (a < active_lines_.size() && active_lines_[a] < disp_lines[d])) {
+            i = active_lines_[a];
+            a++;
+        } else if (a == active_lines_.size() || disp_lines[d] < active_lines_[a]) {
+            i = disp_lines[d];
+            d++;
+        } else {
+            i = active_lines_[a];
+            a++;
+            d++;
+        }
 
         // Update population, including process error and dispersal.
         // Also return # newly mummified from that line
-        nm += aphids[i].update(this, wasps, emigrants.slice(i).col(this_j),
-                               immigrants.slice(i).col(this_j), eng);
-
-        if (wilted_) {
-            aphids[i].apterous.X *= death_mort;
-            aphids[i].alates.X *= death_mort;
-            aphids[i].paras.X *= death_mort;
-        }
+        // (Views of these columns, since `.col()` would be copied to a new vector)
+        const arma::mat& emig_i(emigrants.slice(i));
+        const arma::mat& immig_i(immigrants.slice(i));
+        const arma::vec emig_ij(const_cast<double*>(emig_i.colptr(this_j)),
+                                emig_i.n_rows, false, true);
+        const arma::vec immig_ij(const_cast<double*>(immig_i.colptr(this_j)),
+                                 immig_i.n_rows, false, true);
+        nm += aphids[i].update<proc_error, max_stages>(this, wasps, emig_ij,
+                                                       immig_ij, eng);
+
+        if (wilted_) aphids[i].clear(death_mort);
 
         // Adjust for potential extinction or re-colonization:
         extinct_colonize(i);
 
-    }
+        const AphidPop& ap(aphids[i]);
+        double unpar = ap.apterous.total_aphids() + ap.alates.total_aphids();
+        total_unpar_N_ += unpar;
+        total_N_ += unpar + ap.paras.total_aphids();
 
-    mummies.update(pred_rate, nm);
-    double mums = arma::accu(mummies.Y);
-    if (mums < extinct_N) mummies.Y.fill(0);
-    if (max_mum_density > 0 && mums > max_mum_density) {
-        mummies.Y *= (max_mum_density / mums);
-    }
-
-    age++;
-
-    return;
-
-}
-// Same but minus stochasticity
-void OnePatch::update(const arma::cube& emigrants,
-                      const arma::cube& immigrants,
-                      const WaspPop* wasps) {
-
-    update_z_wilted();
-
-    S = 1 / (1 + z / K);
-    S_y = 1 / (1 + z / K_y);
-
-    empty = true;
-
-    double nm = 0; // newly mummified
-
-    for (uint32 i = 0; i < aphids.size(); i++) {
-
-        nm += aphids[i].update(this, wasps, emigrants.slice(i).col(this_j),
-                               immigrants.slice(i).col(this_j));
-
-        if (wilted_) {
-            aphids[i].apterous.X *= death_mort;
-            aphids[i].alates.X *= death_mort;
-            aphids[i].paras.X *= death_mort;
-        }
-
-        extinct_colonize(i);
+        if (line_active(ap)) next_active_.push_back(i);
 
     }
+    active_lines_.swap(next_active_);
 
+    PhaseScope timer(phase::wasps);
     mummies.update(pred_rate, nm);
-    double mums = arma::accu(mummies.Y);
-    if (mums < extinct_N) mummies.Y.fill(0);
+    double mums = mummies.total_mummies();
+    if (mums < extinct_N) mummies.clear();
     if (max_mum_density > 0 && mums > max_mum_density) {
-        mummies.Y *= (max_mum_density / mums);
+        mummies.clear(max_mum_density / mums);
     }
 
     age++;
@@ -192,15 +207,46 @@ void OnePatch::update(const arma::cube& emigrants,
 
 }
 
+template void OnePatch::update<true, 0>(const arma::cube& emigrants,
+                                        const arma::cube& immigrants,
+                                        const arena_vector<uint32>& disp_lines,
+                                        const WaspPop* wasps,
+                                        pcg32& eng);
+template void OnePatch::update<true, stage_limits::up_to_32>(const arma::cube& emigrants,
+                                                             const arma::cube& immigrants,
+                                                             const arena_vector<uint32>& disp_lines,
+                                                             const WaspPop* wasps,
+                                                             pcg32& eng);
+template void OnePatch::update<true, stage_limits::up_to_64>(const arma::cube& emigrants,
+                                                             const arma::cube& immigrants,
+                                                             const arena_vector<uint32>& disp_lines,
+                                                             const WaspPop* wasps,
+                                                             pcg32& eng);
+template void OnePatch::update<false, 0>(const arma::cube& emigrants,
+                                         const arma::cube& immigrants,
+                                         const arena_vector<uint32>& disp_lines,
+                                         const WaspPop* wasps,
+                                         pcg32& eng);
+template void OnePatch::update<false, stage_limits::up_to_32>(const arma::cube& emigrants,
+                                                              const arma::cube& immigrants,
+                                                              const arena_vector<uint32>& disp_lines,
+                                                              const WaspPop* wasps,
+                                                              pcg32& eng);
+template void OnePatch::update<false, stage_limits::up_to_64>(const arma::cube& emigrants,
+                                                              const arma::cube& immigrants,
+                                                              const arena_vector<uint32>& disp_lines,
+                                                              const WaspPop* wasps,
+                                                              pcg32& eng);
+
 
 
 
 
 // Do the actual clearing of patches while avoiding extinction
-template <typename T>
-inline void OneCage::do_clearing(std::vector<PatchClearingInfo<T>>& clear_patches,
+template <typename T, bool partial_clear>
+inline void OneCage::do_clearing(arena_vector<PatchClearingInfo<T>>& clear_patches,
                                     double& remaining,
-                                    std::vector<bool>& wilted,
+                                    arena_vector<bool>& wilted,
                                     const double& clear_surv,
                                     pcg32& eng) {
 
@@ -237,7 +283,7 @@ inline void OneCage::do_clearing(std::vector<PatchClearingInfo<T>>& clear_patche
         set_K(K, K_y, eng);
         set_death_mort(death_mort, eng);
 
-        if (clear_surv > 0) {
+        if (partial_clear) {
             patches[clear_patches.front().ind].clear(K, K_y, death_mort,
                                         clear_surv);
         } else patches[clear_patches.front().ind].clear(K, K_y, death_mort);
@@ -270,7 +316,7 @@ inline void OneCage::do_clearing(std::vector<PatchClearingInfo<T>>& clear_patche
         set_K(K, K_y, eng);
         set_death_mort(death_mort, eng);
 
-        if (clear_surv > 0) {
+        if (partial_clear) {
             patches[clear_patches.front().ind].clear(K, K_y, death_mort,
                                         clear_surv);
         } else patches[clear_patches.front().ind].clear(K, K_y, death_mort);
@@ -285,18 +331,19 @@ inline void OneCage::do_clearing(std::vector<PatchClearingInfo<T>>& clear_patche
 
 
 // Clear patches by either a maximum age or total abundance
+template <bool partial_clear>
 void OneCage::clear_patches(const uint32& max_age,
                                const double& clear_surv,
                                pcg32& eng) {
 
-    std::vector<PatchClearingInfo<uint32>> clear_patches;
+    arena_vector<PatchClearingInfo<uint32>> clear_patches;
     clear_patches.reserve(patches.size());
 
     // # remaining aphids for non-cleared patches
     double remaining = 0;
 
     // keeping track of dying plants:
-    std::vector<bool> wilted;
+    arena_vector<bool> wilted;
     wilted.reserve(patches.size());
 
     for (const OnePatch& p : patches) {
@@ -308,22 +355,24 @@ void OneCage::clear_patches(const uint32& max_age,
         } else remaining += N;
     }
 
-    do_clearing<uint32>(clear_patches, remaining, wilted, clear_surv, eng);
+    do_clearing<uint32, partial_clear>(clear_patches, remaining, wilted, clear_surv, eng);
+    refresh();
 
     return;
 }
 
 
+template <bool partial_clear>
 void OneCage::clear_patches(const double& max_N,
                                const double& clear_surv,
                                pcg32& eng) {
 
-    std::vector<PatchClearingInfo<double>> clear_patches;
+    arena_vector<PatchClearingInfo<double>> clear_patches;
     clear_patches.reserve(patches.size());
 
     double remaining = 0;
 
-    std::vector<bool> wilted;
+    arena_vector<bool> wilted;
     wilted.reserve(patches.size());
 
     for (const OnePatch& p : patches) {
@@ -335,7 +384,23 @@ void OneCage::clear_patches(const double& max_N,
         } else remaining += N;
     }
 
-    do_clearing<double>(clear_patches, remaining, wilted, clear_surv, eng);
+    do_clearing<double, partial_clear>(clear_patches, remaining, wilted, clear_surv, eng);
+    refresh();
 
     return;
 }
+
+
+
+template void OneCage::clear_patches<true>(const uint32& max_age,
+                                           const double& clear_surv,
+                                           pcg32& eng);
+template void OneCage::clear_patches<false>(const uint32& max_age,
+                                            const double& clear_surv,
+                                            pcg32& eng);
+template void OneCage::clear_patches<true>(const double& max_N,
+                                           const double& clear_surv,
+                                           pcg32& eng);
+template void OneCage::clear_patches<false>(const double& max_N,
+                                            const double& clear_surv,
+                                            pcg32& eng);
@@ -2,8 +2,9 @@
 # define __CLONEWARS_PATCHES_H
 
 
-#include <RcppArmadillo.h>      // arma namespace
+#include "rcpp_compat.hpp"      // arma namespace
 #include <vector>               // vector class
+#include <algorithm>            // sort
 #include <random>               // normal distribution
 #include <pcg/pcg_random.hpp>   // pcg prng
 #include "clonewars_types.hpp"  // integer types
@@ -11,6 +12,9 @@
 #include "aphids.hpp"           // aphid classes
 #include "wasps.hpp"            // wasp classes
 #include "pcg.hpp"              // runif_ fxns
+#include "arena.hpp"            // arena_vector
+#include "serialize.hpp"        // StateWriter, StateReader
+#include "phase_timer.hpp"      // PhaseScope
 
 
 
@@ -65,7 +69,8 @@ struct PatchClearingInfo {
                       const T& thresh_info_)
         : ind(ind_), N(N_), wilted(wilted_), thresh_info(thresh_info_) {}
     PatchClearingInfo(const PatchClearingInfo<T>& other)
-        : ind(other.ind), N(other.N), thresh_info(other.thresh_info) {}
+        : ind(other.ind), N(other.N), wilted(other.wilted),
+          thresh_info(other.thresh_info) {}
 
     // This returns true when `other` should be cleared first
     bool operator<(const PatchClearingInfo<T>& other) const {
@@ -92,14 +97,6 @@ One patch of continuous habitat.
 class OnePatch {
 
 
-    /*
-     Carrying capacity for patch.
-     It depends on the Leslie matrix for each line's apterous and alates.
-     I'm not including parasitized aphids because they shouldn't be too numerous.
-     */
-    double carrying_capacity() const;
-
-
     /*
      Adjust for potential extinction or re-colonization:
      */
@@ -112,10 +109,46 @@ class OnePatch {
 
     MEMBER(bool,wilted)
 
+    // Totals for all lines, kept up to date by `update`, `clear`,
+    // and `refresh`:
+    double total_N_;                // living aphids
+    double total_unpar_N_;          // UNparasitized aphids
+
+    /*
+     Indices (ascending) for lines that aren't extinct, kept up to date the
+     same way as the totals.
+     Extinct lines have no aphids, so they're only updated when they have
+     dispersers coming in.
+     (When `extinct_N <= 0`, extinct lines can be "re-colonized" without any
+     aphids, so all lines are always active.)
+     */
+    arena_vector<uint32> active_lines_;
+    arena_vector<uint32> next_active_;  // used inside `update`
+
+    /*
+     Carrying capacity when there are no aphids on the patch.
+     This only changes when the patch is cleared (because that changes `K`), so it's
+     stored here after the first time it's needed.
+     */
+    mutable double empty_cc_;
+    mutable bool empty_cc_set_;
+
+    inline bool line_active(const AphidPop& ap) const {
+        return !ap.extinct || extinct_N <= 0;
+    }
+
 
 public:
 
-    std::vector<AphidPop> aphids;   // aphids in this patch
+    /*
+     Carrying capacity for patch.
+     It depends on the Leslie matrix for each line's apterous and alates.
+     I'm not including parasitized aphids because they shouldn't be too numerous.
+     (This is only public so it can be benchmarked.)
+     */
+    double carrying_capacity() const;
+
+    arena_vector<AphidPop> aphids;  // aphids in this patch
     MummyPop mummies;               // mummies in this patch
     bool empty;                     // whether no aphids are on this patch
     double pred_rate;               // predation on aphids
@@ -135,7 +168,9 @@ public:
 
 
     OnePatch()
-        : wilted_(false), aphids(), mummies(), empty(true), pred_rate(0),
+        : wilted_(false), total_N_(0), total_unpar_N_(0), active_lines_(),
+          next_active_(), empty_cc_(0), empty_cc_set_(false),
+          aphids(), mummies(), empty(true), pred_rate(0),
           K(0), K_y(1),
           n_patches(1), this_j(0), death_prop(1), death_mort(1), extinct_N() {};
 
@@ -169,6 +204,12 @@ public:
              const arma::vec& mum_density_0,
              const double& max_mum_density_)
         : wilted_(false),
+          total_N_(0),
+          total_unpar_N_(0),
+          active_lines_(),
+          next_active_(),
+          empty_cc_(0),
+          empty_cc_set_(false),
           aphids(),
           mummies(mum_density_0),
           empty(true),
@@ -185,6 +226,8 @@ public:
         uint32 n_lines = aphid_name.size();
 
         aphids.reserve(n_lines);
+        active_lines_.reserve(n_lines);
+        next_active_.reserve(n_lines);
 
         for (uint32 i = 0; i < n_lines; i++) {
             AphidPop ap(aphid_name[i], sigma_x, rho, demog_mult,
@@ -199,12 +242,18 @@ public:
             } else if (empty) empty = false;
         }
 
+        refresh();
+
     };
 
 
 
     OnePatch(const OnePatch& other)
-        : wilted_(false), aphids(other.aphids), mummies(other.mummies),
+        : wilted_(false), total_N_(other.total_N_),
+          total_unpar_N_(other.total_unpar_N_),
+          active_lines_(other.active_lines_), next_active_(other.next_active_),
+          empty_cc_(other.empty_cc_), empty_cc_set_(other.empty_cc_set_),
+          aphids(other.aphids), mummies(other.mummies),
           empty(other.empty), pred_rate(other.pred_rate),
           K(other.K), K_y(other.K_y), z(other.z),
           S(other.S), S_y(other.S_y), n_patches(other.n_patches),
@@ -214,6 +263,12 @@ public:
 
     OnePatch& operator=(const OnePatch& other) {
         wilted_ = other.wilted_;
+        total_N_ = other.total_N_;
+        total_unpar_N_ = other.total_unpar_N_;
+        active_lines_ = other.active_lines_;
+        next_active_ = other.next_active_;
+        empty_cc_ = other.empty_cc_;
+        empty_cc_set_ = other.empty_cc_set_;
         aphids = other.aphids;
         mummies = other.mummies;
         empty = other.empty;
@@ -256,8 +311,10 @@ public:
                const double& death_mort_) {
         for (AphidPop& ap : aphids) ap.clear();
         mummies.clear();
+        refresh();
         empty = true;
         wilted_ = false;
+        empty_cc_set_ = false;
         age = 0;
         K = K_;
         K_y = K_y_;
@@ -282,9 +339,11 @@ public:
                 ap.extinct = false;
             }
         }
+        refresh();
         mummies.clear(surv);
-        if (arma::accu(mummies.Y) < extinct_N) mummies.Y.fill(0);
+        if (mummies.total_mummies() < extinct_N) mummies.clear();
         wilted_ = false;
+        empty_cc_set_ = false;
         age = 0;
         K = K_;
         K_y = K_y_;
@@ -294,47 +353,102 @@ public:
 
     // Total (living) aphids on patch
     inline double total_aphids() const {
-        double ta = 0;
-        for (const AphidPop& ap : aphids) {
-            ta += ap.total_aphids();
-        }
-        return ta;
+        return total_N_;
     }
     // Total UNparasitized aphids on patch
     inline double total_unpar_aphids() const {
-        double ta = 0;
-        for (const AphidPop& ap : aphids) {
-            ta += ap.apterous.total_aphids() + ap.alates.total_aphids();
-        }
-        return ta;
+        return total_unpar_N_;
     }
     // Total mummies on patch
     inline double total_mummies() const {
-        double tm = arma::accu(mummies.Y);
-        return tm;
+        return mummies.total_mummies();
+    }
+    // Indices for lines that aren't extinct
+    inline const arena_vector<uint32>& active_lines() const {
+        return active_lines_;
+    }
+
+    // Save and restore state (see `serialize.hpp`)
+    void save_state(StateWriter& out) const {
+        out.write(wilted_);
+        out.write(total_N_);
+        out.write(total_unpar_N_);
+        out.write(active_lines_);
+        out.write(static_cast<uint64>(aphids.size()));
+        for (const AphidPop& ap : aphids) ap.save_state(out);
+        mummies.save_state(out);
+        out.write(empty);
+        out.write(K);
+        out.write(K_y);
+        out.write(z);
+        out.write(S);
+        out.write(S_y);
+        out.write(age);
+        out.write(death_mort);
+        return;
+    }
+    void load_state(StateReader& in) {
+        in.read(wilted_);
+        in.read(total_N_);
+        in.read(total_unpar_N_);
+        in.read(active_lines_);
+        uint64 n_lines;
+        in.read(n_lines);
+        if (n_lines != aphids.size()) in.fail();
+        for (AphidPop& ap : aphids) ap.load_state(in);
+        mummies.load_state(in);
+        in.read(empty);
+        in.read(K);
+        in.read(K_y);
+        in.read(z);
+        in.read(S);
+        in.read(S_y);
+        in.read(age);
+        in.read(death_mort);
+        next_active_.clear();
+        empty_cc_set_ = false;
+        return;
+    }
+    /*
+     Re-calculate patch totals from each line's totals, and re-make
+     the list of active lines.
+     Call this after changing aphids from outside this class
+     (e.g., perturbations or moving dispersers between cages).
+     */
+    inline void refresh() {
+        total_N_ = 0;
+        total_unpar_N_ = 0;
+        active_lines_.clear();
+        for (uint32 i = 0; i < aphids.size(); i++) {
+            const AphidPop& ap(aphids[i]);
+            double unpar = ap.apterous.total_aphids() + ap.alates.total_aphids();
+            total_unpar_N_ += unpar;
+            total_N_ += unpar + ap.paras.total_aphids();
+            if (line_active(ap)) active_lines_.push_back(i);
+        }
+        return;
     }
 
     /*
      Add dispersal info to `emigrants` and `immigrants` cubes.
      In these cubes, rows are aphid stages, columns are patches,
      and slices are aphid lines.
+     Lines that might have added to the cubes are flagged in `dispersing`
+     and (if not already flagged) added to `disp_lines`.
     */
+    template <bool disp_error>
     void calc_dispersal(arma::cube& emigrants,
                         arma::cube& immigrants,
+                        arena_vector<bool>& dispersing,
+                        arena_vector<uint32>& disp_lines,
                         pcg32& eng) const {
-        for (uint32 i = 0; i < aphids.size(); i++) {
-            aphids[i].calc_dispersal(this, emigrants.slice(i),
-                                     immigrants.slice(i), eng);
-        }
-        return;
-    }
-
-    // Same thing as above, but overloaded for not including dispersal stochasticity
-    void calc_dispersal(arma::cube& emigrants,
-                        arma::cube& immigrants) const {
-        for (uint32 i = 0; i < aphids.size(); i++) {
-            aphids[i].calc_dispersal(this, emigrants.slice(i),
-                                     immigrants.slice(i));
+        for (const uint32& i : active_lines_) {
+            bool d = aphids[i].calc_dispersal<disp_error>(this, emigrants.slice(i),
+                                                          immigrants.slice(i), eng);
+            if (d && !dispersing[i]) {
+                dispersing[i] = true;
+                disp_lines.push_back(i);
+            }
         }
         return;
     }
@@ -342,15 +456,16 @@ public:
 
     /*
      Iterate one time step, after calculating dispersal numbers
+     (`max_stages` is described in `stages.hpp`).
+     `disp_lines` are indices (ascending) for lines that had any dispersers
+     in the cage.
      */
+    template <bool proc_error, uint32 max_stages>
     void update(const arma::cube& emigrants,
                 const arma::cube& immigrants,
+                const arena_vector<uint32>& disp_lines,
                 const WaspPop* wasps,
                 pcg32& eng);
-    // Same but minus stochasticity
-    void update(const arma::cube& emigrants,
-                const arma::cube& immigrants,
-                const WaspPop* wasps);
 
 
 };
@@ -388,6 +503,20 @@ class OneCage {
 
     double extinct_N;               // used here for the wasps
 
+    // Totals for all patches, kept up to date by `refresh`:
+    double total_N_;                // living aphids
+    double total_unpar_N_;          // UNparasitized aphids
+    bool empty_;                    // whether all patches are empty
+    // Indices for patches with any active lines (also kept up to date by `refresh`):
+    arena_vector<uint32> occupied_;
+    /*
+     Lines that had dispersers in the last call to `calc_dispersal`.
+     These are the only slices in `emigrants` and `immigrants` that can be non-zero.
+     `dispersing_` has a flag for each line, `disp_lines_` has the indices (ascending).
+     */
+    arena_vector<bool> dispersing_;
+    arena_vector<uint32> disp_lines_;
+
 
     // Set K and K_y
     void set_K(double& K, double& K_y, pcg32& eng) {
@@ -410,28 +539,25 @@ class OneCage {
     }
 
     inline void set_wasp_info(double& old_mums) {
-        wasps.x = 0;
+        wasps.x = total_unpar_N_;
         old_mums = 0;
-        for (OnePatch& p : patches) {
-            wasps.x += p.total_unpar_aphids();
-            old_mums += p.mummies.Y.back();
-        }
+        for (OnePatch& p : patches) old_mums += p.mummies.Y.back();
         return;
     }
 
 
     // Do the actual clearing of patches while avoiding extinction
-    template <typename T>
-    void do_clearing(std::vector<PatchClearingInfo<T>>& clear_patches,
+    template <typename T, bool partial_clear>
+    void do_clearing(arena_vector<PatchClearingInfo<T>>& clear_patches,
                      double& remaining,
-                     std::vector<bool>& wilted,
+                     arena_vector<bool>& wilted,
                      const double& clear_surv,
                      pcg32& eng);
 
 
 public:
 
-    std::vector<OnePatch> patches;
+    arena_vector<OnePatch> patches;
     WaspPop wasps;
     arma::cube emigrants;
     arma::cube immigrants;
@@ -440,6 +566,8 @@ public:
     OneCage()
         : tnorm_distr(), beta_distr(), mean_K_(), sd_K_(), K_y_mult(),
           shape1_death_mort_(), shape2_death_mort_(), extinct_N(),
+          total_N_(0), total_unpar_N_(0), empty_(true), occupied_(),
+          dispersing_(), disp_lines_(),
           patches(), wasps(), emigrants(), immigrants() {};
 
     /*
@@ -487,6 +615,12 @@ public:
           shape1_death_mort_(shape1_death_mort),
           shape2_death_mort_(shape2_death_mort),
           extinct_N(extinct_N_),
+          total_N_(0),
+          total_unpar_N_(0),
+          empty_(true),
+          occupied_(),
+          dispersing_(),
+          disp_lines_(),
           patches(),
           wasps(rel_attack_, a_, k_, h_, wasp_density_0_,
                 sex_ratio_, s_y_, sigma_y),
@@ -536,6 +670,12 @@ public:
         emigrants = arma::zeros<arma::cube>(n_stages, n_patches, n_lines);
         immigrants = arma::zeros<arma::cube>(n_stages, n_patches, n_lines);
 
+        occupied_.reserve(n_patches);
+        dispersing_.assign(n_lines, false);
+        disp_lines_.reserve(n_lines);
+
+        refresh();
+
     }
 
     OneCage(const OneCage& other)
@@ -547,6 +687,12 @@ public:
           shape1_death_mort_(other.shape1_death_mort_),
           shape2_death_mort_(other.shape2_death_mort_),
           extinct_N(other.extinct_N),
+          total_N_(other.total_N_),
+          total_unpar_N_(other.total_unpar_N_),
+          empty_(other.empty_),
+          occupied_(other.occupied_),
+          dispersing_(other.dispersing_),
+          disp_lines_(other.disp_lines_),
           patches(other.patches),
           wasps(other.wasps),
           emigrants(other.emigrants),
@@ -561,6 +707,12 @@ public:
         shape1_death_mort_ = other.shape1_death_mort_;
         shape2_death_mort_ = other.shape2_death_mort_;
         extinct_N = other.extinct_N;
+        total_N_ = other.total_N_;
+        total_unpar_N_ = other.total_unpar_N_;
+        empty_ = other.empty_;
+        occupied_ = other.occupied_;
+        dispersing_ = other.dispersing_;
+        disp_lines_ = other.disp_lines_;
         patches = other.patches;
         wasps = other.wasps;
         emigrants = other.emigrants;
@@ -580,6 +732,72 @@ public:
         return patches[idx];
     }
 
+
+    // Total (living) aphids in cage
+    inline double total_aphids() const {
+        return total_N_;
+    }
+    // Total UNparasitized aphids in cage
+    inline double total_unpar_aphids() const {
+        return total_unpar_N_;
+    }
+    // Whether all patches are empty
+    inline bool empty() const {
+        return empty_;
+    }
+
+    /*
+     Save and restore state (see `serialize.hpp`).
+     This is only done between days, so `emigrants` and `immigrants` aren't
+     needed (they're re-calculated at the start of each day).
+     */
+    void save_state(StateWriter& out) const {
+        out.write_stream(beta_distr);
+        out.write(total_N_);
+        out.write(total_unpar_N_);
+        out.write(empty_);
+        out.write(occupied_);
+        out.write(static_cast<uint64>(patches.size()));
+        for (const OnePatch& p : patches) p.save_state(out);
+        wasps.save_state(out);
+        return;
+    }
+    void load_state(StateReader& in) {
+        in.read_stream(beta_distr);
+        in.read(total_N_);
+        in.read(total_unpar_N_);
+        in.read(empty_);
+        in.read(occupied_);
+        uint64 n_patches;
+        in.read(n_patches);
+        if (n_patches != patches.size()) in.fail();
+        for (OnePatch& p : patches) p.load_state(in);
+        wasps.load_state(in);
+        emigrants.fill(0);
+        immigrants.fill(0);
+        for (const uint32& i : disp_lines_) dispersing_[i] = false;
+        disp_lines_.clear();
+        return;
+    }
+    /*
+     Re-calculate cage totals from each patch's totals, and re-make the list
+     of occupied patches.
+     Call this after changing patches from outside this class.
+     */
+    inline void refresh() {
+        total_N_ = 0;
+        total_unpar_N_ = 0;
+        empty_ = true;
+        occupied_.clear();
+        for (const OnePatch& p : patches) {
+            total_N_ += p.total_aphids();
+            total_unpar_N_ += p.total_unpar_aphids();
+            if (!p.empty) empty_ = false;
+            if (!p.active_lines().empty()) occupied_.push_back(p.this_j);
+        }
+        return;
+    }
+
     // Remove dispersers from this cage:
     arma::mat remove_dispersers(const double& disp_prop) {
 
@@ -588,13 +806,17 @@ public:
 
         arma::mat D = arma::zeros<arma::mat>(n_stages, n_lines);
 
+        // (Extinct lines have no dispersers)
         arma::vec Di;
-        for (OnePatch& p : patches) {
-            for (uint32 i = 0; i < n_lines; i++) {
+        for (const uint32& j : occupied_) {
+            OnePatch& p(patches[j]);
+            for (const uint32& i : p.active_lines()) {
                 Di = p.aphids[i].remove_dispersers(disp_prop);
                 D.col(i) += Di;
             }
+            p.refresh();
         }
+        refresh();
 
         return D;
 
@@ -610,33 +832,39 @@ public:
         for (uint32 i = 0; i < n_lines; i++) {
             arma::vec DD = D.col(i) / n_patches;
             for (OnePatch& p : patches) {
-                p.aphids[i].alates.X += DD;
+                AphidPop& ap(p.aphids[i]);
+                ap.alates.add(DD);
+                // This line needs to be updated now:
+                if (ap.alates.total_aphids() > 0) ap.extinct = false;
             }
         }
+        for (OnePatch& p : patches) p.refresh();
+        refresh();
 
         return;
 
     }
 
+    template <bool disp_error>
     inline void calc_dispersal(pcg32& eng) {
 
         // Dispersal from previous generation
-        emigrants.fill(0);
-        immigrants.fill(0);
-        for (const OnePatch& p : patches) {
-            p.calc_dispersal(emigrants, immigrants, eng);
+        // (only lines that dispersed last time can have non-zero slices)
+        for (const uint32& i : disp_lines_) {
+            emigrants.slice(i).zeros();
+            immigrants.slice(i).zeros();
+            dispersing_[i] = false;
         }
-        return;
-    }
-    inline void calc_dispersal() {
-        emigrants.fill(0);
-        immigrants.fill(0);
-        for (const OnePatch& p : patches) {
-            p.calc_dispersal(emigrants, immigrants);
+        disp_lines_.clear();
+        for (const uint32& j : occupied_) {
+            patches[j].calc_dispersal<disp_error>(emigrants, immigrants,
+                                                  dispersing_, disp_lines_, eng);
         }
+        std::sort(disp_lines_.begin(), disp_lines_.end());
         return;
     }
 
+    template <bool proc_error, uint32 max_stages>
     inline void update(pcg32& eng) {
         /*
          Once `calc_dispersal` has updated inside `emigrants` and `immigrants`, we
@@ -646,30 +874,32 @@ public:
         double old_mums;
         set_wasp_info(old_mums);
         // Then we can update aphids and mummies:
-        for (OnePatch& p : patches) {
-            p.update(emigrants, immigrants, &wasps, eng);
+        {
+            PhaseScope timer(phase::aphids);
+            for (OnePatch& p : patches) {
+                p.update<proc_error, max_stages>(emigrants, immigrants, disp_lines_,
+                                                 &wasps, eng);
+            }
+            refresh();
         }
         // Lastly update adult wasps:
-        wasps.update(old_mums, eng);
-        if (wasps.Y < extinct_N) wasps.Y = 0;
-        return;
-    }
-    inline void update() {
-        double old_mums;
-        set_wasp_info(old_mums);
-        for (OnePatch& p : patches) {
-            p.update(emigrants, immigrants, &wasps);
-        }
-        wasps.update(old_mums);
+        PhaseScope timer(phase::wasps);
+        wasps.update<proc_error>(old_mums, eng);
         if (wasps.Y < extinct_N) wasps.Y = 0;
         return;
     }
 
 
-    // Clear patches by either a maximum age or total abundance
+    /*
+     Clear patches by either a maximum age or total abundance.
+     If `partial_clear` is true, a proportion `clear_surv` of aphids and
+     mummies survive clearing; otherwise `clear_surv` is ignored.
+     */
+    template <bool partial_clear>
     void clear_patches(const uint32& max_age,
                        const double& clear_surv,
                        pcg32& eng);
+    template <bool partial_clear>
     void clear_patches(const double& max_N,
                        const double& clear_surv,
                        pcg32& eng);
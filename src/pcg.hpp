@@ -1,7 +1,7 @@
 #ifndef __CLONEWARS_PCG_H
 #define __CLONEWARS_PCG_H
 
-#include <RcppArmadillo.h>
+#include "rcpp_compat.hpp"
 #include <vector>
 #include <string>
 #include <pcg/pcg_extras.hpp>  // pcg 128-bit integer type
@@ -31,13 +31,25 @@ Seeding
 */
 
 
+// `n` 32-bit seeds (casted to 64-bit) from R's RNG (or `standalone_rng` without R)
+inline std::vector<uint64> r_sub_seeds(const uint32& n) {
+#ifdef CLONEWARS_STANDALONE
+    std::vector<uint64> sub_seeds(n);
+    for (uint64& s : sub_seeds) s = standalone_rng()();
+    return sub_seeds;
+#else
+    return as<std::vector<uint64>>(Rcpp::runif(n,0,4294967296));
+#endif
+}
+
+
 // To sample for seeds before multi-core operations
 inline std::vector<std::vector<uint64>> mt_seeds(const uint32& n_reps) {
 
     std::vector<std::vector<uint64>> sub_seeds(n_reps, std::vector<uint64>(4));
 
     for (uint32 i = 0; i < n_reps; i++) {
-        sub_seeds[i] = as<std::vector<uint64>>(Rcpp::runif(4,0,4294967296));
+        sub_seeds[i] = r_sub_seeds(4);
     }
 
     return sub_seeds;
@@ -58,7 +70,7 @@ For single-core operations, you can use R's RNG for 32-bit random number generat
 inline pcg32 seeded_pcg() {
 
     // Four 32-bit seeds from unif_rand
-    std::vector<uint64> sub_seeds = as<std::vector<uint64>>(Rcpp::runif(4,0,4294967296));
+    std::vector<uint64> sub_seeds = r_sub_seeds(4);
 
     uint64 seed1;
     uint64 seed2;
@@ -109,7 +121,7 @@ inline std::vector<std::vector<uint64>> mt_seeds64(const uint32& n_cores) {
     std::vector<std::vector<uint64>> sub_seeds(n_cores, std::vector<uint64>(8));
 
     for (uint32 i = 0; i < n_cores; i++) {
-        sub_seeds[i] = as<std::vector<uint64>>(Rcpp::runif(8,0,4294967296));
+        sub_seeds[i] = r_sub_seeds(8);
     }
 
     return sub_seeds;
@@ -132,7 +144,7 @@ inline void fill_seeds64(const std::vector<uint64>& sub_seeds,
 inline pcg64 seeded_pcg64() {
 
     // 32-bit seeds from unif_rand
-    std::vector<uint64> sub_seeds = as<std::vector<uint64>>(Rcpp::runif(8,0,4294967296));
+    std::vector<uint64> sub_seeds = r_sub_seeds(8);
     uint128 seed1;
     uint128 seed2;
 
@@ -0,0 +1,136 @@
+# ifndef __CLONEWARS_PHASE_TIMER_H
+# define __CLONEWARS_PHASE_TIMER_H
+
+
+#include <chrono>               // steady_clock
+#include <atomic>               // atomic
+#include "clonewars_types.hpp"  // integer types
+#include "trace.hpp"            // TraceBuffer
+
+
+
+/*
+ Optional timers for how long simulations spend in each phase.
+
+ Code for a phase is wrapped in a `PhaseScope` object, which switches this
+ thread's current phase until it goes out of scope.
+ Time is only added to the innermost phase (e.g., time computing carrying
+ capacity isn't also counted as time updating aphids), so totals add up to
+ the total time.
+ When tracing is on (see `trace.hpp`), a `PhaseScope` also records when
+ the phase began and ended.
+ When neither is on, a `PhaseScope` only checks two flags.
+ */
+
+
+namespace phase {
+    enum Phase : uint32 {
+        other = 0,
+        perturbation,
+        dispersal,
+        aphids,             // Leslie steps, attack, density dependence
+        process_error,
+        carrying_capacity,  // eigenvalue solves for plant wilting
+        wasps,              // mummies and adult wasps
+        clearing,
+        output,
+        store,              // handing finished reps to the store's writer thread
+        count
+    };
+    const char* const names[] = {
+        "other", "perturbation", "dispersal", "aphids", "process_error",
+        "carrying_capacity", "wasps", "clearing", "output", "store"
+    };
+}
+
+
+class PhaseTimers {
+
+    typedef std::chrono::steady_clock clock;
+
+    double totals[phase::count];
+    uint32 current;
+    clock::time_point last;
+
+    static std::atomic<bool>& enabled_() {
+        static std::atomic<bool> on(false);
+        return on;
+    }
+
+public:
+
+    PhaseTimers() : totals(), current(phase::other), last(clock::now()) {};
+
+    // Every thread has its own timers:
+    static PhaseTimers& local() {
+        thread_local PhaseTimers timers;
+        return timers;
+    }
+
+    // Turn timers on or off (for all threads; don't call inside parallel regions)
+    static void enable(const bool& on) {
+        enabled_().store(on, std::memory_order_relaxed);
+        return;
+    }
+    inline static bool enabled() {
+        return enabled_().load(std::memory_order_relaxed);
+    }
+
+    // Set totals to zero and start timing `phase::other`
+    void reset() {
+        for (uint32 i = 0; i < phase::count; i++) totals[i] = 0;
+        current = phase::other;
+        last = clock::now();
+        return;
+    }
+
+    /*
+     Start timing `p`, returning the phase that was being timed before.
+     Time since the last switch goes to the phase that was being timed.
+     */
+    inline uint32 start(const uint32& p) {
+        clock::time_point now = clock::now();
+        totals[current] += std::chrono::duration<double>(now - last).count();
+        last = now;
+        uint32 prev = current;
+        current = p;
+        return prev;
+    }
+
+    // Seconds spent in phase `p` (up to the last switch)
+    inline double total(const uint32& p) const {
+        return totals[p];
+    }
+
+};
+
+
+// Time (and/or trace) this phase until the object goes out of scope.
+class PhaseScope {
+
+    bool on;
+    bool tracing;
+    uint32 phase_;
+    uint32 prev;
+
+public:
+
+    PhaseScope(const uint32& p)
+        : on(PhaseTimers::enabled()), tracing(TraceBuffer::enabled()),
+          phase_(p), prev(0) {
+        if (on) prev = PhaseTimers::local().start(p);
+        if (tracing) TraceBuffer::local().begin(p);
+    }
+    ~PhaseScope() {
+        if (tracing) TraceBuffer::local().end(phase_);
+        if (on) PhaseTimers::local().start(prev);
+    }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+};
+
+
+
+#endif
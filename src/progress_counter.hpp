@@ -0,0 +1,169 @@
+# ifndef __CLONEWARS_PROGRESS_COUNTER_H
+# define __CLONEWARS_PROGRESS_COUNTER_H
+
+
+#include <vector>               // vector class
+#include <atomic>               // atomic
+#include <chrono>               // milliseconds
+#include <thread>               // sleep_for
+#include <algorithm>            // min
+#ifdef CLONEWARS_STANDALONE
+#include <iostream>             // cerr
+#else
+#include <progress.hpp>         // for the progress bar
+#endif
+#ifdef _OPENMP
+#include <omp.h>                // OpenMP
+#endif
+#include "clonewars_types.hpp"  // integer types
+
+
+
+#ifdef CLONEWARS_STANDALONE
+/*
+ Without R, this replaces RcppProgress's `Progress` class.
+ It prints percent finished to stderr and can't be interrupted.
+ */
+class Progress {
+
+    uint64 max;
+    uint64 current;
+    uint32 last_pct;
+    bool display;
+
+public:
+
+    Progress(const uint64& max_, const bool& display_)
+        : max(max_), current(0), last_pct(0), display(display_) {};
+    ~Progress() {
+        if (display && last_pct < 100) std::cerr << "\r100%" << std::endl;
+    }
+
+    void increment(const uint64& n = 1) {
+        current += n;
+        if (!display || max == 0) return;
+        uint32 pct = static_cast<uint32>((100 * std::min(current, max)) / max);
+        if (pct > last_pct) {
+            last_pct = pct;
+            std::cerr << "\r" << pct << "%" << std::flush;
+            if (pct == 100) std::cerr << std::endl;
+        }
+        return;
+    }
+    inline bool is_aborted() const {
+        return false;
+    }
+    inline bool check_abort() {
+        return false;
+    }
+
+};
+#endif
+
+
+
+/*
+ Progress and user interrupts for the parallel reps.
+
+ Worker threads only add to their own atomic counter and read an atomic
+ "aborted" flag, so they never wait on each other or on R.
+ Only the master thread (the one R is running on) touches the progress bar
+ and checks for user interrupts.
+ It does this while simulating its own reps, then keeps doing it until
+ all the other threads are done (see `monitor`).
+ */
+class ProgressCounter {
+
+    // Each counter gets its own cache line so threads don't slow each other down:
+    struct Slot {
+        std::atomic<uint64> n;
+        char pad[64 - sizeof(std::atomic<uint64>)];
+        Slot() : n(0) {};
+    };
+
+    Progress& prog_bar;
+    std::vector<Slot> slots;
+    std::atomic<bool> aborted_;
+    std::atomic<uint32> n_finished;
+    uint64 reported;  // only used by master thread
+
+    inline static uint32 thread__() {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+    }
+
+public:
+
+    ProgressCounter(Progress& prog_bar_, const uint32& n_threads)
+        : prog_bar(prog_bar_), slots(n_threads), aborted_(false),
+          n_finished(0), reported(0) {};
+
+    // Add `n` days finished by this thread.
+    inline void add(const uint64& n) {
+        slots[thread__()].n.fetch_add(n, std::memory_order_relaxed);
+        return;
+    }
+
+    inline bool aborted() const {
+        return aborted_.load(std::memory_order_relaxed);
+    }
+
+    /*
+     Update progress bar and check for user interrupts.
+     This does nothing when not called from the master thread.
+     */
+    void report() {
+        if (thread__() != 0) return;
+        uint64 total = 0;
+        for (const Slot& s : slots) total += s.n.load(std::memory_order_relaxed);
+        if (total > reported) {
+            prog_bar.increment(total - reported);
+            reported = total;
+        }
+        if (!aborted() && (prog_bar.is_aborted() || prog_bar.check_abort())) {
+            aborted_.store(true, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    // Call once by each thread when it has no more reps to simulate.
+    inline void finish_thread() {
+        n_finished.fetch_add(1, std::memory_order_release);
+        return;
+    }
+
+    /*
+     Keep reporting progress until all `n_team` threads are finished.
+     Only the master thread should call this, after `finish_thread`.
+     */
+    void monitor(const uint32& n_team) {
+        while (n_finished.load(std::memory_order_acquire) < n_team) {
+            report();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        report();
+        return;
+    }
+
+};
+
+
+// For checking for user interrupts every N iterations:
+inline bool interrupt_check(uint32& iters,
+                            ProgressCounter& progress,
+                            const uint32& N = 100) {
+    ++iters;
+    if (iters > N) {
+        progress.add(iters);
+        iters = 0;
+        progress.report();
+        return progress.aborted();
+    }
+    return false;
+}
+
+
+#endif
@@ -0,0 +1,114 @@
+# ifndef __CLONEWARS_RCPP_COMPAT_H
+# define __CLONEWARS_RCPP_COMPAT_H
+
+
+/*
+ The simulation core (everything but the functions exported to R) only needs
+ Armadillo, `stop`, and a couple of R's normal distribution functions.
+ When compiled with `-DCLONEWARS_STANDALONE` (see `standalone/Makefile`),
+ this file provides those without R, so the core can be built into programs
+ that don't need an R session.
+ Otherwise it just includes RcppArmadillo.
+ */
+
+
+#ifdef CLONEWARS_STANDALONE
+
+#include <armadillo>            // arma namespace
+#include <string>               // string class
+#include <stdexcept>            // runtime_error
+#include <cmath>                // erfc, sqrt, log, exp
+#include <limits>               // infinity
+#include <random>               // mt19937
+
+
+namespace Rcpp {
+    // Same as `Rcpp::stop`, except that nothing catches it for R:
+    [[noreturn]] inline void stop(const std::string& msg) {
+        throw std::runtime_error(msg);
+    }
+}
+
+
+namespace R {
+
+    inline double pnorm5(double x, double mu, double sigma,
+                         int lower_tail, int log_p) {
+        double z = (x - mu) / sigma;
+        if (!lower_tail) z = -z;
+        double p = 0.5 * std::erfc(-z / std::sqrt(2.0));
+        if (log_p) p = std::log(p);
+        return p;
+    }
+
+    /*
+     Acklam's rational approximation, followed by one step of Halley's method
+     (which gets it to about the same precision as R's version).
+     */
+    inline double qnorm5(double p, double mu, double sigma,
+                         int lower_tail, int log_p) {
+
+        static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                                   -2.759285104469687e+02, 1.383577518672690e+02,
+                                   -3.066479806614716e+01, 2.506628277459239e+00};
+        static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                                   -1.556989798598866e+02, 6.680131188771972e+01,
+                                   -1.328068155288572e+01};
+        static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                                   -2.400758277161838e+00, -2.549732539343734e+00,
+                                   4.374664141464968e+00, 2.938163982698783e+00};
+        static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                                   2.445134137142996e+00, 3.754408661907416e+00};
+        const double p_low = 0.02425;
+        const double sqrt_2pi = 2.506628274631000502;
+
+        if (log_p) p = std::exp(p);
+        if (!lower_tail) p = 1 - p;
+        if (p <= 0) return -std::numeric_limits<double>::infinity();
+        if (p >= 1) return std::numeric_limits<double>::infinity();
+
+        double x, q, r;
+        if (p < p_low) {
+            q = std::sqrt(-2 * std::log(p));
+            x = (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+                ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+        } else if (p <= 1 - p_low) {
+            q = p - 0.5;
+            r = q * q;
+            x = (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q /
+                (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1);
+        } else {
+            q = std::sqrt(-2 * std::log(1 - p));
+            x = -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+                ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+        }
+
+        double e = 0.5 * std::erfc(-x / std::sqrt(2.0)) - p;
+        double u = e * sqrt_2pi * std::exp(x * x / 2);
+        x -= u / (1 + x * u / 2);
+
+        return mu + sigma * x;
+    }
+
+}
+
+
+/*
+ Stands in for R's RNG when making seeds for each rep (see `pcg.hpp`).
+ Programs should seed this before simulating.
+ */
+inline std::mt19937& standalone_rng() {
+    static std::mt19937 eng(std::random_device{}());
+    return eng;
+}
+
+
+#else
+
+#include <RcppArmadillo.h>      // arma namespace, Rcpp, R
+
+#endif
+
+
+
+#endif
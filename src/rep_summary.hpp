@@ -0,0 +1,530 @@
+# ifndef __CLONEWARS_REP_SUMMARY_H
+# define __CLONEWARS_REP_SUMMARY_H
+
+
+#include "rcpp_compat.hpp"      // arma namespace
+#include <vector>               // vector class
+#include <string>               // string class
+#include "clonewars_types.hpp"  // integer types
+#include "patches.hpp"          // OneCage
+#include "arena.hpp"            // arena_vector
+#include "serialize.hpp"        // StateWriter, StateReader
+#include "phase_timer.hpp"      // PhaseScope
+#include "simulations.hpp"      // SimOutput
+
+
+
+// Calculate the number of rows per rep, for `n_times` saved time points.
+inline void calc_rep_rows(uint32& n_rows,
+                          uint32& n_rows_wasps,
+                          const uint32& n_times,
+                          const uint32& n_lines,
+                          const uint32& n_cages,
+                          const uint32& n_patches) {
+
+    n_rows_wasps = n_cages * n_times;
+
+    n_rows = n_cages * n_patches * n_lines * n_times;
+    n_rows *= 2;  // `*2` for separate alate vs apterous
+    n_rows += n_cages * n_patches * n_times;  // for mummies
+
+    return;
+}
+
+
+/*
+
+
+ leslie_matrix__(instar_days, surv_juv, surv_adult, repro, leslie_);
+ leslie_sad__(leslie_, X_0_);
+ X_0_ *= aphid_density_0;
+
+ OR
+
+ leslie_matrix__(instar_days, surv_juv, surv_adult, repro, leslie_);
+ X_0_ = aphid_density_0;
+ */
+
+/*
+ To calculate dispersal start date
+ arma::accu(instar_days.head(instar_days.n_elem - 1)) - 1
+ */
+
+
+/*
+ Output from one rep (or, after `assimilate`, from all of them).
+ Each vector is a column in the output data frames.
+
+ When `sparse` is true, aphid and mummy rows with zero abundance are left out,
+ and the `event_*` columns record when each line in each patch went extinct
+ (its abundance went to zero) or colonized it (its abundance went from zero
+ to above zero) between saved time points.
+ Wasp rows are always kept, so they give all the saved times for each cage.
+ */
+struct RepSummary {
+
+    std::vector<uint32> rep;
+    std::vector<uint32> time;
+    std::vector<uint32> cage;
+    std::vector<uint32> patch;
+    std::vector<std::string> line;
+    std::vector<std::string> type;
+    std::vector<output_t> N;
+    std::vector<uint32> wasp_rep;
+    std::vector<uint32> wasp_time;
+    std::vector<uint32> wasp_cage;
+    std::vector<output_t> wasp_N;
+    std::vector<uint32> event_rep;
+    std::vector<uint32> event_time;
+    std::vector<uint32> event_cage;
+    std::vector<uint32> event_patch;
+    std::vector<std::string> event_line;
+    std::vector<std::string> event_type;
+
+    RepSummary()
+        : rep(), time(), cage(), patch(), line(), type(), N(),
+          wasp_rep(), wasp_time(), wasp_cage(), wasp_N(),
+          event_rep(), event_time(), event_cage(), event_patch(),
+          event_line(), event_type(), r(), sparse(false), present(),
+          first_point(true) {};
+
+    // `n_times` is the max # time points saved (see `SaveSchedule::n_saves`)
+    void reserve(const uint32& rep_,
+                 const uint32& n_times,
+                 const uint32& n_lines,
+                 const uint32& n_cages,
+                 const uint32& n_patches,
+                 const bool& sparse_ = false) {
+        uint32 n_rows, n_rows_wasps;
+        calc_rep_rows(n_rows, n_rows_wasps, n_times,
+                      n_lines, n_cages, n_patches);
+        r = rep_;
+        sparse = sparse_;
+        // (there's no telling how many rows sparse output will have)
+        if (sparse) n_rows = 0;
+        rep.reserve(n_rows);
+        time.reserve(n_rows);
+        cage.reserve(n_rows);
+        patch.reserve(n_rows);
+        line.reserve(n_rows);
+        type.reserve(n_rows);
+        N.reserve(n_rows);
+        wasp_rep.reserve(n_rows_wasps);
+        wasp_time.reserve(n_rows_wasps);
+        wasp_cage.reserve(n_rows_wasps);
+        wasp_N.reserve(n_rows_wasps);
+    }
+
+    // This version used when assimilating all reps into the first one
+    void reserve(const uint32& n, const uint32& nw) {
+        rep.reserve(n);
+        time.reserve(n);
+        cage.reserve(n);
+        patch.reserve(n);
+        line.reserve(n);
+        type.reserve(n);
+        N.reserve(n);
+        wasp_rep.reserve(nw);
+        wasp_time.reserve(nw);
+        wasp_cage.reserve(nw);
+        wasp_N.reserve(nw); // `nw` is for the wasp vectors
+        return;
+    }
+
+
+    void push_back(const uint32& t,
+                   const arena_vector<OneCage>& cages) {
+
+        PhaseScope timer(phase::output);
+
+        start_time_point__(cages);
+        uint32 l = 0;  // index for `present`
+
+        for (uint32 k = 0; k < cages.size(); k++) {
+
+            const OneCage& cage(cages[k]);
+
+            // Everything but wasps:
+            for (uint32 j = 0; j < cage.size(); j++) {
+                const OnePatch& patch(cage[j]);
+                for (uint32 i = 0; i < patch.size(); i++) {
+                    const AphidPop& aphid(patch[i]);
+                    append_living_aphids__(t, k, j, aphid.aphid_name,
+                                           aphid.alates.total_aphids(),
+                                           aphid.apterous.total_aphids(), l);
+                    l++;
+                }
+                append_mummies__(t, k, j, patch.total_mummies());
+            }
+
+            wasp_rep.push_back(r);
+            wasp_time.push_back(t);
+            wasp_cage.push_back(k);
+            wasp_N.push_back(static_cast<output_t>(cage.wasps.Y));
+        }
+
+        return;
+    }
+
+
+    /*
+     Same as above, but abundances come from `values`, which should be in the
+     same order as they're added above (see `output_values__` below).
+     */
+    void push_back(const uint32& t,
+                   const arena_vector<OneCage>& cages,
+                   const arena_vector<double>& values) {
+
+        PhaseScope timer(phase::output);
+
+        uint32 v = 0;
+        start_time_point__(cages);
+        uint32 l = 0;  // index for `present`
+
+        for (uint32 k = 0; k < cages.size(); k++) {
+
+            const OneCage& cage(cages[k]);
+
+            for (uint32 j = 0; j < cage.size(); j++) {
+                const OnePatch& patch(cage[j]);
+                for (uint32 i = 0; i < patch.size(); i++) {
+                    append_living_aphids__(t, k, j, patch[i].aphid_name,
+                                           values[v], values[v+1], l);
+                    v += 2;
+                    l++;
+                }
+                append_mummies__(t, k, j, values[v]);
+                v++;
+            }
+
+            wasp_rep.push_back(r);
+            wasp_time.push_back(t);
+            wasp_cage.push_back(k);
+            wasp_N.push_back(static_cast<output_t>(values[v]));
+            v++;
+        }
+
+        return;
+    }
+
+
+    void clear() {
+
+        rep.clear();
+        time.clear();
+        cage.clear();
+        patch.clear();
+        line.clear();
+        type.clear();
+        N.clear();
+        wasp_rep.clear();
+        wasp_time.clear();
+        wasp_cage.clear();
+        wasp_N.clear();
+        event_rep.clear();
+        event_time.clear();
+        event_cage.clear();
+        event_patch.clear();
+        event_line.clear();
+        event_type.clear();
+
+        // to clear memory:
+        rep.shrink_to_fit();
+        time.shrink_to_fit();
+        cage.shrink_to_fit();
+        patch.shrink_to_fit();
+        line.shrink_to_fit();
+        type.shrink_to_fit();
+        N.shrink_to_fit();
+        wasp_rep.shrink_to_fit();
+        wasp_time.shrink_to_fit();
+        wasp_cage.shrink_to_fit();
+        wasp_N.shrink_to_fit();
+        event_rep.shrink_to_fit();
+        event_time.shrink_to_fit();
+        event_cage.shrink_to_fit();
+        event_patch.shrink_to_fit();
+        event_line.shrink_to_fit();
+        event_type.shrink_to_fit();
+    }
+
+
+    void assimilate(RepSummary& other) {
+
+        for (uint32 i = 0; i < other.time.size(); i++) {
+
+            rep.push_back(other.rep[i]);
+            time.push_back(other.time[i]);
+            cage.push_back(other.cage[i]);
+            patch.push_back(other.patch[i]);
+            line.push_back(other.line[i]);
+            type.push_back(other.type[i]);
+            N.push_back(other.N[i]);
+
+        }
+
+        for (uint32 i = 0; i < other.wasp_time.size(); i++) {
+
+            wasp_rep.push_back(other.wasp_rep[i]);
+            wasp_time.push_back(other.wasp_time[i]);
+            wasp_cage.push_back(other.wasp_cage[i]);
+            wasp_N.push_back(other.wasp_N[i]);
+
+        }
+
+        for (uint32 i = 0; i < other.event_time.size(); i++) {
+
+            event_rep.push_back(other.event_rep[i]);
+            event_time.push_back(other.event_time[i]);
+            event_cage.push_back(other.event_cage[i]);
+            event_patch.push_back(other.event_patch[i]);
+            event_line.push_back(other.event_line[i]);
+            event_type.push_back(other.event_type[i]);
+
+        }
+
+        other.clear();
+
+        return;
+
+    }
+
+
+    /*
+     Add a copy of rows `[0, n)` (and wasp rows `[0, nw)` and event rows
+     `[0, ne)`) with a new rep number.
+     This is for reps that are known to be identical to the first one.
+     */
+    void repeat(const uint32& n, const uint32& nw, const uint32& ne,
+                const uint32& rep_) {
+
+        for (uint32 i = 0; i < n; i++) {
+            rep.push_back(rep_);
+            time.push_back(time[i]);
+            cage.push_back(cage[i]);
+            patch.push_back(patch[i]);
+            line.push_back(line[i]);
+            type.push_back(type[i]);
+            N.push_back(N[i]);
+        }
+
+        for (uint32 i = 0; i < nw; i++) {
+            wasp_rep.push_back(rep_);
+            wasp_time.push_back(wasp_time[i]);
+            wasp_cage.push_back(wasp_cage[i]);
+            wasp_N.push_back(wasp_N[i]);
+        }
+
+        for (uint32 i = 0; i < ne; i++) {
+            event_rep.push_back(rep_);
+            event_time.push_back(event_time[i]);
+            event_cage.push_back(event_cage[i]);
+            event_patch.push_back(event_patch[i]);
+            event_line.push_back(event_line[i]);
+            event_type.push_back(event_type[i]);
+        }
+
+        return;
+    }
+
+
+    // Move all output to `out` (this is left empty):
+    void move_to(SimOutput& out) {
+        out.rep.swap(rep);
+        out.time.swap(time);
+        out.cage.swap(cage);
+        out.patch.swap(patch);
+        out.line.swap(line);
+        out.type.swap(type);
+        out.N.swap(N);
+        out.wasp_rep.swap(wasp_rep);
+        out.wasp_time.swap(wasp_time);
+        out.wasp_cage.swap(wasp_cage);
+        out.wasp_N.swap(wasp_N);
+        out.event_rep.swap(event_rep);
+        out.event_time.swap(event_time);
+        out.event_cage.swap(event_cage);
+        out.event_patch.swap(event_patch);
+        out.event_line.swap(event_line);
+        out.event_type.swap(event_type);
+        clear();
+        return;
+    }
+
+
+    // Save and restore output so far (see `serialize.hpp`)
+    void save_state(StateWriter& out) const {
+        out.write(r);
+        out.write(rep);
+        out.write(time);
+        out.write(cage);
+        out.write(patch);
+        out.write(line);
+        out.write(type);
+        out.write(N);
+        out.write(wasp_rep);
+        out.write(wasp_time);
+        out.write(wasp_cage);
+        out.write(wasp_N);
+        out.write(sparse);
+        out.write(present);
+        out.write(event_rep);
+        out.write(event_time);
+        out.write(event_cage);
+        out.write(event_patch);
+        out.write(event_line);
+        out.write(event_type);
+        return;
+    }
+    void load_state(StateReader& in) {
+        in.read(r);
+        in.read(rep);
+        in.read(time);
+        in.read(cage);
+        in.read(patch);
+        in.read(line);
+        in.read(type);
+        in.read(N);
+        in.read(wasp_rep);
+        in.read(wasp_time);
+        in.read(wasp_cage);
+        in.read(wasp_N);
+        // Sparse output can't be continued as dense, or vice versa:
+        bool sparse_;
+        in.read(sparse_);
+        if (sparse_ != sparse) in.fail();
+        in.read(present);
+        in.read(event_rep);
+        in.read(event_time);
+        in.read(event_cage);
+        in.read(event_patch);
+        in.read(event_line);
+        in.read(event_type);
+        return;
+    }
+
+
+private:
+
+    uint32 r;
+    bool sparse;
+    /*
+     For sparse output, whether each line in each patch (in the same order
+     they're added to output) had any aphids at the last saved time point.
+     It's empty before the first time point.
+     */
+    std::vector<bool> present;
+
+    // For sparse output, whether this is the first time point (which has no events):
+    bool first_point;
+
+    inline void start_time_point__(const arena_vector<OneCage>& cages) {
+        if (!sparse) return;
+        first_point = present.empty();
+        if (first_point) {
+            uint32 n = 0;
+            for (const OneCage& cage : cages) {
+                for (uint32 j = 0; j < cage.size(); j++) n += cage[j].size();
+            }
+            present.assign(n, false);
+        }
+        return;
+    }
+
+    inline void append_living_aphids__(const uint32& t,
+                                       const uint32& c,
+                                       const uint32& p,
+                                       const std::string& l,
+                                       const double& N_ala,
+                                       const double& N_apt,
+                                       const uint32& idx) {
+
+        if (sparse) {
+            append_sparse_aphids__(t, c, p, l, N_ala, N_apt, idx);
+            return;
+        }
+
+        rep.push_back(r);
+        rep.push_back(r);
+
+        time.push_back(t);
+        time.push_back(t);
+
+        cage.push_back(c);
+        cage.push_back(c);
+
+        patch.push_back(p);
+        patch.push_back(p);
+
+        line.push_back(l);
+        line.push_back(l);
+
+        type.push_back("alate");
+        type.push_back("apterous");
+
+        N.push_back(static_cast<output_t>(N_ala));
+        N.push_back(static_cast<output_t>(N_apt));
+
+        return;
+    }
+
+    inline void append_sparse_aphids__(const uint32& t,
+                                       const uint32& c,
+                                       const uint32& p,
+                                       const std::string& l,
+                                       const double& N_ala,
+                                       const double& N_apt,
+                                       const uint32& idx) {
+
+        const bool now = N_ala > 0 || N_apt > 0;
+        if (!first_point && now != present[idx]) {
+            event_rep.push_back(r);
+            event_time.push_back(t);
+            event_cage.push_back(c);
+            event_patch.push_back(p);
+            event_line.push_back(l);
+            event_type.push_back(now ? "colonization" : "extinction");
+        }
+        present[idx] = now;
+
+        if (N_ala > 0) {
+            rep.push_back(r);
+            time.push_back(t);
+            cage.push_back(c);
+            patch.push_back(p);
+            line.push_back(l);
+            type.push_back("alate");
+            N.push_back(static_cast<output_t>(N_ala));
+        }
+        if (N_apt > 0) {
+            rep.push_back(r);
+            time.push_back(t);
+            cage.push_back(c);
+            patch.push_back(p);
+            line.push_back(l);
+            type.push_back("apterous");
+            N.push_back(static_cast<output_t>(N_apt));
+        }
+
+        return;
+    }
+
+    inline void append_mummies__(const uint32& t,
+                                 const uint32& c,
+                                 const uint32& p,
+                                 const double& N_mum) {
+        if (sparse && !(N_mum > 0)) return;
+        rep.push_back(r);
+        time.push_back(t);
+        cage.push_back(c);
+        patch.push_back(p);
+        line.push_back("");
+        type.push_back("mummy");
+        N.push_back(static_cast<output_t>(N_mum));
+        return;
+    }
+};
+
+
+
+#endif
@@ -0,0 +1,625 @@
+
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ Writing and reading stores of simulation output (see `result_store.hpp`).
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include "rcpp_compat.hpp"      // arma namespace, stop
+#include <vector>               // vector class
+#include <string>               // string class
+#include <fstream>              // file streams
+#include <cstdio>               // rename, remove
+#include <cstring>              // memcpy, memcmp
+#include <cstdint>              // fixed-width integer types
+#include <cmath>                // signbit
+#include <limits>               // numeric_limits
+#include <algorithm>            // lower_bound, upper_bound, min
+#ifndef _WIN32
+#include <fcntl.h>              // open
+#include <unistd.h>             // close
+#include <sys/mman.h>           // mmap, munmap, madvise
+#include <sys/stat.h>           // fstat
+#endif
+
+#include "clonewars_types.hpp"  // integer types
+#include "result_store.hpp"     // StoreWriter, StoreWriteQueue, MappedFile, StoreReader
+#include "simulations.hpp"      // SimOutput
+#include "rep_summary.hpp"      // RepSummary
+
+
+
+
+/*
+ *****************************************************************************
+ StoreWriter
+ *****************************************************************************
+ */
+
+
+/*
+ Add `n` abundances to the end of `runs` as zero runs (see `result_store.hpp`).
+ Only positive zeros are dropped, so decoding gives back the same bits.
+ */
+template <typename T>
+void encode_runs__(const T* x, const std::uint64_t& n, std::vector<char>& runs) {
+
+    const std::uint64_t max_run = std::numeric_limits<std::uint32_t>::max();
+
+    std::uint64_t i = 0;
+    while (i < n) {
+        std::uint32_t n_zeros = 0;
+        while (i < n && n_zeros < max_run && x[i] == 0 && !std::signbit(x[i])) {
+            n_zeros++;
+            i++;
+        }
+        const std::uint64_t start = i;
+        while (i < n && i - start < max_run && (x[i] != 0 || std::signbit(x[i]))) i++;
+        const std::uint32_t n_values = i - start;
+        const std::uint64_t pos = runs.size();
+        runs.resize(pos + 2 * sizeof(std::uint32_t) + n_values * sizeof(T));
+        std::memcpy(&runs[pos], &n_zeros, sizeof(std::uint32_t));
+        std::memcpy(&runs[pos + sizeof(std::uint32_t)], &n_values, sizeof(std::uint32_t));
+        if (n_values > 0) {
+            std::memcpy(&runs[pos + 2 * sizeof(std::uint32_t)], x + start,
+                        n_values * sizeof(T));
+        }
+    }
+
+    return;
+}
+
+
+
+StoreWriter::StoreWriter(const std::string& fn_,
+                         const uint32& n_reps,
+                         const uint32& n_cages_,
+                         const uint32& n_patches_,
+                         const std::vector<std::string>& aphid_name_,
+                         const bool& compress_)
+    : fn(fn_), tmp_fn(), out(), pos(0), n_cages(n_cages_), n_patches(n_patches_),
+      n_lines(aphid_name_.size()),
+      rows_per_time(n_cages_ * n_patches_ * (2 * aphid_name_.size() + 1)),
+      aphid_name(aphid_name_), index(), compress(compress_), runs(), closed(false) {
+
+    if (!active()) return;
+
+    tmp_fn = fn + ".tmp";
+    out.open(tmp_fn, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return;
+
+    index.resize(n_reps);
+
+    write_bytes__(store::magic, 8);
+    write_u64__(store::version);
+    write_u64__(sizeof(output_t));
+    write_u64__(compress ? store::zero_runs : store::raw);
+    write_u64__(n_reps);
+    write_u64__(n_cages);
+    write_u64__(n_patches);
+    write_u64__(n_lines);
+    for (const std::string& name : aphid_name) {
+        write_u64__(name.size());
+        write_bytes__(name.data(), name.size());
+    }
+    pad__();
+
+    return;
+}
+
+
+StoreWriter::~StoreWriter() {
+    if (active() && !closed) {
+        if (out.is_open()) out.close();
+        std::remove(tmp_fn.c_str());
+    }
+}
+
+
+void StoreWriter::write_bytes__(const void* x, const std::uint64_t& n) {
+    out.write(static_cast<const char*>(x), n);
+    pos += n;
+    return;
+}
+
+void StoreWriter::pad__() {
+    const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    if (pos % 8 != 0) write_bytes__(zeros, 8 - pos % 8);
+    return;
+}
+
+
+/*
+ Check that the first time point has the order of rows that the reader
+ assumes, and that there are the same number of rows at every time point.
+ */
+bool StoreWriter::rows_match__(const RepSummary& summary) const {
+
+    const std::uint64_t n_times = summary.wasp_N.size() / n_cages;
+    if (summary.wasp_N.size() != n_times * n_cages) return false;
+    if (summary.N.size() != n_times * rows_per_time) return false;
+    if (n_times == 0) return true;
+
+    uint32 r = 0;
+    for (uint32 k = 0; k < n_cages; k++) {
+        if (summary.wasp_cage[k] != k) return false;
+        for (uint32 j = 0; j < n_patches; j++) {
+            for (uint32 i = 0; i < n_lines; i++) {
+                for (const char* type : {"alate", "apterous"}) {
+                    if (summary.cage[r] != k || summary.patch[r] != j ||
+                        summary.line[r] != aphid_name[i] || summary.type[r] != type) {
+                        return false;
+                    }
+                    r++;
+                }
+            }
+            if (summary.cage[r] != k || summary.patch[r] != j ||
+                summary.type[r] != "mummy") return false;
+            r++;
+        }
+    }
+
+    return true;
+}
+
+
+bool StoreWriter::write(const uint32& rep, const RepSummary& summary) {
+
+    if (!out.good() || !rows_match__(summary)) return false;
+
+    StoreIndexEntry& entry(index[rep]);
+    entry.n_times = summary.wasp_N.size() / n_cages;
+    if (entry.n_times == 0) return true;
+
+    std::vector<std::uint32_t> times(entry.n_times);
+    for (uint32 t = 0; t < entry.n_times; t++) {
+        times[t] = summary.wasp_time[t * n_cages];
+        // They have to be increasing for reading by time:
+        if (t > 0 && times[t] <= times[t-1]) return false;
+    }
+
+    entry.offset = pos;
+    entry.t_min = times.front();
+    entry.t_max = times.back();
+
+    write_bytes__(times.data(), times.size() * sizeof(std::uint32_t));
+    pad__();
+    if (compress) {
+        runs.clear();
+        encode_runs__(summary.N.data(), summary.N.size(), runs);
+        encode_runs__(summary.wasp_N.data(), summary.wasp_N.size(), runs);
+        write_u64__(runs.size());
+        write_bytes__(runs.data(), runs.size());
+    } else {
+        write_bytes__(summary.N.data(), summary.N.size() * sizeof(output_t));
+        write_bytes__(summary.wasp_N.data(), summary.wasp_N.size() * sizeof(output_t));
+    }
+    pad__();
+
+    return out.good();
+}
+
+
+bool StoreWriter::close() {
+
+    if (!active() || closed) return true;
+
+    const std::uint64_t index_offset = pos;
+    for (const StoreIndexEntry& entry : index) {
+        write_u64__(entry.offset);
+        write_u64__(entry.n_times);
+        write_u64__(entry.t_min);
+        write_u64__(entry.t_max);
+    }
+    write_u64__(index_offset);
+    write_bytes__(store::index_magic, 8);
+
+    out.close();
+    if (out.fail()) return false;
+    if (std::rename(tmp_fn.c_str(), fn.c_str()) != 0) return false;
+
+    closed = true;
+
+    return true;
+}
+
+
+void StoreWriter::discard() {
+
+    if (!active() || closed) return;
+
+    if (out.is_open()) out.close();
+    std::remove(tmp_fn.c_str());
+    std::remove(fn.c_str());
+
+    closed = true;
+
+    return;
+}
+
+
+
+
+/*
+ *****************************************************************************
+ StoreWriteQueue
+ *****************************************************************************
+ */
+
+
+StoreWriteQueue::StoreWriteQueue(StoreWriter& store_, const uint32& capacity_)
+    : store(store_), capacity(std::max(capacity_, static_cast<uint32>(1))), queue(), mtx(),
+      not_full(), not_empty(), done(false), failed(false), writer() {
+    if (store.active()) writer = std::thread(&StoreWriteQueue::run__, this);
+}
+
+
+void StoreWriteQueue::run__() {
+
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (true) {
+        not_empty.wait(lock, [this]() { return done || !queue.empty(); });
+        if (queue.empty()) break;
+        std::pair<uint32, RepSummary> item(std::move(queue.front()));
+        queue.pop_front();
+        const bool skip = failed;
+        lock.unlock();
+        not_full.notify_one();
+        bool written = false;
+        if (!skip) {
+            // (nothing can be thrown from this thread to R)
+            try {
+                written = store.write(item.first, item.second);
+            } catch (...) {
+                written = false;
+            }
+        }
+        item.second.clear();
+        lock.lock();
+        if (!written && !failed) {
+            failed = true;
+            // Threads waiting to push should find out now:
+            not_full.notify_all();
+        }
+    }
+
+    return;
+}
+
+
+bool StoreWriteQueue::push(const uint32& rep, RepSummary& summary) {
+
+    std::unique_lock<std::mutex> lock(mtx);
+    not_full.wait(lock, [this]() { return failed || queue.size() < capacity; });
+    if (failed) {
+        lock.unlock();
+        summary.clear();
+        return false;
+    }
+    queue.emplace_back(rep, std::move(summary));
+    not_empty.notify_one();
+    lock.unlock();
+    summary.clear();
+
+    return true;
+}
+
+
+bool StoreWriteQueue::finish() {
+
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done = true;
+        }
+        not_empty.notify_one();
+        writer.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    return !failed;
+}
+
+
+
+
+/*
+ *****************************************************************************
+ MappedFile
+ *****************************************************************************
+ */
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& fn)
+    : in(fn, std::ios::in | std::ios::binary), size_(0) {
+    if (in.is_open()) {
+        in.seekg(0, std::ios::end);
+        size_ = static_cast<std::uint64_t>(in.tellg());
+    }
+}
+MappedFile::~MappedFile() {}
+
+bool MappedFile::is_open() const {
+    return in.is_open();
+}
+
+bool MappedFile::read(const std::uint64_t& offset,
+                      const std::uint64_t& n,
+                      void* dst) const {
+    if (offset > size_ || n > size_ - offset) return false;
+    if (n == 0) return true;
+    in.seekg(offset);
+    in.read(static_cast<char*>(dst), n);
+    return !in.fail();
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& fn) : data_(nullptr), size_(0) {
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            // Reads jump between reps and times, so read-ahead mostly wastes I/O:
+            madvise(map, st.st_size, MADV_RANDOM);
+            data_ = static_cast<const char*>(map);
+            size_ = st.st_size;
+        }
+    }
+    // (the mapping stays valid after this)
+    ::close(fd);
+}
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+}
+
+bool MappedFile::is_open() const {
+    return data_ != nullptr;
+}
+
+bool MappedFile::read(const std::uint64_t& offset,
+                      const std::uint64_t& n,
+                      void* dst) const {
+    if (offset > size_ || n > size_ - offset) return false;
+    if (n > 0) std::memcpy(dst, data_ + offset, n);
+    return true;
+}
+
+#endif
+
+
+
+
+/*
+ *****************************************************************************
+ StoreReader
+ *****************************************************************************
+ */
+
+
+StoreReader::StoreReader(const std::string& file_name)
+    : file(file_name), n_bytes(0), encoding(store::raw), rows_per_time(0), index(),
+      fn_(file_name), n_reps_(0), n_cages_(0), n_patches_(0), aphid_name_() {
+
+    if (!file.is_open()) {
+        Rcpp::stop("\nERROR: `" + fn_ + "` couldn't be opened.\n");
+    }
+
+    char magic[8];
+    if (!file.read(0, 8, magic) || std::memcmp(magic, store::magic, 8) != 0) {
+        Rcpp::stop("\nERROR: `" + fn_ + "` isn't a clonewars output store.\n");
+    }
+    std::uint64_t offset = 8;
+    // Version 1 is the same except that it has no encoding (so it's raw):
+    const std::uint64_t version = read_u64__(offset);
+    if (version != 1 && version != store::version) {
+        Rcpp::stop("\nERROR: `" + fn_ + "` was written by a version of clonewars "
+                   "that used a different format.\n");
+    }
+    n_bytes = read_u64__(offset);
+    if (n_bytes != sizeof(float) && n_bytes != sizeof(double)) corrupted__();
+    if (version > 1) encoding = read_u64__(offset);
+    if (encoding != store::raw && encoding != store::zero_runs) corrupted__();
+    n_reps_ = read_u64__(offset);
+    n_cages_ = read_u64__(offset);
+    n_patches_ = read_u64__(offset);
+    uint32 n_lines = read_u64__(offset);
+    if (n_lines > file.size()) corrupted__();  // (before allocating for them)
+    aphid_name_.resize(n_lines);
+    for (std::string& name : aphid_name_) {
+        std::uint64_t n = read_u64__(offset);
+        if (n > file.size()) corrupted__();
+        name.resize(n);
+        if (n > 0 && !file.read(offset, n, &name[0])) corrupted__();
+        offset += n;
+    }
+    rows_per_time = n_cages_ * n_patches_ * (2 * n_lines + 1);
+
+    // Footer, then index:
+    if (file.size() < 16) corrupted__();
+    offset = file.size() - 16;
+    std::uint64_t index_offset = read_u64__(offset);
+    if (!file.read(offset, 8, magic) || std::memcmp(magic, store::index_magic, 8) != 0) {
+        corrupted__();
+    }
+    if (index_offset + n_reps_ * 4 * sizeof(std::uint64_t) != file.size() - 16) {
+        corrupted__();
+    }
+    index.resize(n_reps_);
+    offset = index_offset;
+    for (StoreIndexEntry& entry : index) {
+        entry.offset = read_u64__(offset);
+        entry.n_times = read_u64__(offset);
+        entry.t_min = read_u64__(offset);
+        entry.t_max = read_u64__(offset);
+        // (encoded abundances are checked as they're decoded)
+        std::uint64_t n_vals = entry.n_times * (rows_per_time + n_cages_);
+        if (encoding != store::raw) n_vals = 0;
+        if (entry.offset + entry.n_times * sizeof(std::uint32_t) +
+            n_vals * n_bytes > index_offset + 8) {
+            corrupted__();
+        }
+    }
+
+}
+
+
+void StoreReader::corrupted__() const {
+    Rcpp::stop("\nERROR: `" + fn_ + "` is corrupted or incomplete.\n");
+}
+
+
+std::uint64_t StoreReader::read_u64__(std::uint64_t& offset) const {
+    std::uint64_t x;
+    if (!file.read(offset, sizeof(std::uint64_t), &x)) corrupted__();
+    offset += sizeof(std::uint64_t);
+    return x;
+}
+
+
+// Read `n` abundances starting at `offset`, in whichever precision they were written:
+void StoreReader::read_N__(const std::uint64_t& offset,
+                           const std::uint64_t& n,
+                           std::vector<output_t>& N) const {
+    if (n_bytes == sizeof(output_t)) {
+        N.resize(n);
+        if (!file.read(offset, n * n_bytes, N.data())) corrupted__();
+    } else if (n_bytes == sizeof(float)) {
+        std::vector<float> x(n);
+        if (!file.read(offset, n * n_bytes, x.data())) corrupted__();
+        N.assign(x.begin(), x.end());
+    } else {
+        std::vector<double> x(n);
+        if (!file.read(offset, n * n_bytes, x.data())) corrupted__();
+        N.assign(x.begin(), x.end());
+    }
+    return;
+}
+
+
+/*
+ Decode `n` abundances from zero runs starting at `offset` (which is moved past
+ them), without reading past `end`.
+ */
+void StoreReader::decode_N__(std::uint64_t& offset,
+                             const std::uint64_t& end,
+                             const std::uint64_t& n,
+                             std::vector<output_t>& N) const {
+    N.assign(n, 0);
+    std::vector<float> x_float;
+    std::vector<double> x_double;
+    std::uint64_t i = 0;
+    while (i < n) {
+        std::uint32_t n_run[2];
+        if (offset + sizeof(n_run) > end || !file.read(offset, sizeof(n_run), n_run)) {
+            corrupted__();
+        }
+        offset += sizeof(n_run);
+        const std::uint64_t n_zeros = n_run[0], n_values = n_run[1];
+        if (n_zeros + n_values > n - i || n_values * n_bytes > end - offset) corrupted__();
+        i += n_zeros;
+        if (n_values == 0) continue;
+        if (n_bytes == sizeof(float)) {
+            x_float.resize(n_values);
+            if (!file.read(offset, n_values * n_bytes, x_float.data())) corrupted__();
+            std::copy(x_float.begin(), x_float.end(), N.begin() + i);
+        } else {
+            x_double.resize(n_values);
+            if (!file.read(offset, n_values * n_bytes, x_double.data())) corrupted__();
+            std::copy(x_double.begin(), x_double.end(), N.begin() + i);
+        }
+        offset += n_values * n_bytes;
+        i += n_values;
+    }
+    return;
+}
+
+
+void StoreReader::read(const uint32& rep,
+                       const uint32& t_min,
+                       const uint32& t_max,
+                       SimOutput& out) const {
+
+    if (rep >= n_reps_) {
+        Rcpp::stop("\nERROR: rep " + std::to_string(rep) + " isn't in `" + fn_ +
+                   "` (reps go from 0 to " + std::to_string(n_reps_ - 1) + ").\n");
+    }
+    const StoreIndexEntry& entry(index[rep]);
+    if (entry.n_times == 0 || t_min > entry.t_max || t_max < entry.t_min) return;
+
+    std::vector<std::uint32_t> times(entry.n_times);
+    if (!file.read(entry.offset, times.size() * sizeof(std::uint32_t), times.data())) {
+        corrupted__();
+    }
+    const uint32 t0 = std::lower_bound(times.begin(), times.end(), t_min) -
+        times.begin();
+    const uint32 t1 = std::upper_bound(times.begin(), times.end(), t_max) -
+        times.begin();
+    if (t0 >= t1) return;
+
+    std::uint64_t N_offset = entry.offset + entry.n_times * sizeof(std::uint32_t);
+    if (N_offset % 8 != 0) N_offset += 8 - N_offset % 8;
+
+    std::vector<output_t> N;
+    std::vector<output_t> wasp_N;
+    // Where rows for `t0` start in `N` and `wasp_N`:
+    uint64 r = 0, w = 0;
+    if (encoding == store::raw) {
+        const std::uint64_t wasp_offset = N_offset + entry.n_times * rows_per_time * n_bytes;
+        read_N__(N_offset + t0 * rows_per_time * n_bytes, (t1 - t0) * rows_per_time, N);
+        read_N__(wasp_offset + t0 * n_cages_ * n_bytes, (t1 - t0) * n_cages_, wasp_N);
+    } else {
+        std::uint64_t offset = N_offset;
+        const std::uint64_t n_runs = read_u64__(offset);
+        if (n_runs > file.size() - offset) corrupted__();
+        const std::uint64_t end = offset + n_runs;
+        decode_N__(offset, end, entry.n_times * rows_per_time, N);
+        decode_N__(offset, end, entry.n_times * n_cages_, wasp_N);
+        r = t0 * rows_per_time;
+        w = t0 * n_cages_;
+    }
+
+    const std::string alate("alate"), apterous("apterous"), mummy("mummy"), none("");
+
+    for (uint32 t = t0; t < t1; t++) {
+        for (uint32 k = 0; k < n_cages_; k++) {
+            for (uint32 j = 0; j < n_patches_; j++) {
+                for (const std::string& name : aphid_name_) {
+                    for (const std::string* type : {&alate, &apterous}) {
+                        out.rep.push_back(rep);
+                        out.time.push_back(times[t]);
+                        out.cage.push_back(k);
+                        out.patch.push_back(j);
+                        out.line.push_back(name);
+                        out.type.push_back(*type);
+                        out.N.push_back(N[r]);
+                        r++;
+                    }
+                }
+                out.rep.push_back(rep);
+                out.time.push_back(times[t]);
+                out.cage.push_back(k);
+                out.patch.push_back(j);
+                out.line.push_back(none);
+                out.type.push_back(mummy);
+                out.N.push_back(N[r]);
+                r++;
+            }
+            out.wasp_rep.push_back(rep);
+            out.wasp_time.push_back(times[t]);
+            out.wasp_cage.push_back(k);
+            out.wasp_N.push_back(wasp_N[w]);
+            w++;
+        }
+    }
+
+    return;
+}
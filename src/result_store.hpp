@@ -0,0 +1,288 @@
+# ifndef __CLONEWARS_RESULT_STORE_H
+# define __CLONEWARS_RESULT_STORE_H
+
+
+#include "rcpp_compat.hpp"      // arma namespace, stop
+#include <vector>               // vector class
+#include <string>               // string class
+#include <fstream>              // file streams
+#include <cstdint>              // fixed-width integer types
+#include <deque>                // deque
+#include <utility>              // pair
+#include <thread>               // thread
+#include <mutex>                // mutex, unique_lock
+#include <condition_variable>   // condition_variable
+#include "clonewars_types.hpp"  // integer types
+#include "simulations.hpp"      // SimOutput
+#include "rep_summary.hpp"      // RepSummary
+
+
+
+/*
+ Binary file of simulation output that can be read by rep and time without
+ reading the whole thing.
+
+ This is written by `sim_clonewars__` (when `store_file` isn't empty) one rep
+ at a time as reps finish, so output never has to all be in memory.
+ Numbers are stored in native byte order, like in `serialize.hpp`, but with
+ fixed-width integers so that files don't depend on the size of `uint32` etc.
+
+ Layout (all integers are 64-bit unless otherwise noted):
+
+     header:
+         "CLWSTORE"
+         format version
+         # bytes per abundance (4 if written with `-DCLONEWARS_FLOAT_OUTPUT`, else 8)
+         encoding of abundances (0 = raw, 1 = zero runs; see below)
+         n_reps, n_cages, n_patches, n_lines
+         line names (each as its length then its characters)
+     one chunk per simulated rep (each starting on an 8-byte boundary):
+         times               n_times values (32-bit), then padding to 8 bytes
+         aphid abundances    n_times * rows_per_time values
+         wasp abundances     n_times * n_cages values
+         (if encoded, the abundances are instead the # bytes of runs, then
+          the runs, then padding to 8 bytes)
+     index (one entry per rep):
+         chunk offset, n_times, first time, last time
+     footer:
+         offset of the index
+         "CLWINDEX"
+
+ Only abundances are stored, because every time point in a rep has the same
+ rows in the same order as `RepSummary::push_back` adds them: for each cage,
+ for each patch, alates then apterous for each line, then mummies.
+ The `cage`, `patch`, `line`, and `type` columns come from this order, and
+ `rep` comes from the index.
+ Reps that are copies of another one (see "deterministic" in `sim_clonewars__`)
+ point to the same chunk.
+
+ With `store_compress`, abundances are stored as runs: the # zeros (32-bit),
+ the # values after those zeros (32-bit), then those values.
+ Runs cover aphid abundances, then separately wasp abundances.
+ Abundances are zero for every line that's gone extinct from a patch (and
+ for patches that were cleared), so this mostly drops those.
+ Times can't be found at fixed offsets in an encoded chunk, so reading any
+ time from a rep decodes all of that rep's abundances.
+ Version 1 files have no encoding in the header and are always raw.
+ A store is only kept if every rep finished: after an interrupt, it's
+ discarded (see `StoreWriter::discard`).
+ */
+
+
+namespace store {
+    const char magic[] = "CLWSTORE";
+    const char index_magic[] = "CLWINDEX";
+    const std::uint64_t version = 2;
+    enum Encoding : std::uint64_t {
+        raw = 0,
+        zero_runs = 1
+    };
+}
+
+
+struct StoreIndexEntry {
+    std::uint64_t offset;
+    std::uint64_t n_times;
+    std::uint64_t t_min;
+    std::uint64_t t_max;
+    StoreIndexEntry() : offset(0), n_times(0), t_min(0), t_max(0) {};
+};
+
+
+
+/*
+ Writes a store to `fn + ".tmp"`, which is renamed to `fn` when `close` is
+ called, so an unfinished or failed run never leaves a store that looks
+ complete.
+ If it's destroyed before `close` is called, the temporary file is removed.
+ If `fn` is empty, this does nothing (and `active()` is false).
+ None of the methods are thread-safe.
+ */
+class StoreWriter {
+
+    std::string fn;
+    std::string tmp_fn;
+    std::ofstream out;
+    std::uint64_t pos;
+    std::uint64_t n_cages;
+    std::uint64_t n_patches;
+    std::uint64_t n_lines;
+    std::uint64_t rows_per_time;
+    std::vector<std::string> aphid_name;
+    std::vector<StoreIndexEntry> index;
+    bool compress;
+    std::vector<char> runs;     // (re-used for each rep's encoded abundances)
+    bool closed;
+
+    void write_bytes__(const void* x, const std::uint64_t& n);
+    void write_u64__(const std::uint64_t& x) {
+        write_bytes__(&x, sizeof(std::uint64_t));
+    }
+    void pad__();
+    bool rows_match__(const RepSummary& summary) const;
+
+public:
+
+    StoreWriter(const std::string& fn_,
+                const uint32& n_reps,
+                const uint32& n_cages_,
+                const uint32& n_patches_,
+                const std::vector<std::string>& aphid_name_,
+                const bool& compress_);
+    StoreWriter(const StoreWriter&) = delete;
+    StoreWriter& operator=(const StoreWriter&) = delete;
+    ~StoreWriter();
+
+    inline bool active() const noexcept { return !fn.empty(); }
+    inline bool good() const { return out.good(); }
+
+    /*
+     Add output from rep `rep`.
+     Returns false if it couldn't be written or if `summary` doesn't have the
+     rows described above.
+     */
+    bool write(const uint32& rep, const RepSummary& summary);
+    // Make rep `rep` point to the same output as rep `from`:
+    void repeat(const uint32& rep, const uint32& from) {
+        index[rep] = index[from];
+        return;
+    }
+    // Write the index and move the file to `fn`. Returns false if anything didn't work.
+    bool close();
+    /*
+     Remove the temporary file without writing the index, and also remove
+     any older file at `fn`, so an unfinished run doesn't leave a store that
+     looks like its output.
+     */
+    void discard();
+
+};
+
+
+
+
+/*
+ Writes reps to a `StoreWriter` on a background thread, so the threads
+ simulating reps don't wait for output to be written to disk.
+
+ At most `capacity` reps can be waiting to be written, so `push` waits when
+ the disk can't keep up instead of letting finished reps pile up in memory.
+ Reps are handed over once each, so a mutex is plenty fast here.
+ If `store` isn't active, no thread is started and nothing should be pushed.
+ `push` can be called from any thread, but `finish` should only be called
+ once all calls to `push` are done.
+ */
+class StoreWriteQueue {
+
+    StoreWriter& store;
+    const uint32 capacity;
+    std::deque<std::pair<uint32, RepSummary>> queue;
+    std::mutex mtx;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    bool done;      // no more reps will be pushed
+    bool failed;    // a rep couldn't be written
+    std::thread writer;
+
+    void run__();
+
+public:
+
+    StoreWriteQueue(StoreWriter& store_, const uint32& capacity_);
+    StoreWriteQueue(const StoreWriteQueue&) = delete;
+    StoreWriteQueue& operator=(const StoreWriteQueue&) = delete;
+    ~StoreWriteQueue() { finish(); }
+
+    /*
+     Move output from rep `rep` into the queue (`summary` is left empty).
+     Returns false if an earlier rep couldn't be written, in which case
+     `summary` is dropped.
+     */
+    bool push(const uint32& rep, RepSummary& summary);
+    // Wait for all reps to be written. Returns false if any couldn't be.
+    bool finish();
+
+};
+
+
+
+
+/*
+ Read-only view of a file's bytes.
+ It's memory-mapped (except on Windows, where it reads from a file stream),
+ so only the parts of the file that are read are brought into memory.
+ */
+class MappedFile {
+
+#ifdef _WIN32
+    mutable std::ifstream in;
+#else
+    const char* data_;
+#endif
+    std::uint64_t size_;
+
+public:
+
+    MappedFile(const std::string& fn);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool is_open() const;
+    inline std::uint64_t size() const noexcept { return size_; }
+    // Copy `n` bytes starting at `offset` to `dst`. Returns false if that's past the end.
+    bool read(const std::uint64_t& offset, const std::uint64_t& n, void* dst) const;
+
+};
+
+
+
+/*
+ Reads output from a store.
+ Errors (a missing, corrupted, or unrecognized file) result in a call to `stop`.
+ */
+class StoreReader {
+
+    MappedFile file;
+    std::uint64_t n_bytes;
+    std::uint64_t encoding;
+    std::uint64_t rows_per_time;
+    std::vector<StoreIndexEntry> index;
+
+    std::uint64_t read_u64__(std::uint64_t& offset) const;
+    void read_N__(const std::uint64_t& offset,
+                  const std::uint64_t& n,
+                  std::vector<output_t>& N) const;
+    void decode_N__(std::uint64_t& offset,
+                    const std::uint64_t& end,
+                    const std::uint64_t& n,
+                    std::vector<output_t>& N) const;
+    [[noreturn]] void corrupted__() const;
+
+    MEMBER(std::string, fn)
+    MEMBER(uint32, n_reps)
+    MEMBER(uint32, n_cages)
+    MEMBER(uint32, n_patches)
+    MEMBER(std::vector<std::string>, aphid_name)
+
+public:
+
+    StoreReader(const std::string& file_name);
+
+    /*
+     Add rows from rep `rep` at times from `t_min` to `t_max` (inclusive) to
+     the end of the columns in `out`.
+     Only those rows (plus the rep's time points) are read from the file,
+     unless the rep's abundances are encoded.
+     */
+    void read(const uint32& rep,
+              const uint32& t_min,
+              const uint32& t_max,
+              SimOutput& out) const;
+
+};
+
+
+
+
+#endif
@@ -0,0 +1,108 @@
+# ifndef __CLONEWARS_SAVE_SCHEDULE_H
+# define __CLONEWARS_SAVE_SCHEDULE_H
+
+
+#include <vector>               // vector class
+#include <deque>                // deque
+#include <cstring>              // memcpy
+#include "clonewars_types.hpp"  // integer types
+
+
+
+/*
+ Which days output is saved on.
+
+ Output is always saved on the first and last days, and on every day in
+ `[t, t + event_window)` for each perturbation or plant check on day `t`.
+ Other days are saved if they're a multiple of `save_every` or in `save_days`
+ (which is how log-spaced or piecewise schedules are made in R).
+ These are all known before a rep starts.
+
+ If `change` is above zero, a day that isn't on this schedule is also saved
+ when any abundance in the output differs from the last saved value by more
+ than `change` times that value, or goes to or from zero (e.g., extinctions).
+ At most `max_triggered` of these extra days are saved per rep, so the
+ number of rows in output never exceeds `n_saves`.
+ */
+class SaveSchedule {
+
+    std::vector<bool> fixed;    // whether each day is on the schedule
+
+public:
+
+    uint32 max_t;
+    double change;
+    uint32 max_triggered;
+
+    SaveSchedule(const uint32& max_t_,
+                 const uint32& save_every,
+                 const std::vector<uint32>& save_days,
+                 const std::vector<uint32>& perturb_when,
+                 const std::deque<uint32>& check_for_clear,
+                 const uint32& event_window,
+                 const double& change_,
+                 const uint32& max_triggered_)
+        : fixed(max_t_ + 1, false), max_t(max_t_), change(change_),
+          max_triggered(change_ > 0 ? max_triggered_ : 0) {
+
+        fixed.front() = true;
+        fixed.back() = true;
+        if (save_every > 0) {
+            for (uint32 t = 0; t <= max_t; t += save_every) fixed[t] = true;
+        }
+        for (const uint32& t : save_days) {
+            if (t <= max_t) fixed[t] = true;
+        }
+        if (event_window > 0) {
+            for (const uint32& t : perturb_when) add_window__(t, event_window);
+            for (const uint32& t : check_for_clear) add_window__(t, event_window);
+        }
+
+    }
+
+    // Whether day `t` is on the schedule:
+    inline bool scheduled(const uint32& t) const {
+        return t <= max_t && fixed[t];
+    }
+
+    // Whether days not on the schedule can be saved:
+    inline bool triggers() const noexcept {
+        return max_triggered > 0;
+    }
+
+    // Max # days saved for a rep that starts on day `t0`:
+    uint32 n_saves(const uint32& t0) const {
+        uint32 n = 1;  // for `t0`
+        for (uint32 t = t0 + 1; t <= max_t; t++) n += fixed[t];
+        return n + max_triggered;
+    }
+
+    // For checking that checkpoints were made with the same schedule:
+    uint64 checksum() const {
+        uint64 x = 1469598103934665603ULL;
+        for (uint32 t = 0; t <= max_t; t++) {
+            if (!fixed[t]) continue;
+            x ^= static_cast<uint64>(t);
+            x *= 1099511628211ULL;
+        }
+        uint64 change_bits;
+        std::memcpy(&change_bits, &change, sizeof(double));
+        for (const uint64& y : {static_cast<uint64>(max_triggered), change_bits}) {
+            x ^= y;
+            x *= 1099511628211ULL;
+        }
+        return x;
+    }
+
+private:
+
+    inline void add_window__(const uint32& t, const uint32& window) {
+        for (uint32 i = t; i < t + window && i <= max_t; i++) fixed[i] = true;
+        return;
+    }
+
+};
+
+
+
+#endif
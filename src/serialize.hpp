@@ -0,0 +1,319 @@
+# ifndef __CLONEWARS_SERIALIZE_H
+# define __CLONEWARS_SERIALIZE_H
+
+
+#include "rcpp_compat.hpp"      // arma namespace
+#include <vector>               // vector class
+#include <deque>                // deque
+#include <string>               // string class
+#include <sstream>              // string streams
+#include <fstream>              // file streams
+#include <cstdio>               // rename, remove
+#include <cstring>              // memcpy
+#include <type_traits>          // is_arithmetic
+#include "clonewars_types.hpp"  // integer types
+
+
+
+/*
+ Writing and reading simulation state to and from a binary buffer.
+
+ Numbers are stored in native byte order (these are only meant to be read back
+ on the same kind of machine that wrote them).
+ Random number generators and `<random>` distributions are stored using their
+ stream operators, because that's the only portable way to get their internal state
+ (e.g., the second normal deviate that `std::normal_distribution` saves for later).
+
+ Classes that have state that changes through time have `save_state` and
+ `load_state` methods that use these.
+ They only store things that change during a rep; everything else
+ comes from the arguments used to construct them.
+ */
+
+
+class StateWriter {
+
+    std::string buf;
+
+public:
+
+    StateWriter() : buf() {};
+
+    template <typename T>
+    void write(const T& x) {
+        static_assert(std::is_arithmetic<T>::value,
+                      "StateWriter::write only works directly on numbers");
+        buf.append(reinterpret_cast<const char*>(&x), sizeof(T));
+        return;
+    }
+    void write(const bool& x) {
+        char c = x ? 1 : 0;
+        buf.push_back(c);
+        return;
+    }
+    void write(const std::string& x) {
+        write(static_cast<uint64>(x.size()));
+        buf.append(x);
+        return;
+    }
+    void write(const arma::vec& x) {
+        write(static_cast<uint64>(x.n_elem));
+        write_doubles__(x.memptr(), x.n_elem);
+        return;
+    }
+    void write(const arma::mat& x) {
+        write(static_cast<uint64>(x.n_rows));
+        write(static_cast<uint64>(x.n_cols));
+        write_doubles__(x.memptr(), x.n_elem);
+        return;
+    }
+    void write(const arma::cube& x) {
+        write(static_cast<uint64>(x.n_rows));
+        write(static_cast<uint64>(x.n_cols));
+        write(static_cast<uint64>(x.n_slices));
+        write_doubles__(x.memptr(), x.n_elem);
+        return;
+    }
+    template <typename T, class A>
+    void write(const std::vector<T, A>& x) {
+        write(static_cast<uint64>(x.size()));
+        for (const T& y : x) write(y);
+        return;
+    }
+    template <class A>
+    void write(const std::vector<bool, A>& x) {
+        write(static_cast<uint64>(x.size()));
+        for (bool y : x) write(y);
+        return;
+    }
+    template <typename T, class A>
+    void write(const std::deque<T, A>& x) {
+        write(static_cast<uint64>(x.size()));
+        for (const T& y : x) write(y);
+        return;
+    }
+
+    // For RNGs and distributions:
+    template <typename T>
+    void write_stream(const T& x) {
+        std::ostringstream ss;
+        ss << x;
+        write(ss.str());
+        return;
+    }
+
+    inline const std::string& str() const noexcept {
+        return buf;
+    }
+
+    /*
+     Write to file `fn`.
+     It first writes to a temporary file, then renames it, so a crash while
+     writing doesn't destroy the previous version of the file.
+     Returns false if anything didn't work.
+     */
+    bool to_file(const std::string& fn) const {
+        std::string tmp_fn = fn + ".tmp";
+        std::ofstream out(tmp_fn, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return false;
+        out.write(buf.data(), buf.size());
+        out.close();
+        if (out.fail()) return false;
+        if (std::rename(tmp_fn.c_str(), fn.c_str()) != 0) {
+            std::remove(tmp_fn.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+
+    inline void write_doubles__(const double* x, const uint64& n) {
+        buf.append(reinterpret_cast<const char*>(x), n * sizeof(double));
+        return;
+    }
+
+};
+
+
+
+
+/*
+ Reading doesn't throw errors (it's done inside parallel regions).
+ Instead, if the buffer is too short or something doesn't match what's expected,
+ `failed()` returns true and everything read from then on is zero or empty.
+ */
+class StateReader {
+
+    std::string buf;
+    uint64 pos;
+    bool failed_;
+
+public:
+
+    StateReader() : buf(), pos(0), failed_(false) {};
+    StateReader(const std::string& buf_) : buf(buf_), pos(0), failed_(false) {};
+    StateReader(const char* data, const uint64& n)
+        : buf(data, n), pos(0), failed_(false) {};
+
+    template <typename T>
+    void read(T& x) {
+        static_assert(std::is_arithmetic<T>::value,
+                      "StateReader::read only works directly on numbers");
+        if (!has__(sizeof(T))) {
+            x = 0;
+            return;
+        }
+        std::memcpy(&x, buf.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return;
+    }
+    void read(bool& x) {
+        char c = 0;
+        read(c);
+        x = c != 0;
+        return;
+    }
+    void read(std::string& x) {
+        uint64 n;
+        read(n);
+        if (!has__(n)) {
+            x.clear();
+            return;
+        }
+        x.assign(buf.data() + pos, n);
+        pos += n;
+        return;
+    }
+    // These check that dimensions match what's already in `x`, since objects
+    // are constructed from arguments before their state is read.
+    void read(arma::vec& x) {
+        uint64 n;
+        read(n);
+        if (n != x.n_elem) failed_ = true;
+        read_doubles__(x.memptr(), x.n_elem);
+        return;
+    }
+    void read(arma::mat& x) {
+        uint64 nr, nc;
+        read(nr);
+        read(nc);
+        if (nr != x.n_rows || nc != x.n_cols) failed_ = true;
+        read_doubles__(x.memptr(), x.n_elem);
+        return;
+    }
+    void read(arma::cube& x) {
+        uint64 nr, nc, ns;
+        read(nr);
+        read(nc);
+        read(ns);
+        if (nr != x.n_rows || nc != x.n_cols || ns != x.n_slices) failed_ = true;
+        read_doubles__(x.memptr(), x.n_elem);
+        return;
+    }
+    template <typename T, class A>
+    void read(std::vector<T, A>& x) {
+        uint64 n;
+        read(n);
+        // (each item takes at least one byte)
+        if (failed_ || n > (buf.size() - pos)) {
+            failed_ = true;
+            n = 0;
+        }
+        x.resize(n);
+        for (T& y : x) read(y);
+        return;
+    }
+    template <class A>
+    void read(std::vector<bool, A>& x) {
+        uint64 n;
+        read(n);
+        // (each item takes at least one byte)
+        if (failed_ || n > (buf.size() - pos)) {
+            failed_ = true;
+            n = 0;
+        }
+        x.resize(n);
+        for (uint64 i = 0; i < n; i++) {
+            bool y;
+            read(y);
+            x[i] = y;
+        }
+        return;
+    }
+    template <typename T, class A>
+    void read(std::deque<T, A>& x) {
+        uint64 n;
+        read(n);
+        // (each item takes at least one byte)
+        if (failed_ || n > (buf.size() - pos)) {
+            failed_ = true;
+            n = 0;
+        }
+        x.resize(n);
+        for (T& y : x) read(y);
+        return;
+    }
+
+    template <typename T>
+    void read_stream(T& x) {
+        std::string s;
+        read(s);
+        if (failed_) return;
+        std::istringstream ss(s);
+        ss >> x;
+        if (ss.fail()) failed_ = true;
+        return;
+    }
+
+    // Read all of file `fn`. Returns false if it can't be opened.
+    bool from_file(const std::string& fn) {
+        std::ifstream in(fn, std::ios::in | std::ios::binary);
+        if (!in.is_open()) return false;
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        buf = ss.str();
+        pos = 0;
+        failed_ = false;
+        return true;
+    }
+
+    // Call this when something read doesn't make sense:
+    inline void fail() noexcept {
+        failed_ = true;
+        return;
+    }
+    inline bool failed() const noexcept {
+        return failed_;
+    }
+    // Whether everything has been read
+    inline bool finished() const noexcept {
+        return pos == buf.size();
+    }
+
+private:
+
+    inline bool has__(const uint64& n) {
+        if (failed_ || (pos + n) > buf.size()) {
+            failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    inline void read_doubles__(double* x, const uint64& n) {
+        if (!has__(n * sizeof(double))) {
+            for (uint64 i = 0; i < n; i++) x[i] = 0;
+            return;
+        }
+        std::memcpy(x, buf.data() + pos, n * sizeof(double));
+        pos += n * sizeof(double);
+        return;
+    }
+
+};
+
+
+
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ This file converts between R objects and the simulations in `simulations.cpp`.
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include <RcppArmadillo.h>      // arma namespace
+#include <vector>               // vector class
+#include <deque>                // deque
+#include <string>               // string class
+#include "clonewars_types.hpp"  // integer types
+#include "simulations.hpp"      // SimOutput, sim_clonewars__
+#include "phase_timer.hpp"      // phase::names
+#include "result_store.hpp"     // StoreReader
+#include "altrep_output.hpp"    // output_list__
+
+
+using namespace Rcpp;
+
+
+
+
+
+
+
+//[[Rcpp::export]]
+List sim_clonewars_cpp(const uint32& n_reps,
+                       const uint32& n_cages,
+                       const uint32& max_plant_age,
+                       const double& max_N,
+                       const std::deque<uint32>& check_for_clear,
+                       const double& clear_surv,
+                       const uint32& max_t,
+                       const uint32& save_every,
+                       const double& mean_K,
+                       const double& sd_K,
+                       const double& K_y_mult,
+                       const double& death_prop,
+                       const double& shape1_death_mort,
+                       const double& shape2_death_mort,
+                       const arma::mat& attack_surv,
+                       const bool& disp_error,
+                       const bool& demog_error,
+                       const double& sigma_x,
+                       const double& sigma_y,
+                       const double& rho,
+                       const double& extinct_N,
+                       const std::vector<std::string>& aphid_name,
+                       const std::vector<arma::cube>& leslie_mat,
+                       const std::vector<arma::cube>& aphid_density_0,
+                       const std::vector<double>& alate_b0,
+                       const std::vector<double>& alate_b1,
+                       const double& alate_disp_prop,
+                       const std::vector<double>& disp_rate,
+                       const std::vector<double>& disp_mort,
+                       const std::vector<uint32>& disp_start,
+                       const std::vector<uint32>& living_days,
+                       const std::vector<double>& pred_rate,
+                       const arma::mat& mum_density_0,
+                       const double& max_mum_density,
+                       const arma::vec& rel_attack,
+                       const double& a,
+                       const double& k,
+                       const double& h,
+                       const std::vector<double>& wasp_density_0,
+                       const uint32& wasp_delay,
+                       const double& sex_ratio,
+                       const double& s_y,
+                       const std::vector<uint32>& perturb_when,
+                       const std::vector<uint32>& perturb_who,
+                       const std::vector<double>& perturb_how,
+                       const std::string& checkpoint_dir,
+                       const uint32& checkpoint_every,
+                       const bool& save_snapshot,
+                       const RawVector& from_snapshot,
+                       const double& cycle_tol,
+                       const bool& profile,
+                       const std::string& trace_file,
+                       const std::string& store_file,
+                       const bool& store_compress,
+                       const bool& sparse_output,
+                       const std::vector<uint32>& save_days,
+                       const uint32& event_window,
+                       const double& save_change,
+                       const uint32& max_change_saves,
+                       const std::vector<double>& summary_probs,
+                       uint32 n_threads,
+                       const bool& show_progress) {
+
+    SimOutput output;
+
+    sim_clonewars__(n_reps, n_cages, max_plant_age, max_N, check_for_clear, clear_surv,
+                    max_t, save_every, mean_K, sd_K, K_y_mult, death_prop,
+                    shape1_death_mort, shape2_death_mort, attack_surv, disp_error,
+                    demog_error, sigma_x, sigma_y, rho, extinct_N, aphid_name,
+                    leslie_mat, aphid_density_0, alate_b0, alate_b1, alate_disp_prop,
+                    disp_rate, disp_mort, disp_start, living_days, pred_rate,
+                    mum_density_0, max_mum_density, rel_attack, a, k, h, wasp_density_0,
+                    wasp_delay, sex_ratio, s_y, perturb_when, perturb_who, perturb_how,
+                    checkpoint_dir, checkpoint_every, save_snapshot,
+                    std::string(from_snapshot.begin(), from_snapshot.end()), cycle_tol,
+                    profile, trace_file, store_file, store_compress, sparse_output, save_days,
+                    event_window, save_change, max_change_saves, summary_probs, n_threads,
+                    show_progress, output);
+
+    List out = output_list__(output);
+
+    if (save_snapshot) {
+        List snapshots_out(output.snapshots.size());
+        for (uint32 i = 0; i < output.snapshots.size(); i++) {
+            std::string& snap(output.snapshots[i]);
+            snapshots_out[i] = RawVector(snap.begin(), snap.end());
+            snap.clear();
+        }
+        out.push_back(snapshots_out, "snapshots");
+    }
+
+    if (profile) {
+        NumericVector phase_totals(phase::count);
+        CharacterVector phase_names(phase::count);
+        for (uint32 p = 0; p < phase::count; p++) {
+            phase_totals[p] = output.phase_times[p];
+            phase_names[p] = phase::names[p];
+        }
+        phase_totals.names() = phase_names;
+        out.attr("phase_times") = phase_totals;
+    }
+
+    return out;
+}
+
+
+
+
+//[[Rcpp::export]]
+List read_store_cpp(const std::string& file,
+                    std::vector<uint32> reps,
+                    const uint32& t_min,
+                    const uint32& t_max) {
+
+    const StoreReader store(file);
+
+    if (reps.empty()) {
+        reps.reserve(store.n_reps());
+        for (uint32 i = 0; i < store.n_reps(); i++) reps.push_back(i);
+    }
+
+    SimOutput output;
+    for (const uint32& rep : reps) store.read(rep, t_min, t_max, output);
+
+    return output_list__(output);
+}
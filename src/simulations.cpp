@@ -3,27 +3,44 @@
  *****************************************************************************
  *****************************************************************************
 
- This file is for simulation functions that will be available from R.
+ This file is for the simulations themselves.
+ They're made available to R in `sim_clonewars.cpp`.
 
  *****************************************************************************
  *****************************************************************************
  */
 
-#include <RcppArmadillo.h>      // arma namespace
+#include "rcpp_compat.hpp"      // arma namespace
 #include <vector>               // vector class
 #include <random>               // normal distribution
 #include <deque>                // deque
+#include <algorithm>            // binary_search
+#include <cmath>                // abs
 #include <pcg/pcg_random.hpp>   // pcg prng
-#include <progress.hpp>         // for the progress bar
 #ifdef _OPENMP
 #include <omp.h>                // OpenMP
 #endif
 
 
 #include "clonewars_types.hpp"  // integer types
+#include "simulations.hpp"      // SimOutput, sim_clonewars__
+#include "rep_summary.hpp"      // RepSummary
 #include "aphids.hpp"           // aphid classes
 #include "patches.hpp"          // patch classes
 #include "pcg.hpp"              // runif_ fxns
+#include "arena.hpp"            // arena_vector, arena_deque, RepArena
+#include "stages.hpp"           // stage_limits, stage_limit
+#include "serialize.hpp"        // StateWriter, StateReader
+#include "progress_counter.hpp" // ProgressCounter, interrupt_check
+#include "phase_timer.hpp"      // PhaseTimers, PhaseScope
+#include "trace.hpp"            // TraceBuffer, write_trace__
+#include "result_store.hpp"     // StoreWriter, StoreWriteQueue
+#include "save_schedule.hpp"    // SaveSchedule
+#include "ensemble_summary.hpp" // EnsembleSummary
+
+
+// (Needs a definition before C++17 because `TraceBuffer::begin` takes it by reference.)
+constexpr uint32 TraceBuffer::rep_event;
 
 
 //' Check that the number of threads doesn't exceed the number available, and change
@@ -49,310 +66,813 @@ inline void thread_check(uint32& n_threads) {
     return;
 }
 
-// For checking for user interrupts every N iterations:
-inline bool interrupt_check(uint32& iters,
-                            Progress& prog_bar,
-                            const uint32& N = 100) {
-    ++iters;
-    if (iters > N) {
-        if (prog_bar.is_aborted() || prog_bar.check_abort()) return true;
-        prog_bar.increment(iters);
-        iters = 0;
-    }
-    return false;
-}
 
 
 
 
 
-// Calculate the number of rows per rep.
-void calc_rep_rows(uint32& n_rows,
-                   uint32& n_rows_wasps,
-                   const uint32& max_t,
-                   const uint32& save_every,
-                   const uint32& n_lines,
-                   const uint32& n_cages,
-                   const uint32& n_patches) {
+inline void do_perturb(arena_deque<PerturbInfo>& perturbs,
+                       arena_vector<OneCage>& cages,
+                       const uint32& t,
+                       const uint32& n_lines,
+                       const double& extinct_N,
+                       const bool& do_pop) {
 
-    // # time points you'll save:
-    n_rows_wasps = (max_t / save_every) + 1;
-    if (max_t % save_every > 0) n_rows_wasps++;
+    if (perturbs.empty()) return;
+
+    uint32 i = 0;
+    while (i < perturbs.size()) {
+        const PerturbInfo& pert(perturbs[i]);
+        if (pert.time != t) break;
+        double mult = pert.multiplier;
+        if (pert.index < n_lines) { // aphids
+            for (OneCage& cage : cages) {
+                for (OnePatch& p : cage.patches) {
+                    AphidPop& aphids(p.aphids[pert.index]);
+                    aphids.clear(mult);
+                    if (aphids.total_aphids() < extinct_N) aphids.clear();
+                    p.refresh();
+                    if ((p.total_aphids() + p.total_mummies()) == 0) {
+                        p.empty = true;
+                    }
+                }
+                cage.refresh();
+            }
+        } else if (pert.index == n_lines) { // mummies
+            for (OneCage& cage : cages) {
+                for (OnePatch& p : cage.patches) {
+                    p.mummies.clear(mult);
+                    if (p.total_mummies() < extinct_N) p.mummies.clear();
+                }
+            }
+        } else { // adult wasps
+            for (OneCage& cage : cages) {
+                cage.wasps.Y *= mult;
+                if (cage.wasps.Y < extinct_N) cage.wasps.Y = 0;
+            }
+        }
+        i++;
+    }
 
-    n_rows = n_cages * n_patches * n_lines * n_rows_wasps;
-    n_rows *= 2;  // `*2` for separate alate vs apterous
-    n_rows += n_patches * n_rows_wasps;  // for mummies
+    if (do_pop && i > 0) {
+        perturbs.erase(perturbs.begin(), perturbs.begin() + i);
+    }
 
     return;
 }
 
 
-/*
 
 
- leslie_matrix__(instar_days, surv_juv, surv_adult, repro, leslie_);
- leslie_sad__(leslie_, X_0_);
- X_0_ *= aphid_density_0;
 
- OR
+/*
+ =====================================================================================
+ =====================================================================================
+ Saving output
+ =====================================================================================
+ =====================================================================================
+ */
 
- leslie_matrix__(instar_days, surv_juv, surv_adult, repro, leslie_);
- X_0_ = aphid_density_0;
+/*
+ Values that are saved in output for one day, in the same order as in
+ `RepSummary::push_back`.
  */
+inline void output_values__(const arena_vector<OneCage>& cages,
+                            arena_vector<double>& out) {
+    out.clear();
+    for (const OneCage& cage : cages) {
+        for (const OnePatch& patch : cage.patches) {
+            for (const AphidPop& aphid : patch.aphids) {
+                out.push_back(aphid.alates.total_aphids());
+                out.push_back(aphid.apterous.total_aphids());
+            }
+            out.push_back(patch.total_mummies());
+        }
+        out.push_back(cage.wasps.Y);
+    }
+    return;
+}
+
 
 /*
- To calculate dispersal start date
- arma::accu(instar_days.head(instar_days.n_elem - 1)) - 1
+ Decides whether a day that isn't on the save schedule gets saved because
+ abundances changed too much since the last saved day (see `SaveSchedule`).
+ `saved` should be called every time output is saved for a day on the schedule.
  */
+class ChangeTrigger {
 
+    arena_vector<double> last;  // output on last saved day
+    arena_vector<double> now;
+    uint32 n_triggered;
 
-struct RepSummary {
-
-    std::vector<uint32> rep;
-    std::vector<uint32> time;
-    std::vector<uint32> cage;
-    std::vector<uint32> patch;
-    std::vector<std::string> line;
-    std::vector<std::string> type;
-    std::vector<double> N;
-    std::vector<uint32> wasp_rep;
-    std::vector<uint32> wasp_time;
-    std::vector<uint32> wasp_cage;
-    std::vector<double> wasp_N;
-
-    RepSummary()
-        : rep(), time(), cage(), patch(), line(), type(), N(),
-          wasp_rep(), wasp_time(), wasp_cage(), wasp_N(), r() {};
-
-    void reserve(const uint32& rep_,
-                 const uint32& max_t,
-                 const uint32& save_every,
-                 const uint32& n_lines,
-                 const uint32& n_cages,
-                 const uint32& n_patches) {
-        uint32 n_rows, n_rows_wasps;
-        calc_rep_rows(n_rows, n_rows_wasps, max_t, save_every,
-                      n_lines, n_cages, n_patches);
-        rep.reserve(n_rows);
-        time.reserve(n_rows);
-        cage.reserve(n_rows);
-        patch.reserve(n_rows);
-        line.reserve(n_rows);
-        type.reserve(n_rows);
-        N.reserve(n_rows);
-        wasp_rep.reserve(n_rows_wasps);
-        wasp_time.reserve(n_rows_wasps);
-        wasp_cage.reserve(n_rows_wasps);
-        wasp_N.reserve(n_rows_wasps);
-        r = rep_;
-    }
-
-    // This version used when assimilating all reps into the first one
-    void reserve(const uint32& n, const uint32& nw) {
-        rep.reserve(n);
-        time.reserve(n);
-        cage.reserve(n);
-        patch.reserve(n);
-        line.reserve(n);
-        type.reserve(n);
-        N.reserve(n);
-        wasp_rep.reserve(nw);
-        wasp_time.reserve(nw);
-        wasp_cage.reserve(nw);
-        wasp_N.reserve(nw); // `nw` is for the wasp vectors
-        return;
-    }
+public:
 
+    const SaveSchedule& schedule;
 
-    void push_back(const uint32& t,
-                   const std::vector<OneCage>& cages) {
+    ChangeTrigger(const SaveSchedule& schedule_)
+        : last(), now(), n_triggered(0), schedule(schedule_) {};
 
-        for (uint32 k = 0; k < cages.size(); k++) {
+    inline bool active() const noexcept {
+        return schedule.triggers();
+    }
 
-            const OneCage& cage(cages[k]);
+    void saved(const arena_vector<OneCage>& cages) {
+        if (active()) output_values__(cages, last);
+        return;
+    }
 
-            // Everything but wasps:
-            for (uint32 j = 0; j < cage.size(); j++) {
-                const OnePatch& patch(cage[j]);
-                for (uint32 i = 0; i < patch.size(); i++) {
-                    const AphidPop& aphid(patch[i]);
-                    append_living_aphids__(t, k, j, aphid.aphid_name,
-                                           aphid.alates.total_aphids(),
-                                           aphid.apterous.total_aphids());
-                }
-                append_mummies__(t, k, j, patch.total_mummies());
+    // Whether output for the current day should be saved
+    bool fires(const arena_vector<OneCage>& cages) {
+        if (!active() || n_triggered >= schedule.max_triggered) return false;
+        output_values__(cages, now);
+        if (now.size() != last.size()) return false;
+        for (uint32 i = 0; i < now.size(); i++) {
+            const double& x(now[i]);
+            const double& y(last[i]);
+            if ((x > 0) != (y > 0) || std::abs(x - y) > schedule.change * y) {
+                n_triggered++;
+                last.swap(now);
+                return true;
             }
-
-            wasp_rep.push_back(r);
-            wasp_time.push_back(t);
-            wasp_cage.push_back(k);
-            wasp_N.push_back(cage.wasps.Y);
         }
+        return false;
+    }
 
+    void save_state(StateWriter& out) const {
+        out.write(last);
+        out.write(n_triggered);
+        return;
+    }
+    void load_state(StateReader& in) {
+        in.read(last);
+        in.read(n_triggered);
         return;
     }
 
+};
 
-    void clear() {
 
-        time.clear();
-        cage.clear();
-        patch.clear();
-        line.clear();
-        type.clear();
-        N.clear();
-        wasp_rep.clear();
-        wasp_time.clear();
-        wasp_cage.clear();
-        wasp_N.clear();
 
-        // to clear memory:
-        time.shrink_to_fit();
-        cage.shrink_to_fit();
-        patch.shrink_to_fit();
-        line.shrink_to_fit();
-        type.shrink_to_fit();
-        N.shrink_to_fit();
-        wasp_rep.shrink_to_fit();
-        wasp_time.shrink_to_fit();
-        wasp_cage.shrink_to_fit();
-        wasp_N.shrink_to_fit();
+/*
+ =====================================================================================
+ =====================================================================================
+ Checkpoints
+ =====================================================================================
+ =====================================================================================
+ */
+
+/*
+ Everything that changes during a rep, after day `t` is finished.
+ Objects must already be constructed from the same arguments before reading.
+ */
+inline void write_rep_state__(StateWriter& out,
+                              const uint32& t,
+                              const arena_vector<OneCage>& cages,
+                              const arena_deque<PerturbInfo>& perturbs,
+                              const arena_deque<uint32>& check_for_clear,
+                              const pcg32& eng) {
+    out.write(t);
+    out.write_stream(eng);
+    out.write(check_for_clear);
+    out.write(static_cast<uint64>(perturbs.size()));
+    for (const PerturbInfo& pert : perturbs) {
+        out.write(pert.time);
+        out.write(pert.multiplier);
+        out.write(pert.index);
+    }
+    out.write(static_cast<uint64>(cages.size()));
+    for (const OneCage& cage : cages) cage.save_state(out);
+    return;
+}
+inline void read_rep_state__(StateReader& in,
+                             uint32& t,
+                             arena_vector<OneCage>& cages,
+                             arena_deque<PerturbInfo>& perturbs,
+                             arena_deque<uint32>& check_for_clear,
+                             pcg32& eng) {
+    in.read(t);
+    in.read_stream(eng);
+    in.read(check_for_clear);
+    uint64 n_perturbs;
+    in.read(n_perturbs);
+    if (in.failed()) n_perturbs = 0;
+    perturbs.resize(n_perturbs);
+    for (PerturbInfo& pert : perturbs) {
+        in.read(pert.time);
+        in.read(pert.multiplier);
+        in.read(pert.index);
     }
+    uint64 n_cages;
+    in.read(n_cages);
+    if (n_cages != cages.size()) in.fail();
+    for (OneCage& cage : cages) cage.load_state(in);
+    return;
+}
+
+
 
+/*
+ Checkpoint files (one per rep) inside folder `dir`.
+ No checkpoints are made if `dir` is empty.
+ If `every > 0`, a checkpoint is written every `every` days.
+ One is also written when a rep is interrupted and when it's done, so that
+ reps that are done aren't re-run when resuming.
+ */
+struct CheckpointInfo {
 
-    void assimilate(RepSummary& other) {
+    std::string dir;
+    uint32 every;
 
-        for (uint32 i = 0; i < other.time.size(); i++) {
+    CheckpointInfo(const std::string& dir_, const uint32& every_)
+        : dir(dir_), every(every_) {};
 
-            rep.push_back(other.rep[i]);
-            time.push_back(other.time[i]);
-            cage.push_back(other.cage[i]);
-            patch.push_back(other.patch[i]);
-            line.push_back(other.line[i]);
-            type.push_back(other.type[i]);
-            N.push_back(other.N[i]);
+    inline bool active() const noexcept {
+        return !dir.empty();
+    }
+    inline std::string file(const uint32& rep) const {
+        return dir + "/rep_" + std::to_string(rep) + ".ckpt";
+    }
 
-        }
+};
 
-        for (uint32 i = 0; i < other.wasp_time.size(); i++) {
+// Identifies checkpoint files and the version of their format:
+const std::string checkpoint_magic = "clonewars checkpoint";
+const uint32 checkpoint_version = 4;
 
-            wasp_rep.push_back(other.wasp_rep[i]);
-            wasp_time.push_back(other.wasp_time[i]);
-            wasp_cage.push_back(other.wasp_cage[i]);
-            wasp_N.push_back(other.wasp_N[i]);
+/*
+ Write checkpoint for a rep.
+ Dimensions are stored to check that a checkpoint matches the arguments
+ used when resuming.
+ Returns false if the file couldn't be written.
+ */
+inline bool save_checkpoint__(const CheckpointInfo& ckpt,
+                              const uint32& rep,
+                              const bool& done,
+                              const uint32& t,
+                              const RepSummary& summary,
+                              const arena_vector<OneCage>& cages,
+                              const arena_deque<PerturbInfo>& perturbs,
+                              const arena_deque<uint32>& check_for_clear,
+                              const pcg32& eng,
+                              const ChangeTrigger& trigger,
+                              const uint32& n_stages,
+                              const uint32& max_t) {
+
+    StateWriter out;
+
+    out.write(checkpoint_magic);
+    out.write(checkpoint_version);
+    out.write(rep);
+    out.write(static_cast<uint64>(cages.size()));
+    out.write(static_cast<uint64>(cages.front().size()));
+    out.write(static_cast<uint64>(cages.front()[0].size()));
+    out.write(n_stages);
+    out.write(max_t);
+    out.write(trigger.schedule.checksum());
+    // Output is stored differently with `CLONEWARS_FLOAT_OUTPUT`:
+    out.write(static_cast<uint32>(sizeof(output_t)));
+    out.write(done);
+
+    summary.save_state(out);
+    // Reps that are done only need output:
+    if (!done) {
+        write_rep_state__(out, t, cages, perturbs, check_for_clear, eng);
+        trigger.save_state(out);
+    }
 
-        }
+    return out.to_file(ckpt.file(rep));
 
-        other.clear();
+}
 
-        return;
+/*
+ Read checkpoint for a rep if one exists.
+ Returns 0 if there's no checkpoint file, 1 if it was read, and -1 if it was
+ corrupted or doesn't match the arguments.
+ */
+inline int load_checkpoint__(const CheckpointInfo& ckpt,
+                             const uint32& rep,
+                             bool& done,
+                             uint32& t,
+                             RepSummary& summary,
+                             arena_vector<OneCage>& cages,
+                             arena_deque<PerturbInfo>& perturbs,
+                             arena_deque<uint32>& check_for_clear,
+                             pcg32& eng,
+                             ChangeTrigger& trigger,
+                             const uint32& n_stages,
+                             const uint32& max_t) {
+
+    StateReader in;
+    if (!in.from_file(ckpt.file(rep))) return 0;
+
+    std::string magic;
+    uint32 version, rep_, n_stages_, max_t_, output_size;
+    uint64 n_cages, n_patches, n_lines, schedule;
+
+    in.read(magic);
+    in.read(version);
+    in.read(rep_);
+    in.read(n_cages);
+    in.read(n_patches);
+    in.read(n_lines);
+    in.read(n_stages_);
+    in.read(max_t_);
+    in.read(schedule);
+    in.read(output_size);
+    in.read(done);
+
+    if (in.failed() || magic != checkpoint_magic || version != checkpoint_version ||
+        rep_ != rep || n_cages != cages.size() ||
+        n_patches != cages.front().size() || n_lines != cages.front()[0].size() ||
+        n_stages_ != n_stages || max_t_ != max_t || schedule != trigger.schedule.checksum() ||
+        output_size != sizeof(output_t)) {
+        return -1;
+    }
 
+    summary.load_state(in);
+    if (!done) {
+        read_rep_state__(in, t, cages, perturbs, check_for_clear, eng);
+        trigger.load_state(in);
     }
 
+    if (in.failed() || !in.finished() || t > max_t) return -1;
+
+    return 1;
+
+}
+
 
-private:
 
-    uint32 r;
 
-    inline void append_living_aphids__(const uint32& t,
-                                       const uint32& c,
-                                       const uint32& p,
-                                       const std::string& l,
-                                       const double& N_ala,
-                                       const double& N_apt) {
+/*
+ =====================================================================================
+ =====================================================================================
+ Snapshots
+ =====================================================================================
+ =====================================================================================
+ */
 
-        rep.push_back(r);
-        rep.push_back(r);
+/*
+ A snapshot is the state of a rep at the end of its last day, so that many
+ reps ("branches") can start from it instead of each re-simulating the same
+ days from the start.
+ Branches use their own random number seeds, and their own perturbations and
+ plant-clearing days (only the ones after the snapshot's day are used).
+ Everything else that changes during a rep comes from the snapshot.
+
+ `from` is the snapshot to start from (no snapshot if empty).
+ If `save` is true, each rep stores a snapshot of its final state.
+ */
+struct SnapshotInfo {
 
-        time.push_back(t);
-        time.push_back(t);
+    std::string from;
+    bool save;
 
-        cage.push_back(c);
-        cage.push_back(c);
+    SnapshotInfo(const std::string& from_, const bool& save_)
+        : from(from_), save(save_) {};
 
-        patch.push_back(p);
-        patch.push_back(p);
+    inline bool branching() const noexcept {
+        return !from.empty();
+    }
 
-        line.push_back(l);
-        line.push_back(l);
+};
 
-        type.push_back("alate");
-        type.push_back("apterous");
+const std::string snapshot_magic = "clonewars snapshot";
+const uint32 snapshot_version = 1;
 
-        N.push_back(N_ala);
-        N.push_back(N_apt);
+
+inline std::string make_snapshot__(const uint32& t,
+                                   const arena_vector<OneCage>& cages,
+                                   const arena_deque<PerturbInfo>& perturbs,
+                                   const arena_deque<uint32>& check_for_clear,
+                                   const pcg32& eng,
+                                   const uint32& n_stages) {
+
+    StateWriter out;
+
+    out.write(snapshot_magic);
+    out.write(snapshot_version);
+    out.write(static_cast<uint64>(cages.size()));
+    out.write(static_cast<uint64>(cages.front().size()));
+    out.write(static_cast<uint64>(cages.front()[0].size()));
+    out.write(n_stages);
+
+    write_rep_state__(out, t, cages, perturbs, check_for_clear, eng);
+
+    return out.str();
+}
+
+// Read the header of a snapshot, returning false if it isn't a valid one.
+inline bool snapshot_header__(StateReader& in,
+                              uint64& n_cages,
+                              uint64& n_patches,
+                              uint64& n_lines,
+                              uint32& n_stages) {
+    std::string magic;
+    uint32 version;
+    in.read(magic);
+    in.read(version);
+    in.read(n_cages);
+    in.read(n_patches);
+    in.read(n_lines);
+    in.read(n_stages);
+    return !in.failed() && magic == snapshot_magic && version == snapshot_version;
+}
+
+/*
+ Day a snapshot was taken on. Also checks that its header matches the arguments.
+ This is run before simulations so that problems can be reported with `stop`.
+ */
+inline uint32 snapshot_day(const std::string& snapshot,
+                           const uint32& n_cages,
+                           const uint32& n_patches,
+                           const uint32& n_lines,
+                           const uint32& n_stages) {
+    StateReader in(snapshot);
+    uint64 n_cages_, n_patches_, n_lines_;
+    uint32 n_stages_, t;
+    if (!snapshot_header__(in, n_cages_, n_patches_, n_lines_, n_stages_)) {
+        stop("\nERROR: `from_snapshot` isn't a valid snapshot.\n");
+    }
+    if (n_cages_ != n_cages || n_patches_ != n_patches || n_lines_ != n_lines ||
+        n_stages_ != n_stages) {
+        stop("\nERROR: `from_snapshot` was made with a different number of cages, "
+             "patches, aphid lines, or aphid stages.\n");
+    }
+    in.read(t);
+    return t;
+}
+
+/*
+ Lay the state from a snapshot over cages that were constructed from this
+ call's arguments.
+ Perturbations and plant-clearing days that are on or before the snapshot's
+ day are removed, and the snapshot's RNG state is ignored.
+ Returns false if the snapshot is corrupted.
+ */
+inline bool load_snapshot__(const std::string& snapshot,
+                            uint32& t,
+                            arena_vector<OneCage>& cages,
+                            arena_deque<PerturbInfo>& perturbs,
+                            arena_deque<uint32>& check_for_clear) {
+
+    StateReader in(snapshot);
+    uint64 n_cages, n_patches, n_lines;
+    uint32 n_stages;
+    if (!snapshot_header__(in, n_cages, n_patches, n_lines, n_stages)) return false;
+
+    arena_deque<PerturbInfo> old_perturbs;
+    arena_deque<uint32> old_check_for_clear;
+    pcg32 old_eng;
+    read_rep_state__(in, t, cages, old_perturbs, old_check_for_clear, old_eng);
+    if (in.failed() || !in.finished()) return false;
+
+    while (!perturbs.empty() && perturbs.front().time <= t) perturbs.pop_front();
+    while (!check_for_clear.empty() && check_for_clear.front() <= t) {
+        check_for_clear.pop_front();
+    }
+
+    return true;
+}
+
+
+
+
+/*
+ =====================================================================================
+ =====================================================================================
+ Cycles in deterministic simulations
+ =====================================================================================
+ =====================================================================================
+ */
+
+/*
+ Without any stochasticity, reps often settle into a fixed point or a cycle set
+ by the plant-check schedule.
+ If the state at the end of day `t` is the same (within a tolerance) as it was
+ at the end of day `t - L`, and the plant-check schedule for the remaining
+ days is the same as it was `L` days ago, then the remaining output is just
+ a repeat of the last `L` days.
+
+ States are only compared at the start of each period of the plant-check
+ schedule, so cycles are multiples of that period (up to `max_mult` periods).
+ After the last plant check, states are compared every day.
+
+ This struct has the information that's the same for all reps.
+ */
+struct CycleInfo {
+
+    static const uint32 max_mult = 8;
+
+    double tol;                 // relative tolerance for states being the same
+    bool active;
+    bool use_age;               // whether plant age is used for clearing
+    uint32 max_age;
+    uint32 max_t;
+    uint32 last_check;          // last plant-check day (0 if none)
+    uint32 period;              // # days per period of plant-check schedule
+    bool periodic_checks;       // whether cycles can be found on or before `last_check`
+    std::vector<uint32> aligned_days;  // plant checks at the start of each period
+    uint32 max_days;            // longest cycle looked for
+
+    CycleInfo(const double& tol_,
+              const bool& deterministic,
+              const std::deque<uint32>& check_for_clear,
+              const uint32& max_plant_age,
+              const uint32& max_t_)
+        : tol(tol_), active(tol_ > 0 && deterministic),
+          use_age(max_plant_age > 0), max_age(max_plant_age), max_t(max_t_),
+          last_check(0), period(1), periodic_checks(false), aligned_days(),
+          max_days(max_mult) {
+
+        if (!active || check_for_clear.empty()) return;
+
+        uint32 n = check_for_clear.size();
+        last_check = check_for_clear.back();
+        if (n < 2) return;
+
+        std::vector<uint32> gaps(n - 1);
+        for (uint32 i = 0; i < (n - 1); i++) {
+            gaps[i] = check_for_clear[i+1] - check_for_clear[i];
+        }
+        // Smallest # gaps that the schedule repeats after (it has to repeat at least once):
+        uint32 k = 0;
+        for (uint32 kk = 1; (2 * kk) <= gaps.size(); kk++) {
+            bool repeats = true;
+            for (uint32 i = 0; (i + kk) < gaps.size(); i++) {
+                if (gaps[i] != gaps[i+kk]) {
+                    repeats = false;
+                    break;
+                }
+            }
+            if (repeats) {
+                k = kk;
+                break;
+            }
+        }
+        if (k == 0) return;
+
+        period = 0;
+        for (uint32 i = 0; i < k; i++) period += gaps[i];
+        max_days = max_mult * period;
+        for (uint32 i = 0; i < n; i += k) aligned_days.push_back(check_for_clear[i]);
+        /*
+         The schedule has to continue until `max_t`, otherwise repeating the
+         last cycle would include plant checks that don't happen.
+         */
+        periodic_checks = (last_check + gaps[(n - 1) % k]) >= max_t;
 
         return;
     }
 
-    inline void append_mummies__(const uint32& t,
-                                 const uint32& c,
-                                 const uint32& p,
-                                 const double& N_mum) {
-        rep.push_back(r);
-        time.push_back(t);
-        cage.push_back(c);
-        patch.push_back(p);
-        line.push_back("");
-        type.push_back("mummy");
-        N.push_back(N_mum);
+};
+
+
+/*
+ Everything about the state at the end of day `t` that can affect later days
+ when there's no stochasticity.
+ Plant age only matters when it's used for clearing, and then only if it could
+ pass the maximum age before `max_t` (or the plant is wilted, since then it's
+ sorted by age when avoiding extinction).
+ */
+inline void state_fingerprint__(const arena_vector<OneCage>& cages,
+                                const CycleInfo& info,
+                                const uint32& t,
+                                arena_vector<double>& out) {
+    out.clear();
+    for (const OneCage& cage : cages) {
+        for (const OnePatch& patch : cage.patches) {
+            if (info.use_age) {
+                if (patch.wilted() || (patch.age + (info.max_t - t)) > info.max_age) {
+                    out.push_back(patch.age);
+                } else out.push_back(-1);
+            }
+            out.push_back(patch.wilted() ? 1 : 0);
+            out.push_back(patch.empty ? 1 : 0);
+            out.push_back(patch.K);
+            out.push_back(patch.K_y);
+            out.push_back(patch.death_mort);
+            for (const AphidPop& aphid : patch.aphids) {
+                out.push_back(aphid.extinct ? 1 : 0);
+                out.insert(out.end(), aphid.apterous.X.begin(), aphid.apterous.X.end());
+                out.insert(out.end(), aphid.alates.X.begin(), aphid.alates.X.end());
+                out.insert(out.end(), aphid.paras.X.begin(), aphid.paras.X.end());
+            }
+            out.insert(out.end(), patch.mummies.Y.begin(), patch.mummies.Y.end());
+        }
+        out.push_back(cage.wasps.Y);
+    }
+    return;
+}
+
+
+
+/*
+ Fixed number of objects used as a first-in, first-out queue.
+ `push_back` returns the object to overwrite (the oldest one when it's full)
+ instead of constructing a new one, so for vectors, once every slot has been
+ used, adding more doesn't allocate anything.
+ */
+template <typename T>
+class FixedRing {
+
+    arena_vector<T> slots;
+    uint32 first;
+    uint32 n;
+
+public:
+
+    FixedRing(const uint32& capacity) : slots(capacity), first(0), n(0) {};
+
+    // Reserve space in every slot (only for vectors)
+    void reserve(const uint32& n_values) {
+        for (T& x : slots) x.reserve(n_values);
         return;
     }
+
+    inline uint32 size() const noexcept { return n; }
+    inline bool empty() const noexcept { return n == 0; }
+    inline void clear() noexcept {
+        first = 0;
+        n = 0;
+        return;
+    }
+
+    inline const T& operator[](const uint32& i) const {
+        return slots[(first + i) % slots.size()];
+    }
+    inline const T& front() const { return (*this)[0]; }
+    inline const T& back() const { return (*this)[n - 1]; }
+
+    T& push_back() {
+        if (n == slots.size()) pop_front();
+        T& x(slots[(first + n) % slots.size()]);
+        n++;
+        return x;
+    }
+    inline void pop_front() noexcept {
+        first = (first + 1) % slots.size();
+        n--;
+        return;
+    }
+
 };
 
 
+/*
+ Looks for cycles in one rep.
+ `add_output` and `found` should be called at the end of every day once
+ nothing but the state and plant-check schedule can affect later days
+ (i.e., after the last perturbation and after wasps are added).
+ Outputs and states are kept in `FixedRing`s that are allocated once
+ (only if `info.active`), so memory doesn't grow with `max_t`.
+ */
+class CycleFinder {
 
+    const CycleInfo& info;
 
-inline void do_perturb(std::deque<PerturbInfo>& perturbs,
-                       std::vector<OneCage>& cages,
-                       const uint32& t,
-                       const uint32& n_lines,
-                       const double& extinct_N,
-                       const bool& do_pop) {
+    arena_vector<double> fp;
+    FixedRing<uint32> state_days;
+    FixedRing<arena_vector<double>> states;
+    FixedRing<arena_vector<double>> outputs;  // last `info.max_days` days
 
-    if (perturbs.empty()) return;
+    uint32 end_day;     // last day simulated
+    uint32 cycle_len;   // # days in cycle
 
-    uint32 i = 0;
-    while (i < perturbs.size()) {
-        const PerturbInfo& pert(perturbs[i]);
-        if (pert.time != t) break;
-        double mult = pert.multiplier;
-        if (pert.index < n_lines) { // aphids
-            for (OneCage& cage : cages) {
-                for (OnePatch& p : cage.patches) {
-                    AphidPop& aphids(p.aphids[pert.index]);
-                    aphids.clear(mult);
-                    if (aphids.total_aphids() < extinct_N) aphids.clear();
-                    if ((p.total_aphids() + p.total_mummies()) == 0) {
-                        p.empty = true;
-                    }
-                }
-            }
-        } else if (pert.index == n_lines) { // mummies
-            for (OneCage& cage : cages) {
-                for (OnePatch& p : cage.patches) {
-                    p.mummies.clear(mult);
-                    if (arma::accu(p.mummies.Y) < extinct_N) p.mummies.Y.fill(0);
-                }
+    inline bool same__(const arena_vector<double>& x,
+                       const arena_vector<double>& y) const {
+        if (x.size() != y.size()) return false;
+        for (uint32 i = 0; i < x.size(); i++) {
+            double diff = std::abs(x[i] - y[i]);
+            double scale = std::max(1.0, std::max(std::abs(x[i]), std::abs(y[i])));
+            if (diff > info.tol * scale) return false;
+        }
+        return true;
+    }
+
+public:
+
+    /*
+     Before a plant check, states are only added at the start of each period,
+     and after the last one, states more than `max_mult` days old are dropped,
+     so there are never more than `info.max_days + 1` of them.
+     */
+    CycleFinder(const CycleInfo& info_,
+                const arena_vector<OneCage>& cages)
+        : info(info_), fp(),
+          state_days(info_.active ? (info_.max_days + 1) : 0),
+          states(info_.active ? (info_.max_days + 1) : 0),
+          outputs(info_.active ? info_.max_days : 0),
+          end_day(0), cycle_len(0) {
+        if (!info.active) return;
+        state_fingerprint__(cages, info, info.max_t, fp);
+        states.reserve(fp.size());
+        output_values__(cages, fp);
+        outputs.reserve(fp.size());
+    };
+
+    inline bool active() const noexcept {
+        return info.active;
+    }
+
+    // Store output for day `t`
+    void add_output(const arena_vector<OneCage>& cages) {
+        output_values__(cages, outputs.push_back());
+        return;
+    }
+
+    // Whether the state at the end of day `t` starts a repeat of an earlier cycle
+    bool found(const uint32& t,
+               const arena_vector<OneCage>& cages) {
+
+        const bool after_checks = t > info.last_check;
+        if (!after_checks) {
+            if (!info.periodic_checks ||
+                !std::binary_search(info.aligned_days.begin(),
+                                    info.aligned_days.end(), t)) {
+                return false;
             }
-        } else { // adult wasps
-            for (OneCage& cage : cages) {
-                cage.wasps.Y *= mult;
-                if (cage.wasps.Y < extinct_N) cage.wasps.Y = 0;
+        } else if (!state_days.empty() && state_days.back() <= info.last_check) {
+            // States from before the last plant check can't be part of a cycle now:
+            state_days.clear();
+            states.clear();
+        }
+
+        state_fingerprint__(cages, info, t, fp);
+
+        uint32 max_len = info.max_days;
+        if (after_checks) max_len = CycleInfo::max_mult;
+        for (uint32 i = states.size(); i > 0; i--) {
+            uint32 len = t - state_days[i-1];
+            if (len > max_len || len > outputs.size()) break;
+            if (same__(fp, states[i-1])) {
+                end_day = t;
+                cycle_len = len;
+                return true;
             }
         }
-        i++;
+
+        while (!state_days.empty() && (t - state_days.front()) >= max_len) {
+            state_days.pop_front();
+            states.pop_front();
+        }
+        state_days.push_back() = t;
+        arena_vector<double>& s(states.push_back());
+        s.assign(fp.begin(), fp.end());
+
+        return false;
     }
 
-    if (do_pop && i > 0) {
-        perturbs.erase(perturbs.begin(), perturbs.begin() + i);
+    // After a cycle is found, add output for the remaining days by repeating it
+    void fill(RepSummary& summary,
+              const arena_vector<OneCage>& cages,
+              const SaveSchedule& schedule) const {
+        for (uint32 t = end_day + 1; t <= info.max_t; t++) {
+            if (!schedule.scheduled(t)) continue;
+            // Days since the same point in the last cycle:
+            uint32 back = cycle_len - ((t - end_day - 1) % cycle_len);
+            summary.push_back(t, cages, outputs[outputs.size() - back]);
+        }
+        return;
     }
 
-    return;
-}
+};
+
+
 
 
+/*
+ Compile-time choices for how a rep is simulated.
+ These are chosen once at the top of `sim_clonewars_cpp`, so the branches
+ for options that aren't being used don't exist in the loops.
+ */
+template <bool disp_error_, bool process_error_, bool partial_clear_,
+          uint32 max_stages_>
+struct SimPolicy {
+    // dispersal stochasticity
+    static constexpr bool disp_error = disp_error_;
+    // environmental and demographic stochasticity
+    static constexpr bool process_error = process_error_;
+    // some aphids and mummies survive plant clearing (i.e., `clear_surv > 0`)
+    static constexpr bool partial_clear = partial_clear_;
+    // most aphid stages there can be, or 0 for no limit (see `stages.hpp`)
+    static constexpr uint32 max_stages = max_stages_;
+};
+
 
+// Threshold for clearing patches: either max age or max # aphids
+template <typename T>
+inline T clear_threshold__(const uint32& max_plant_age, const double& max_N);
+template <>
+inline uint32 clear_threshold__<uint32>(const uint32& max_plant_age,
+                                        const double& max_N) {
+    return max_plant_age;
+}
+template <>
+inline double clear_threshold__<double>(const uint32& max_plant_age,
+                                        const double& max_N) {
+    return max_N;
+}
 
 
 /*
@@ -360,14 +880,16 @@ inline void do_perturb(std::deque<PerturbInfo>& perturbs,
  It should be double for using aphid abundance to determine whether a patch gets cleared.
  */
 
-template <typename T>
-RepSummary one_rep__(const T& clear_threshold,
+template <typename T, class Policy>
+RepSummary one_rep__(const uint32& max_plant_age,
+                     const double& max_N,
                      const uint32& rep,
                      const uint32& n_cages,
-                     std::deque<uint32> check_for_clear,
+                     const std::deque<uint32>& check_for_clear_,
                      const double& clear_surv,
                      const uint32& max_t,
-                     const uint32& save_every,
+                     const SaveSchedule& schedule,
+                     const bool& sparse_output,
                      const double& mean_K,
                      const double& sd_K,
                      const double& K_y_mult,
@@ -375,7 +897,6 @@ RepSummary one_rep__(const T& clear_threshold,
                      const double& shape1_death_mort,
                      const double& shape2_death_mort,
                      const arma::mat& attack_surv,
-                     const bool& disp_error,
                      const bool& demog_error,
                      const double& sigma_x,
                      const double& sigma_y,
@@ -405,25 +926,35 @@ RepSummary one_rep__(const T& clear_threshold,
                      const std::vector<uint32>& perturb_when,
                      const std::vector<uint32>& perturb_who,
                      const std::vector<double>& perturb_how,
-                     Progress& prog_bar,
+                     const CheckpointInfo& ckpt,
+                     const SnapshotInfo& snap,
+                     std::string& snapshot_out,
+                     const CycleInfo& cycle_info,
+                     ProgressCounter& progress,
                      int& status_code,
                      pcg32& eng) {
 
     double demog_mult = 1;
     if (!demog_error) demog_mult = 0;
-    // either type of environmental error
-    bool process_error = (sigma_x > 0) || (sigma_y > 0);
+
+    const T clear_threshold = clear_threshold__<T>(max_plant_age, max_N);
 
     uint32 n_lines = aphid_name.size();
     uint32 n_patches = aphid_density_0.size();
+    uint32 n_stages = leslie_mat.front().n_rows;
 
     RepSummary summary;
 
-    summary.reserve(rep, max_t, save_every, n_lines, n_cages, n_patches);
-
     uint32 iters = 0;
 
-    std::vector<OneCage> cages;
+    /*
+     All objects below are only needed for this rep, so they're allocated
+     from this thread's `RepArena` (see `arena.hpp`).
+     */
+    arena_deque<uint32> check_for_clear(check_for_clear_.begin(),
+                                        check_for_clear_.end());
+
+    arena_vector<OneCage> cages;
     cages.reserve(n_cages);
     for (uint32 i = 0; i < n_cages; i++) {
         cages.push_back(
@@ -439,28 +970,76 @@ RepSummary one_rep__(const T& clear_threshold,
 
 
 
-    std::deque<PerturbInfo> perturbs(perturb_when.size());
+    arena_deque<PerturbInfo> perturbs(perturb_when.size());
     for (uint32 i = 0; i < perturb_when.size(); i++) {
         perturbs[i] = PerturbInfo(perturb_when[i], perturb_who[i],
                                   perturb_how[i]);
     }
 
 
-    summary.push_back(0, cages);
+    /*
+     Last day that's already been simulated
+     (only > 0 if branching from a snapshot or resuming from a checkpoint)
+     */
+    uint32 t0 = 0;
+    bool resumed = false;
+
+    if (snap.branching() &&
+        !load_snapshot__(snap.from, t0, cages, perturbs, check_for_clear)) {
+        status_code = -4;
+        return summary;
+    }
+    const uint32 t_start = t0;
+
+    summary.reserve(rep, schedule.n_saves(t0), n_lines, n_cages, n_patches,
+                    sparse_output);
 
-    for (uint32 t = 1; t <= max_t; t++) {
+    ChangeTrigger trigger(schedule);
 
-        if (interrupt_check(iters, prog_bar)) {
+    if (ckpt.active()) {
+        bool done = false;
+        int ckpt_status = load_checkpoint__(ckpt, rep, done, t0, summary, cages,
+                                            perturbs, check_for_clear, eng,
+                                            trigger, n_stages, max_t);
+        if (ckpt_status < 0) {
+            status_code = -2;
+            return summary;
+        }
+        resumed = ckpt_status > 0;
+        if (resumed) progress.add(done ? (max_t - t_start) : (t0 - t_start));
+        if (done) return summary;
+    }
+
+    if (!resumed) {
+        summary.push_back(t0, cages);
+        trigger.saved(cages);
+    }
+
+    CycleFinder cycles(cycle_info, cages);
+
+    for (uint32 t = t0 + 1; t <= max_t; t++) {
+
+        if (interrupt_check(iters, progress)) {
             status_code = -1;
+            if (ckpt.active() &&
+                !save_checkpoint__(ckpt, rep, false, t - 1, summary, cages,
+                                   perturbs, check_for_clear, eng,
+                                   trigger, n_stages, max_t)) {
+                status_code = -3;
+            }
             return summary;
         }
 
         // Perturbations
-        do_perturb(perturbs, cages, t, aphid_name.size(), extinct_N, true);
+        {
+            PhaseScope timer(phase::perturbation);
+            do_perturb(perturbs, cages, t, aphid_name.size(), extinct_N, true);
+        }
 
         if (n_cages > 1 && alate_disp_prop > 0 &&
             !check_for_clear.empty() && t == check_for_clear.front()) {
 
+            PhaseScope timer(phase::dispersal);
             arma::mat D = cages.front().remove_dispersers(alate_disp_prop);
             for (uint32 i = 1; i < cages.size(); i++) {
                 D += cages[i].remove_dispersers(alate_disp_prop);
@@ -474,50 +1053,148 @@ RepSummary one_rep__(const T& clear_threshold,
 
             OneCage& cage(cages[i]);
 
-            if (disp_error) {
-                cage.calc_dispersal(eng);
-            } else cage.calc_dispersal();
-
-            if (process_error) {
-                cage.update(eng);
-            } else cage.update();
+            {
+                PhaseScope timer(phase::dispersal);
+                cage.calc_dispersal<Policy::disp_error>(eng);
+            }
+            cage.update<Policy::process_error, Policy::max_stages>(eng);
 
 
             if (t == wasp_delay) cage.wasps.Y += wasp_density_0[i];
 
         }
 
-        if (t % save_every == 0 || t == max_t) summary.push_back(t, cages);
+        if (schedule.scheduled(t)) {
+            summary.push_back(t, cages);
+            trigger.saved(cages);
+        } else if (trigger.fires(cages)) {
+            summary.push_back(t, cages);
+        }
+
+        // Only the state and plant-check schedule affect days after this:
+        const bool autonomous = cycles.active() && perturbs.empty() && t >= wasp_delay;
+        if (autonomous) {
+            PhaseScope timer(phase::output);
+            cycles.add_output(cages);
+        }
 
         // If all cages are empty, then stop this rep.
         // It's important to do this before clearing patches.
         bool all_empty = true;
         for (uint32 i = 0; i < n_cages; i++) {
-            for (const OnePatch& p : cages[i].patches) {
-                if (!p.empty) {
-                    all_empty = false;
-                    break;
-                }
+            if (!cages[i].empty()) {
+                all_empty = false;
+                break;
             }
-            if (!all_empty) break;
         }
         if (all_empty) break;
 
         if (!check_for_clear.empty() && t == check_for_clear.front()) {
             check_for_clear.pop_front();
+            PhaseScope timer(phase::clearing);
             for (uint32 i = 0; i < n_cages; i++) {
-                cages[i].clear_patches(clear_threshold, clear_surv, eng);
+                cages[i].clear_patches<Policy::partial_clear>(clear_threshold,
+                                                              clear_surv, eng);
+            }
+        }
+
+        if (ckpt.active() && ckpt.every > 0 && t % ckpt.every == 0 && t < max_t) {
+            if (!save_checkpoint__(ckpt, rep, false, t, summary, cages,
+                                   perturbs, check_for_clear, eng,
+                                   trigger, n_stages, max_t)) {
+                status_code = -3;
+                return summary;
             }
         }
 
+        if (autonomous && t < max_t && cycles.found(t, cages)) {
+            cycles.fill(summary, cages, schedule);
+            progress.add(max_t - t);
+            break;
+        }
+
+    }
 
+    if (ckpt.active() &&
+        !save_checkpoint__(ckpt, rep, true, max_t, summary, cages,
+                           perturbs, check_for_clear, eng,
+                           trigger, n_stages, max_t)) {
+        status_code = -3;
     }
 
+    if (snap.save) {
+        snapshot_out = make_snapshot__(max_t, cages, perturbs, check_for_clear,
+                                       eng, n_stages);
+    }
 
     return summary;
 
 }
 
+
+/*
+ Pointer to `one_rep__` for a given clearing threshold type and set of
+ policies. All versions of `one_rep__` have the same signature, so
+ `sim_clonewars_cpp` can choose one before the reps start.
+ */
+typedef decltype(&one_rep__<uint32, SimPolicy<false, false, false, 0>>) OneRepFn;
+
+template <typename T, bool disp_error, bool process_error, bool partial_clear>
+inline OneRepFn select_stages_policy__(const uint32& n_stages) {
+    typedef SimPolicy<disp_error, process_error, partial_clear,
+                      stage_limits::up_to_32> UpTo32;
+    typedef SimPolicy<disp_error, process_error, partial_clear,
+                      stage_limits::up_to_64> UpTo64;
+    typedef SimPolicy<disp_error, process_error, partial_clear, 0> Dynamic;
+    const uint32 limit = stage_limit(n_stages);
+    if (limit == stage_limits::up_to_32) return &one_rep__<T, UpTo32>;
+    if (limit == stage_limits::up_to_64) return &one_rep__<T, UpTo64>;
+    return &one_rep__<T, Dynamic>;
+}
+template <typename T, bool disp_error, bool process_error>
+inline OneRepFn select_clear_policy__(const bool& partial_clear,
+                                      const uint32& n_stages) {
+    if (partial_clear) {
+        return select_stages_policy__<T, disp_error, process_error, true>(n_stages);
+    }
+    return select_stages_policy__<T, disp_error, process_error, false>(n_stages);
+}
+template <typename T, bool disp_error>
+inline OneRepFn select_process_policy__(const bool& process_error,
+                                        const bool& partial_clear,
+                                        const uint32& n_stages) {
+    if (process_error) {
+        return select_clear_policy__<T, disp_error, true>(partial_clear, n_stages);
+    }
+    return select_clear_policy__<T, disp_error, false>(partial_clear, n_stages);
+}
+template <typename T>
+inline OneRepFn select_disp_policy__(const bool& disp_error,
+                                     const bool& process_error,
+                                     const bool& partial_clear,
+                                     const uint32& n_stages) {
+    if (disp_error) {
+        return select_process_policy__<T, true>(process_error, partial_clear,
+                                                n_stages);
+    }
+    return select_process_policy__<T, false>(process_error, partial_clear,
+                                             n_stages);
+}
+inline OneRepFn select_one_rep__(const uint32& max_plant_age,
+                                 const bool& disp_error,
+                                 const bool& process_error,
+                                 const bool& partial_clear,
+                                 const uint32& n_stages) {
+    if (max_plant_age > 0) {
+        return select_disp_policy__<uint32>(disp_error, process_error,
+                                            partial_clear, n_stages);
+    }
+    return select_disp_policy__<double>(disp_error, process_error,
+                                        partial_clear, n_stages);
+}
+
+
+
 /*
  This template checks for any negative values, and returns an error if
  it finds any.
@@ -816,6 +1493,14 @@ void check_args(const uint32& n_reps,
     if (max_plant_age == 0 && max_N <= 0) {
         stop("\nERROR: max_plant_age == 0 && max_N <= 0\n");
     }
+    /*
+     Aphid process error uses the Cholesky decomposition of a matrix with
+     `rho` off the diagonal, which fails unless `rho < 1`.
+     (Errors can't get out of the parallel loop, so it's checked here.)
+     */
+    if (demog_error && sigma_x > 0 && rho >= 1) {
+        stop("\nERROR: demog_error && sigma_x > 0 && rho >= 1\n");
+    }
 
 
     return;
@@ -825,54 +1510,69 @@ void check_args(const uint32& n_reps,
 
 
 
-//[[Rcpp::export]]
-List sim_clonewars_cpp(const uint32& n_reps,
-                       const uint32& n_cages,
-                       const uint32& max_plant_age,
-                       const double& max_N,
-                       const std::deque<uint32>& check_for_clear,
-                       const double& clear_surv,
-                       const uint32& max_t,
-                       const uint32& save_every,
-                       const double& mean_K,
-                       const double& sd_K,
-                       const double& K_y_mult,
-                       const double& death_prop,
-                       const double& shape1_death_mort,
-                       const double& shape2_death_mort,
-                       const arma::mat& attack_surv,
-                       const bool& disp_error,
-                       const bool& demog_error,
-                       const double& sigma_x,
-                       const double& sigma_y,
-                       const double& rho,
-                       const double& extinct_N,
-                       const std::vector<std::string>& aphid_name,
-                       const std::vector<arma::cube>& leslie_mat,
-                       const std::vector<arma::cube>& aphid_density_0,
-                       const std::vector<double>& alate_b0,
-                       const std::vector<double>& alate_b1,
-                       const double& alate_disp_prop,
-                       const std::vector<double>& disp_rate,
-                       const std::vector<double>& disp_mort,
-                       const std::vector<uint32>& disp_start,
-                       const std::vector<uint32>& living_days,
-                       const std::vector<double>& pred_rate,
-                       const arma::mat& mum_density_0,
-                       const double& max_mum_density,
-                       const arma::vec& rel_attack,
-                       const double& a,
-                       const double& k,
-                       const double& h,
-                       const std::vector<double>& wasp_density_0,
-                       const uint32& wasp_delay,
-                       const double& sex_ratio,
-                       const double& s_y,
-                       const std::vector<uint32>& perturb_when,
-                       const std::vector<uint32>& perturb_who,
-                       const std::vector<double>& perturb_how,
-                       uint32 n_threads,
-                       const bool& show_progress) {
+void sim_clonewars__(const uint32& n_reps,
+                     const uint32& n_cages,
+                     const uint32& max_plant_age,
+                     const double& max_N,
+                     const std::deque<uint32>& check_for_clear,
+                     const double& clear_surv,
+                     const uint32& max_t,
+                     const uint32& save_every,
+                     const double& mean_K,
+                     const double& sd_K,
+                     const double& K_y_mult,
+                     const double& death_prop,
+                     const double& shape1_death_mort,
+                     const double& shape2_death_mort,
+                     const arma::mat& attack_surv,
+                     const bool& disp_error,
+                     const bool& demog_error,
+                     const double& sigma_x,
+                     const double& sigma_y,
+                     const double& rho,
+                     const double& extinct_N,
+                     const std::vector<std::string>& aphid_name,
+                     const std::vector<arma::cube>& leslie_mat,
+                     const std::vector<arma::cube>& aphid_density_0,
+                     const std::vector<double>& alate_b0,
+                     const std::vector<double>& alate_b1,
+                     const double& alate_disp_prop,
+                     const std::vector<double>& disp_rate,
+                     const std::vector<double>& disp_mort,
+                     const std::vector<uint32>& disp_start,
+                     const std::vector<uint32>& living_days,
+                     const std::vector<double>& pred_rate,
+                     const arma::mat& mum_density_0,
+                     const double& max_mum_density,
+                     const arma::vec& rel_attack,
+                     const double& a,
+                     const double& k,
+                     const double& h,
+                     const std::vector<double>& wasp_density_0,
+                     const uint32& wasp_delay,
+                     const double& sex_ratio,
+                     const double& s_y,
+                     const std::vector<uint32>& perturb_when,
+                     const std::vector<uint32>& perturb_who,
+                     const std::vector<double>& perturb_how,
+                     const std::string& checkpoint_dir,
+                     const uint32& checkpoint_every,
+                     const bool& save_snapshot,
+                     const std::string& from_snapshot,
+                     const double& cycle_tol,
+                     const bool& profile,
+                     const std::string& trace_file,
+                     const std::string& store_file,
+                     const bool& store_compress,
+                     const bool& sparse_output,
+                     const std::vector<uint32>& save_days,
+                     const uint32& event_window,
+                     const double& save_change,
+                     const uint32& max_change_saves,
+                     const std::vector<double>& summary_probs,
+                     uint32 n_threads,
+                     const bool& show_progress,
+                     SimOutput& output) {
 
     uint32 n_lines = aphid_name.size();
     uint32 n_patches = aphid_density_0.size();
@@ -890,7 +1590,60 @@ List sim_clonewars_cpp(const uint32& n_reps,
                wasp_density_0, wasp_delay, sex_ratio, s_y,
                perturb_when, perturb_who, perturb_how, n_threads);
 
-    Progress prog_bar(max_t * n_reps, show_progress);
+    if (save_change < 0) stop("\nERROR: save_change < 0\n");
+    const SaveSchedule schedule(max_t, save_every, save_days, perturb_when,
+                                check_for_clear, event_window, save_change,
+                                max_change_saves);
+
+    // either type of environmental error
+    bool process_error = (sigma_x > 0) || (sigma_y > 0);
+    uint32 n_stages = aphid_density_0.front().n_rows;
+    const OneRepFn one_rep = select_one_rep__(max_plant_age, disp_error,
+                                              process_error, clear_surv > 0,
+                                              n_stages);
+
+    const CheckpointInfo ckpt(checkpoint_dir, checkpoint_every);
+
+    const SnapshotInfo snap(from_snapshot, save_snapshot);
+    // Day that branches start from:
+    uint32 t0 = 0;
+    if (snap.branching()) {
+        t0 = snapshot_day(snap.from, n_cages, n_patches, n_lines, n_stages);
+        if (t0 >= max_t) {
+            stop("\nERROR: `max_t` must be greater than the day that "
+                 "`from_snapshot` was taken (" + std::to_string(t0) + ").\n");
+        }
+    }
+    /*
+     A rep that's finished according to its checkpoint doesn't have the state
+     needed for a snapshot.
+     */
+    if (snap.save && ckpt.active()) {
+        stop("\nERROR: snapshots can't be saved when using checkpoints.\n");
+    }
+    std::vector<std::string> snapshots(snap.save ? n_reps : 0);
+    std::string no_snapshot;
+
+    /*
+     Cycles are only looked for when nothing is stochastic.
+     They're not used with snapshots because the final state isn't simulated,
+     or with change-triggered saves because those depend on the days saved
+     before the cycle started.
+     */
+    const bool deterministic = !disp_error && !process_error && sd_K <= 0 &&
+        shape2_death_mort <= 0;
+    const CycleInfo cycle_info((snap.save || schedule.triggers()) ? 0 : cycle_tol,
+                               deterministic,
+                               check_for_clear, max_plant_age, max_t);
+
+    /*
+     When nothing is stochastic, every rep is the same, so only the first is
+     simulated, and it's copied for the rest below.
+     */
+    const uint32 n_sims = deterministic ? 1U : n_reps;
+
+    Progress prog_bar((max_t - t0) * n_sims, show_progress);
+    ProgressCounter progress(prog_bar, n_threads);
     std::vector<int> status_codes(n_threads, 0);
 
     // Generate seeds for random number generators (1 set of seeds per rep)
@@ -898,6 +1651,53 @@ List sim_clonewars_cpp(const uint32& n_reps,
 
     std::vector<RepSummary> summaries(n_reps);
 
+    // Seconds spent in each phase by each thread (only when `profile` is true):
+    std::vector<std::vector<double>> phase_times(n_threads,
+                                                 std::vector<double>(phase::count, 0));
+    PhaseTimers::enable(profile);
+
+    // Timeline of reps and phases for each thread (only when `trace_file` isn't empty):
+    const bool tracing = !trace_file.empty();
+    std::vector<std::vector<TraceEvent>> trace_events(n_threads);
+    uint64 trace_dropped = 0;
+    TraceBuffer::enable(tracing);
+
+    /*
+     When `summary_probs` isn't empty, output is only kept as summaries
+     across reps: each thread adds its reps to its own `EnsembleSummary` as
+     they finish, and these are merged once all reps are done.
+     */
+    const bool ensemble = !summary_probs.empty();
+    if (ensemble && (!store_file.empty() || sparse_output)) {
+        stop("\nERROR: summaries across reps can't be used with sparse output "
+             "or `store_file`.\n");
+    }
+    for (const double& p : summary_probs) {
+        if (p < 0 || p > 1) stop("\nERROR: summary_probs must be in [0, 1]\n");
+    }
+    std::vector<EnsembleSummary> ensembles;
+    if (ensemble) {
+        ensembles.assign(n_threads, EnsembleSummary(max_t, n_cages, n_patches,
+                                                    aphid_name));
+    }
+
+    /*
+     When `store_file` isn't empty, each rep's output is handed to a
+     background thread as soon as the rep finishes, and it's dropped from
+     memory once that thread writes it to the file.
+     There can be up to `n_threads` reps waiting to be written.
+     Stores rely on every time point having the same rows, so they can't be
+     used for sparse output.
+     */
+    if (!store_file.empty() && sparse_output) {
+        stop("\nERROR: sparse output can't be written to `store_file`.\n");
+    }
+    StoreWriter store(store_file, n_reps, n_cages, n_patches, aphid_name, store_compress);
+    if (store.active() && !store.good()) {
+        stop("\nERROR: `store_file` (\"" + store_file + "\") couldn't be opened.\n");
+    }
+    StoreWriteQueue store_queue(store, n_threads);
+
 
 #ifdef _OPENMP
 #pragma omp parallel default(shared) num_threads(n_threads) if (n_threads > 1)
@@ -914,60 +1714,136 @@ List sim_clonewars_cpp(const uint32& n_reps,
 
     pcg32 eng;
 
-    // Parallelize the Loop
+    if (profile) PhaseTimers::local().reset();
+    if (tracing) TraceBuffer::local().reset();
+
+    /*
+     Parallelize the Loop.
+     (`nowait` lets the master thread go on to monitor progress once its reps
+     are done, while the others are still working.)
+     */
 #ifdef _OPENMP
-#pragma omp for schedule(static)
+#pragma omp for schedule(static) nowait
 #endif
-    for (uint32 i = 0; i < n_reps; i++) {
-        if (status_code != 0) continue;
+    for (uint32 i = 0; i < n_sims; i++) {
+        if (status_code != 0 || progress.aborted()) continue;
         seed_pcg(eng, seeds[i]);
-        if (max_plant_age > 0) {
-            summaries[i] = one_rep__<uint32>(max_plant_age, i, n_cages, check_for_clear,
-                                             clear_surv, max_t,
-                                             save_every, mean_K, sd_K, K_y_mult,
-                                             death_prop,
-                                             shape1_death_mort, shape2_death_mort,
-                                             attack_surv, disp_error,
-                                             demog_error, sigma_x, sigma_y, rho,
-                                             extinct_N,
-                                             aphid_name, leslie_mat, aphid_density_0,
-                                             alate_b0, alate_b1,
-                                             alate_disp_prop,
-                                             disp_rate, disp_mort,
-                                             disp_start, living_days, pred_rate,
-                                             mum_density_0, max_mum_density,
-                                             rel_attack, a, k,
-                                             h, wasp_density_0, wasp_delay,
-                                             sex_ratio, s_y,
-                                             perturb_when, perturb_who, perturb_how,
-                                             prog_bar, status_code, eng);
-        } else {
-            summaries[i] = one_rep__<double>(max_N, i, n_cages, check_for_clear,
-                                             clear_surv, max_t,
-                                             save_every, mean_K, sd_K, K_y_mult,
-                                             death_prop,
-                                             shape1_death_mort, shape2_death_mort,
-                                             attack_surv, disp_error,
-                                             demog_error, sigma_x, sigma_y, rho,
-                                             extinct_N,
-                                             aphid_name, leslie_mat, aphid_density_0,
-                                             alate_b0, alate_b1,
-                                             alate_disp_prop,
-                                             disp_rate, disp_mort,
-                                             disp_start, living_days, pred_rate,
-                                             mum_density_0, max_mum_density,
-                                             rel_attack, a, k,
-                                             h, wasp_density_0, wasp_delay,
-                                             sex_ratio, s_y,
-                                             perturb_when, perturb_who, perturb_how,
-                                             prog_bar, status_code, eng);
+        if (tracing) TraceBuffer::local().begin(TraceBuffer::rep_event, i);
+        summaries[i] = one_rep(max_plant_age, max_N, i, n_cages, check_for_clear,
+                               clear_surv, max_t,
+                               schedule, sparse_output, mean_K, sd_K, K_y_mult,
+                               death_prop,
+                               shape1_death_mort, shape2_death_mort,
+                               attack_surv,
+                               demog_error, sigma_x, sigma_y, rho,
+                               extinct_N,
+                               aphid_name, leslie_mat, aphid_density_0,
+                               alate_b0, alate_b1,
+                               alate_disp_prop,
+                               disp_rate, disp_mort,
+                               disp_start, living_days, pred_rate,
+                               mum_density_0, max_mum_density,
+                               rel_attack, a, k,
+                               h, wasp_density_0, wasp_delay,
+                               sex_ratio, s_y,
+                               perturb_when, perturb_who, perturb_how,
+                               ckpt, snap,
+                               snap.save ? snapshots[i] : no_snapshot,
+                               cycle_info, progress, status_code, eng);
+        if (tracing) TraceBuffer::local().end(TraceBuffer::rep_event, i);
+        // Only finished reps are written (the store is dropped after an interrupt):
+        if (store.active() && status_code == 0) {
+            // (includes waiting when the queue is full)
+            PhaseScope timer(phase::store);
+            if (!store_queue.push(i, summaries[i])) status_code = -5;
+        }
+        if (ensemble && status_code >= -1) {
+            /*
+             The one simulated rep stands for all of them when nothing is
+             stochastic, but only if it finished.
+             */
+            const double weight = (deterministic && status_code == 0) ? n_reps : 1;
+            if (!ensembles[active_thread].add(summaries[i], weight)) status_code = -6;
+            summaries[i].clear();
+        }
+        // Everything from this rep is gone now, so its memory can be re-used:
+        RepArena::local().reset();
+    }
+
+    RepArena::local().release();
+
+    // (before `monitor` so that waiting for other threads isn't counted)
+    if (profile) {
+        PhaseTimers& timers(PhaseTimers::local());
+        timers.start(phase::other);
+        for (uint32 p = 0; p < phase::count; p++) {
+            phase_times[active_thread][p] = timers.total(p);
         }
     }
+    if (tracing) {
+        TraceBuffer& buffer(TraceBuffer::local());
+        trace_events[active_thread] = buffer.ordered();
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+        trace_dropped += buffer.n_dropped();
+        buffer.release();
+    }
+
+    progress.finish_thread();
+#ifdef _OPENMP
+    if (active_thread == 0) progress.monitor(omp_get_num_threads());
+#else
+    progress.monitor(1);
+#endif
 
 #ifdef _OPENMP
 }
 #endif
 
+    PhaseTimers::enable(false);
+    TraceBuffer::enable(false);
+
+    if (tracing && !write_trace__(trace_file, trace_events, phase::names, trace_dropped)) {
+        stop("\nERROR: `trace_file` (\"" + trace_file + "\") couldn't be written.\n");
+    }
+    trace_events.clear();
+
+    if (!store_queue.finish()) {
+        stop("\nERROR: `store_file` (\"" + store_file + "\") couldn't be written.\n");
+    }
+
+    for (const int& sc : status_codes) {
+        if (sc == -2) {
+            stop("\nERROR: at least one checkpoint file in `" + checkpoint_dir +
+                 "` is corrupted or was made using different arguments.\n");
+        }
+        if (sc == -3) {
+            stop("\nERROR: at least one checkpoint file couldn't be written to `" +
+                 checkpoint_dir + "`.\n");
+        }
+        if (sc == -4) stop("\nERROR: `from_snapshot` is corrupted.\n");
+        if (sc == -5) {
+            stop("\nERROR: `store_file` (\"" + store_file + "\") couldn't be written.\n");
+        }
+        if (sc == -6) stop("\nERROR: output couldn't be summarized across reps.\n");
+    }
+
+    /*
+     If any rep was interrupted, the store is missing reps.
+     This also means that when nothing is stochastic, the one simulated rep
+     didn't finish, so it's not copied to the others.
+     */
+    bool interrupted = false;
+    for (const int& sc : status_codes) interrupted = interrupted || sc == -1;
+    if (store.active() && interrupted) store.discard();
+    if (store.active() && !interrupted) {
+        for (uint32 i = n_sims; i < n_reps; i++) store.repeat(i, 0);
+        if (!store.close()) {
+            stop("\nERROR: `store_file` (\"" + store_file + "\") couldn't be written.\n");
+        }
+    }
+
 
     /*
      When # reps > 1, combine all RepSummary objects into the first one.
@@ -975,26 +1851,40 @@ List sim_clonewars_cpp(const uint32& n_reps,
      */
     RepSummary& summ(summaries.front());
     if (n_reps > 1) {
-        summ.reserve(summ.N.size() * summaries.size(),
-                     summ.wasp_N.size() * summaries.size());
+        uint32 n = summ.N.size();
+        uint32 nw = summ.wasp_N.size();
+        uint32 ne = summ.event_time.size();
+        summ.reserve(n * summaries.size(), nw * summaries.size());
         for (uint32 i = 1; i < n_reps; i++) {
-            summ.assimilate(summaries[i]);
+            if (i < n_sims) {
+                summ.assimilate(summaries[i]);
+            } else if (!interrupted) summ.repeat(n, nw, ne, i);
+        }
+        if (!interrupted) {
+            for (uint32 i = n_sims; i < snapshots.size(); i++) snapshots[i] = snapshots[0];
         }
     }
 
-    List out = List::create(_["aphids"] = DataFrame::create(
-                                _["rep"] = summ.rep,
-                                _["time"] = summ.time,
-                                _["cage"] = summ.cage,
-                                _["patch"] = summ.patch,
-                                _["line"] = summ.line,
-                                _["type"] = summ.type,
-                                _["N"] = summ.N),
-                            _["wasps"] = DataFrame::create(
-                                _["rep"] = summ.wasp_rep,
-                                _["time"] = summ.wasp_time,
-                                _["cage"] = summ.wasp_cage,
-                                _["wasps"] = summ.wasp_N));
+    summ.move_to(output);
+    output.sparse = sparse_output;
+    if (ensemble) {
+        for (uint32 i = 1; i < ensembles.size(); i++) {
+            ensembles.front().merge(ensembles[i]);
+            ensembles[i] = EnsembleSummary(0, n_cages, n_patches, aphid_name);
+        }
+        ensembles.front().move_to(output, summary_probs);
+    }
+    output.snapshots.swap(snapshots);
+
+    output.phase_times.clear();
+    if (profile) {
+        output.phase_times.assign(phase::count, 0);
+        for (uint32 p = 0; p < phase::count; p++) {
+            for (const std::vector<double>& pt : phase_times) {
+                output.phase_times[p] += pt[p];
+            }
+        }
+    }
 
-    return out;
+    return;
 }
@@ -0,0 +1,134 @@
+# ifndef __CLONEWARS_SIMULATIONS_H
+# define __CLONEWARS_SIMULATIONS_H
+
+
+#include "rcpp_compat.hpp"      // arma namespace
+#include <vector>               // vector class
+#include <deque>                // deque
+#include <string>               // string class
+#include "clonewars_types.hpp"  // integer types
+
+
+
+/*
+ Output from `sim_clonewars__`.
+ The first two groups of vectors are the columns of the "aphids" and "wasps"
+ data frames returned to R.
+ */
+struct SimOutput {
+
+    std::vector<uint32> rep;
+    std::vector<uint32> time;
+    std::vector<uint32> cage;
+    std::vector<uint32> patch;
+    std::vector<std::string> line;
+    std::vector<std::string> type;
+    std::vector<output_t> N;
+
+    std::vector<uint32> wasp_rep;
+    std::vector<uint32> wasp_time;
+    std::vector<uint32> wasp_cage;
+    std::vector<output_t> wasp_N;
+
+    // Only for sparse output (see `RepSummary`):
+    std::vector<uint32> event_rep;
+    std::vector<uint32> event_time;
+    std::vector<uint32> event_cage;
+    std::vector<uint32> event_patch;
+    std::vector<std::string> event_line;
+    std::vector<std::string> event_type;
+    bool sparse = false;
+
+    // Only for summaries across reps (see `EnsembleSummary`):
+    std::vector<uint32> summary_time;
+    std::vector<uint32> summary_cage;
+    std::vector<std::string> summary_line;
+    std::vector<std::string> summary_type;
+    std::vector<double> summary_n;
+    std::vector<double> summary_mean;
+    std::vector<double> summary_probs;
+    // One vector per item in `summary_probs`:
+    std::vector<std::vector<double>> summary_quantiles;
+
+    // One per rep if `save_snapshot` is true, otherwise empty:
+    std::vector<std::string> snapshots;
+    // Seconds spent in each phase (see `phase_timer.hpp`) if `profile` is true:
+    std::vector<double> phase_times;
+
+};
+
+
+
+/*
+ Run all reps.
+ This is everything `sim_clonewars_cpp` does except converting to and from
+ R objects, so it can also be used without R (see `rcpp_compat.hpp`).
+ Errors in arguments or files result in a call to `stop`.
+ */
+void sim_clonewars__(const uint32& n_reps,
+                     const uint32& n_cages,
+                     const uint32& max_plant_age,
+                     const double& max_N,
+                     const std::deque<uint32>& check_for_clear,
+                     const double& clear_surv,
+                     const uint32& max_t,
+                     const uint32& save_every,
+                     const double& mean_K,
+                     const double& sd_K,
+                     const double& K_y_mult,
+                     const double& death_prop,
+                     const double& shape1_death_mort,
+                     const double& shape2_death_mort,
+                     const arma::mat& attack_surv,
+                     const bool& disp_error,
+                     const bool& demog_error,
+                     const double& sigma_x,
+                     const double& sigma_y,
+                     const double& rho,
+                     const double& extinct_N,
+                     const std::vector<std::string>& aphid_name,
+                     const std::vector<arma::cube>& leslie_mat,
+                     const std::vector<arma::cube>& aphid_density_0,
+                     const std::vector<double>& alate_b0,
+                     const std::vector<double>& alate_b1,
+                     const double& alate_disp_prop,
+                     const std::vector<double>& disp_rate,
+                     const std::vector<double>& disp_mort,
+                     const std::vector<uint32>& disp_start,
+                     const std::vector<uint32>& living_days,
+                     const std::vector<double>& pred_rate,
+                     const arma::mat& mum_density_0,
+                     const double& max_mum_density,
+                     const arma::vec& rel_attack,
+                     const double& a,
+                     const double& k,
+                     const double& h,
+                     const std::vector<double>& wasp_density_0,
+                     const uint32& wasp_delay,
+                     const double& sex_ratio,
+                     const double& s_y,
+                     const std::vector<uint32>& perturb_when,
+                     const std::vector<uint32>& perturb_who,
+                     const std::vector<double>& perturb_how,
+                     const std::string& checkpoint_dir,
+                     const uint32& checkpoint_every,
+                     const bool& save_snapshot,
+                     const std::string& from_snapshot,
+                     const double& cycle_tol,
+                     const bool& profile,
+                     const std::string& trace_file,
+                     const std::string& store_file,
+                     const bool& store_compress,
+                     const bool& sparse_output,
+                     const std::vector<uint32>& save_days,
+                     const uint32& event_window,
+                     const double& save_change,
+                     const uint32& max_change_saves,
+                     const std::vector<double>& summary_probs,
+                     uint32 n_threads,
+                     const bool& show_progress,
+                     SimOutput& output);
+
+
+
+#endif
@@ -0,0 +1,136 @@
+# ifndef __CLONEWARS_STAGES_H
+# define __CLONEWARS_STAGES_H
+
+
+#include "clonewars_types.hpp"  // integer types
+#include "arena.hpp"            // arena_vector
+
+
+
+/*
+ Kernels for stage-structured vectors (`n` is the number of stages).
+
+ The aphid updates take a compile-time limit on the number of stages
+ (`max_stages`), which is picked once per run from the number of stages
+ (see `stage_limit` below), so it doesn't depend on any particular life
+ history.
+ When the limit isn't 0, scratch vectors for these kernels live on the stack
+ instead of in the rep's arena (see `StageBuffer`).
+
+ All matrices are column-major (same as Armadillo).
+ */
+
+
+// Most stages for the compile-time versions of the kernels.
+namespace stage_limits {
+    const uint32 up_to_32 = 32;
+    const uint32 up_to_64 = 64;
+}
+
+// Smallest limit that `n` stages fit in, or 0 if they don't fit in any.
+inline uint32 stage_limit(const uint32& n) {
+    if (n <= stage_limits::up_to_32) return stage_limits::up_to_32;
+    if (n <= stage_limits::up_to_64) return stage_limits::up_to_64;
+    return 0;
+}
+
+
+
+
+/*
+ Scratch space for up to `Size` doubles (`n` must be `<= Size`).
+ When `Size == 0`, size is set at run time and memory comes from
+ this thread's `RepArena`.
+ */
+template <uint32 Size>
+struct StageBuffer {
+    double data[Size];
+    StageBuffer(const uint32& n) {};
+};
+template <>
+struct StageBuffer<0> {
+    arena_vector<double> vec;
+    double* data;
+    StageBuffer(const uint32& n) : vec(n), data(vec.data()) {};
+};
+
+
+
+
+// `out = L * x`
+inline void leslie_step__(const double* L,
+                          const double* x,
+                          double* out,
+                          const uint32& n) {
+    for (uint32 i = 0; i < n; i++) out[i] = 0;
+    for (uint32 j = 0; j < n; j++) {
+        const double& xj(x[j]);
+        const double* Lj = L + j * n;
+        for (uint32 i = 0; i < n; i++) out[i] += Lj[i] * xj;
+    }
+    return;
+}
+
+
+// `X = mult * A % LX`, returning the new total of `X`
+inline double survive_attack__(double* X,
+                               const double* A,
+                               const double* LX,
+                               const double& mult,
+                               const uint32& n) {
+    double total = 0;
+    for (uint32 i = 0; i < n; i++) {
+        X[i] = mult * A[i] * LX[i];
+        total += X[i];
+    }
+    return total;
+}
+
+// `(1 - A).t() * LX`
+inline double parasitized__(const double* A,
+                            const double* LX,
+                            const uint32& n) {
+    double np = 0;
+    for (uint32 i = 0; i < n; i++) np += (1 - A[i]) * LX[i];
+    return np;
+}
+
+
+/*
+ Move parasitized aphids forward one day (going backwards to avoid conflicts).
+ The first stage isn't touched, and isn't included in the total that's returned.
+ */
+inline double shift_parasitized__(double* X,
+                                  const double* s,
+                                  const double& pred_surv,
+                                  const double& S_y,
+                                  const uint32& n) {
+    double total = 0;
+    for (uint32 i = n - 1; i > 0; i--) {
+        X[i] = pred_surv * s[i] * S_y * X[i-1];
+        total += X[i];
+    }
+    return total;
+}
+
+
+/*
+ Don't let the number in a stage exceed the number in the preceding stage
+ at the previous time step (`Xt`).
+ Returns the new total of `X`.
+ */
+inline double cap_stages__(double* X,
+                           const double* Xt,
+                           const uint32& n) {
+    double total = X[0];
+    for (uint32 i = 1; i < n; i++) {
+        if (X[i] > Xt[i-1]) X[i] = Xt[i-1];
+        total += X[i];
+    }
+    return total;
+}
+
+
+
+
+#endif
@@ -0,0 +1,158 @@
+# ifndef __CLONEWARS_TDIGEST_H
+# define __CLONEWARS_TDIGEST_H
+
+
+#include <vector>               // vector class
+#include <algorithm>            // sort, min, max
+#include <cmath>                // asin, sin
+#include <limits>               // quiet_NaN, infinity
+#include "clonewars_types.hpp"  // integer types
+
+
+
+/*
+ Approximate quantiles of a stream of numbers (a "merging t-digest";
+ Dunning & Ertl 2019, "Computing extremely accurate quantiles using t-digests").
+
+ Values are kept as weighted centroids, which are only merged with their
+ neighbors when that keeps quantile error small, and much smaller near the
+ tails than in the middle.
+ Memory doesn't depend on how many values are added (there are at most about
+ `2 * compression` centroids plus a buffer of `compression` values), and two
+ digests can be merged, so each thread can keep its own.
+ With fewer than about `compression / 2` values, nothing is merged and
+ quantiles are interpolated between the values themselves.
+ The mean is exact.
+ */
+class TDigest {
+
+    struct Centroid {
+        double mean;
+        double weight;
+        Centroid() : mean(0), weight(0) {};
+        Centroid(const double& m, const double& w) : mean(m), weight(w) {};
+        bool operator<(const Centroid& other) const { return mean < other.mean; }
+    };
+
+    static constexpr double pi = 3.14159265358979323846;
+
+    double compression;
+    std::vector<Centroid> centroids;    // sorted by mean (when `buffer` is empty)
+    std::vector<Centroid> buffer;       // not yet merged into `centroids`
+    double total;                       // total weight
+    double sum;                         // sum of weight * value
+    double min_;
+    double max_;
+
+    // Scale function (`k_1` in the paper) and its inverse:
+    inline double k__(const double& q) const {
+        return compression / (2 * pi) * std::asin(2 * q - 1);
+    }
+    inline double q__(const double& k) const {
+        if (k >= compression / 4) return 1;
+        return (std::sin(k * (2 * pi) / compression) + 1) / 2;
+    }
+
+    void compress__() {
+
+        if (buffer.empty()) return;
+
+        buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+        std::sort(buffer.begin(), buffer.end());
+        centroids.clear();
+
+        Centroid cur(buffer.front());
+        double w_so_far = 0;
+        double w_limit = total * q__(k__(0) + 1);
+        for (uint32 i = 1; i < buffer.size(); i++) {
+            const Centroid& c(buffer[i]);
+            if (w_so_far + cur.weight + c.weight <= w_limit) {
+                cur.mean += (c.mean - cur.mean) * c.weight / (cur.weight + c.weight);
+                cur.weight += c.weight;
+            } else {
+                w_so_far += cur.weight;
+                centroids.push_back(cur);
+                w_limit = total * q__(k__(w_so_far / total) + 1);
+                cur = c;
+            }
+        }
+        centroids.push_back(cur);
+        buffer.clear();
+
+        return;
+    }
+
+public:
+
+    TDigest(const double& compression_ = 100)
+        : compression(compression_), centroids(), buffer(), total(0), sum(0),
+          min_(std::numeric_limits<double>::infinity()),
+          max_(-std::numeric_limits<double>::infinity()) {};
+
+    // Add value `x` with weight `w` (e.g., the number of reps it stands for).
+    void add(const double& x, const double& w = 1) {
+        if (w <= 0) return;
+        buffer.push_back(Centroid(x, w));
+        total += w;
+        sum += x * w;
+        min_ = std::min(min_, x);
+        max_ = std::max(max_, x);
+        if (buffer.size() >= compression) compress__();
+        return;
+    }
+
+    // Add everything from `other`.
+    void merge(const TDigest& other) {
+        if (other.total <= 0) return;
+        buffer.insert(buffer.end(), other.centroids.begin(), other.centroids.end());
+        buffer.insert(buffer.end(), other.buffer.begin(), other.buffer.end());
+        total += other.total;
+        sum += other.sum;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+        compress__();
+        return;
+    }
+
+    inline double weight() const noexcept { return total; }
+
+    double mean() const {
+        if (total <= 0) return std::numeric_limits<double>::quiet_NaN();
+        return sum / total;
+    }
+
+    // Approximate `q` quantile (`0 <= q <= 1`):
+    double quantile(const double& q) {
+
+        compress__();
+
+        if (centroids.empty()) return std::numeric_limits<double>::quiet_NaN();
+        if (q <= 0) return min_;
+        if (q >= 1) return max_;
+        if (centroids.size() == 1) return centroids.front().mean;
+
+        // Each centroid's weight is centered on its mean:
+        const double index = q * total;
+        const Centroid& first(centroids.front());
+        if (index < first.weight / 2) {
+            return min_ + (first.mean - min_) * index / (first.weight / 2);
+        }
+        double w_so_far = first.weight / 2;
+        for (uint32 i = 1; i < centroids.size(); i++) {
+            const Centroid& left(centroids[i-1]);
+            const Centroid& right(centroids[i]);
+            const double dw = (left.weight + right.weight) / 2;
+            if (index < w_so_far + dw) {
+                return left.mean + (right.mean - left.mean) * (index - w_so_far) / dw;
+            }
+            w_so_far += dw;
+        }
+        const Centroid& last(centroids.back());
+        return last.mean + (max_ - last.mean) * (index - w_so_far) / (last.weight / 2);
+    }
+
+};
+
+
+
+#endif
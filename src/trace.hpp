@@ -0,0 +1,191 @@
+# ifndef __CLONEWARS_TRACE_H
+# define __CLONEWARS_TRACE_H
+
+
+#include <vector>               // vector class
+#include <string>               // string class
+#include <fstream>              // file streams
+#include <chrono>               // steady_clock
+#include <atomic>               // atomic
+#include <algorithm>            // min
+#include "clonewars_types.hpp"  // integer types
+
+
+
+/*
+ Optional timeline of what each thread was doing, for viewing in Chrome's
+ trace viewer (chrome://tracing) or Perfetto.
+
+ Each thread records begin/end events for reps and phases (see `PhaseScope`
+ in `phase_timer.hpp`) into its own ring buffer.
+ If a thread records more than `capacity` events, the oldest ones are
+ overwritten, so the file always has the end of the simulations.
+ After the parallel region, all buffers are written using `write_trace__`.
+ */
+
+
+struct TraceEvent {
+    uint32 what;    // phase (see `phase::Phase`) or `TraceBuffer::rep_event`
+    uint32 rep;     // only used for reps
+    double ts;      // microseconds since tracing started
+    bool begin;
+};
+
+
+class TraceBuffer {
+
+    typedef std::chrono::steady_clock clock;
+
+    std::vector<TraceEvent> events;
+    uint64 n_total;  // total # events recorded (including overwritten ones)
+
+    static std::atomic<bool>& enabled_() {
+        static std::atomic<bool> on(false);
+        return on;
+    }
+    static clock::time_point& origin_() {
+        static clock::time_point t0 = clock::now();
+        return t0;
+    }
+
+    inline void record__(const uint32& what, const uint32& rep, const bool& begin) {
+        if (events.empty()) return;
+        TraceEvent& e(events[n_total % events.size()]);
+        e.what = what;
+        e.rep = rep;
+        e.begin = begin;
+        e.ts = std::chrono::duration<double, std::micro>(clock::now() -
+            origin_()).count();
+        n_total++;
+        return;
+    }
+
+public:
+
+    // `what` for events that are reps rather than phases:
+    static constexpr uint32 rep_event = ~static_cast<uint32>(0);
+    // Max # events per thread:
+    static constexpr uint32 capacity = 1U << 18;
+
+    TraceBuffer() : events(), n_total(0) {};
+
+    // Every thread has its own buffer:
+    static TraceBuffer& local() {
+        thread_local TraceBuffer buffer;
+        return buffer;
+    }
+
+    /*
+     Turn tracing on or off (for all threads; don't call inside parallel regions).
+     Turning it on also resets the time that timestamps are relative to.
+     */
+    static void enable(const bool& on) {
+        if (on) origin_() = clock::now();
+        enabled_().store(on, std::memory_order_relaxed);
+        return;
+    }
+    inline static bool enabled() {
+        return enabled_().load(std::memory_order_relaxed);
+    }
+
+    // Empty the buffer and make room for `capacity` events:
+    void reset() {
+        events.assign(capacity, TraceEvent());
+        n_total = 0;
+        return;
+    }
+    // Free the buffer's memory:
+    void release() {
+        std::vector<TraceEvent>().swap(events);
+        n_total = 0;
+        return;
+    }
+
+    inline void begin(const uint32& what, const uint32& rep = 0) {
+        record__(what, rep, true);
+        return;
+    }
+    inline void end(const uint32& what, const uint32& rep = 0) {
+        record__(what, rep, false);
+        return;
+    }
+
+    // Events still in the buffer, oldest first:
+    std::vector<TraceEvent> ordered() const {
+        std::vector<TraceEvent> out;
+        if (events.empty()) return out;
+        uint64 n = std::min(n_total, static_cast<uint64>(events.size()));
+        out.reserve(n);
+        for (uint64 i = n_total - n; i < n_total; i++) {
+            out.push_back(events[i % events.size()]);
+        }
+        return out;
+    }
+    // # events that were overwritten:
+    inline uint64 n_dropped() const {
+        return n_total - std::min(n_total, static_cast<uint64>(events.size()));
+    }
+
+};
+
+
+
+/*
+ Write events from each thread (`thread_events[i]` is from thread `i`) to
+ file `fn` in Chrome's trace-event JSON format.
+ `names` are the names of phases.
+ End events whose begin events were overwritten are skipped.
+ Returns false if the file couldn't be written.
+ */
+inline bool write_trace__(const std::string& fn,
+                          const std::vector<std::vector<TraceEvent>>& thread_events,
+                          const char* const* names,
+                          const uint64& n_dropped) {
+
+    std::ofstream out(fn, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) return false;
+    out.precision(3);
+    out << std::fixed;
+
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto sep = [&first, &out]() {
+        if (!first) out << ",\n";
+        first = false;
+    };
+
+    for (uint32 tid = 0; tid < thread_events.size(); tid++) {
+        sep();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid <<
+            ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+        // # events currently open, to skip unmatched end events:
+        uint32 depth = 0;
+        for (const TraceEvent& e : thread_events[tid]) {
+            if (e.begin) {
+                depth++;
+            } else if (depth == 0) {
+                continue;
+            } else depth--;
+            sep();
+            if (e.what == TraceBuffer::rep_event) {
+                out << "{\"name\":\"rep " << e.rep << "\",\"cat\":\"rep\"";
+            } else out << "{\"name\":\"" << names[e.what] << "\",\"cat\":\"phase\"";
+            out << ",\"ph\":\"" << (e.begin ? 'B' : 'E') << "\",\"ts\":" << e.ts <<
+                ",\"pid\":0,\"tid\":" << tid;
+            if (e.what == TraceBuffer::rep_event && e.begin) {
+                out << ",\"args\":{\"rep\":" << e.rep << "}";
+            }
+            out << "}";
+        }
+    }
+
+    out << "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\"dropped_events\":" <<
+        n_dropped << "}}\n";
+
+    out.close();
+    return !out.fail();
+}
+
+
+
+#endif
@@ -2,7 +2,7 @@
 # define __CLONEWARS_WASPS_H
 
 
-#include <RcppArmadillo.h>      // arma namespace
+#include "rcpp_compat.hpp"      // arma namespace
 #include <vector>               // vector class
 #include <cmath>                // log, exp
 #include <random>               // normal distribution
@@ -11,6 +11,7 @@
 #include <pcg/pcg_random.hpp>   // pcg prng
 #include "pcg.hpp"              // runif_ fxns
 #include "clonewars_types.hpp"  // integer types
+#include "serialize.hpp"        // StateWriter, StateReader
 
 
 
@@ -54,24 +55,36 @@ public:
     }
 
     /*
-     Compute attack probabilities
+     Compute attack probabilities and write them to `out`
      Equation 6 from Meisner et al. (2014)
      Note: rel_attack is equivalent to p_i
      */
-    arma::vec A(const double& Y_m,
-                const double& x,
-                const arma::vec& attack_surv) const {
+    void A(const double& Y_m,
+           const double& x,
+           const arma::vec& attack_surv,
+           double* out) const {
+
+        const uint32 n = rel_attack.n_elem;
+        const double* p = rel_attack.memptr();
+        const double denom = h * x + 1;
 
-        arma::vec A_ = (a * rel_attack * Y_m) / (h * x + 1);
-        arma::vec AA = (1 + A_ / k);
         if (attack_surv.n_elem < 2 || arma::accu(attack_surv) == 0) {
-            A_ = arma::pow(AA, -k);
+            for (uint32 i = 0; i < n; i++) {
+                double A_ = (a * p[i] * Y_m) / denom;
+                out[i] = std::pow(1 + A_ / k, -k);
+            }
         } else {
-            A_ = arma::pow(AA, -k) +
-                attack_surv(0) * A_ % arma::pow(AA, -k-1) +
-                attack_surv(1) * (1-(arma::pow(AA, -k) + A_ % arma::pow(AA, -k-1)));
+            const double& s0(attack_surv(0));
+            const double& s1(attack_surv(1));
+            for (uint32 i = 0; i < n; i++) {
+                double A_ = (a * p[i] * Y_m) / denom;
+                double AA = 1 + A_ / k;
+                double none = std::pow(AA, -k);           // not attacked
+                double once = A_ * std::pow(AA, -k-1);    // attacked once
+                out[i] = none + s0 * once + s1 * (1 - (none + once));
+            }
         }
-        return A_;
+        return;
     }
 
 
@@ -86,6 +99,7 @@ public:
 class MummyPop {
 
     arma::vec Y_0;          // initial mummy densities
+    double N_;              // total of `Y` (see `AphidTypePop::N_`)
 
 public:
 
@@ -93,13 +107,15 @@ public:
     arma::vec Y;            // Mummy density
 
     // Constructors
-    MummyPop() : Y_0(4, arma::fill::zeros), Y(4, arma::fill::zeros) {};
+    MummyPop() : Y_0(4, arma::fill::zeros), N_(0), Y(4, arma::fill::zeros) {};
     MummyPop(const arma::vec& Y_0_)
         : Y_0(arma::join_vert(arma::vec(1, arma::fill::zeros), Y_0_)),
+          N_(arma::accu(Y_0_)),
           Y(arma::join_vert(arma::vec(1, arma::fill::zeros), Y_0_)) {};
-    MummyPop(const MummyPop& other) : Y_0(other.Y_0), Y(other.Y) {};
+    MummyPop(const MummyPop& other) : Y_0(other.Y_0), N_(other.N_), Y(other.Y) {};
     MummyPop& operator=(const MummyPop& other) {
         Y_0 = other.Y_0;
+        N_ = other.N_;
         Y = other.Y;
         return *this;
     }
@@ -111,26 +127,53 @@ public:
                 const double& nm) {
 
         // Go backwards through stages to avoid conflicts...
+        N_ = 0;
         for (uint32 i = Y.n_elem-1; i > 0; i--) {
             Y(i) = (1 - pred_rate) * Y(i-1);
+            N_ += Y(i);
         }
 
         // Add newly mummified over three days:
         Y(0) = nm / 3;
         Y(1) += (nm / 3);
         Y(2) += (nm / 3);
+        N_ += nm;
 
         return;
 
     }
 
+    // Total mummies
+    inline double total_mummies() const {
+        return N_;
+    }
+    // Re-calculate total after `Y` was changed from outside this class
+    inline void refresh_total() {
+        N_ = arma::accu(Y);
+        return;
+    }
+
     // Clearing a patch kills all mummies
     inline void clear() {
         Y.fill(0);
+        N_ = 0;
     }
     // Clearing part of patch
     inline void clear(const double& surv) {
         Y *= surv;
+        N_ *= surv;
+    }
+
+    // Save and restore state (see `serialize.hpp`)
+    void save_state(StateWriter& out) const {
+        out.write(Y);
+        out.write(N_);
+        return;
+    }
+    void load_state(StateReader& in) {
+        in.read(Y);
+        in.read(N_);
+        return;
     }
 
 
@@ -198,32 +241,43 @@ public:
     }
 
 
-    // Return attack matrix
-    arma::vec A(const arma::vec& attack_surv) const {
-        arma::vec A_ = attack.A(Y, x, attack_surv);
-        return A_;
+    // Save and restore state (see `serialize.hpp`)
+    void save_state(StateWriter& out) const {
+        out.write_stream(norm_distr);
+        out.write(Y);
+        out.write(x);
+        return;
+    }
+    void load_state(StateReader& in) {
+        in.read_stream(norm_distr);
+        in.read(Y);
+        in.read(x);
+        return;
+    }
+
+    // Write attack probabilities to `out`
+    void A(const arma::vec& attack_surv, double* out) const {
+        attack.A(Y, x, attack_surv, out);
+        return;
     }
 
     /*
      Update # adult wasps
      `old_mums` is # mummies at time t that are in the last mummy stage
-     before merging
+     before merging.
+     If `proc_error` is false, there's no stochasticity and `eng` isn't used.
      */
+    template <bool proc_error>
     void update(const double& old_mums,
                 pcg32& eng) {
         double max_Y = old_mums + Y;
         if (max_Y == 0) return;
         Y *= s_y;
         Y += (sex_ratio * old_mums);
-        Y *= std::exp(norm_distr(eng) * sigma_y);
-        if (Y > max_Y) Y = max_Y; // make sure it doesn't exceed what's possible
-        return;
-    }
-    // Same as above, but with no stochasticity
-    void update(const double& old_mums) {
-        if (old_mums + Y == 0) return;
-        Y *= s_y;
-        Y += (sex_ratio * old_mums);
+        if (proc_error) {
+            Y *= std::exp(norm_distr(eng) * sigma_y);
+            if (Y > max_Y) Y = max_Y; // make sure it doesn't exceed what's possible
+        }
         return;
     }
 
@@ -0,0 +1,127 @@
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ Counts and times heap allocations, for checking how much `RepArena`
+ (see `src/arena.hpp`) saves.
+
+ Build it as a shared library and preload it into any program:
+
+     make alloc_stats.so
+     LD_PRELOAD=./alloc_stats.so ./clonewars sims.cfg out
+
+ When the program exits, one line of CSV is printed to stderr:
+     allocs,frees,alloc_bytes,alloc_secs,peak_rss_mb
+ where `allocs` counts calls to `malloc`, `calloc`, `realloc`, and the
+ aligned versions (`operator new` and Armadillo both end up in these),
+ `frees` counts calls to `free`, and `alloc_secs` is the total time
+ spent inside all of them (across threads).
+
+ It uses glibc's internal `__libc_*` functions, so only works with glibc.
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include <cstdio>               // fprintf
+#include <cstddef>              // size_t
+#include <cerrno>               // errno
+#include <atomic>               // atomic
+#include <time.h>               // clock_gettime
+#include <sys/resource.h>       // getrusage
+
+
+extern "C" {
+void* __libc_malloc(size_t n);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t n);
+void* __libc_memalign(size_t align, size_t n);
+void __libc_free(void* p);
+}
+
+
+namespace {
+
+std::atomic<unsigned long long> n_allocs(0);
+std::atomic<unsigned long long> n_frees(0);
+std::atomic<unsigned long long> n_bytes(0);
+std::atomic<unsigned long long> n_nanosecs(0);
+
+inline unsigned long long now__() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL +
+        static_cast<unsigned long long>(ts.tv_nsec);
+}
+
+// Adds to counts and time when it goes out of scope
+struct Timer {
+    const unsigned long long t0;
+    const bool is_free;
+    const size_t n;
+    Timer(const bool& is_free_, const size_t& n_)
+        : t0(now__()), is_free(is_free_), n(n_) {};
+    ~Timer() {
+        n_nanosecs.fetch_add(now__() - t0, std::memory_order_relaxed);
+        if (is_free) {
+            n_frees.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            n_allocs.fetch_add(1, std::memory_order_relaxed);
+            n_bytes.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct Report {
+    ~Report() {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        std::fprintf(stderr, "allocs,frees,alloc_bytes,alloc_secs,peak_rss_mb\n"
+                     "%llu,%llu,%llu,%.4f,%.1f\n",
+                     n_allocs.load(), n_frees.load(), n_bytes.load(),
+                     static_cast<double>(n_nanosecs.load()) / 1e9,
+                     static_cast<double>(ru.ru_maxrss) / 1024.0);
+    }
+} report;
+
+}
+
+
+
+extern "C" {
+
+void* malloc(size_t n) {
+    Timer timer(false, n);
+    return __libc_malloc(n);
+}
+void* calloc(size_t n, size_t size) {
+    Timer timer(false, n * size);
+    return __libc_calloc(n, size);
+}
+void* realloc(void* p, size_t n) {
+    Timer timer(false, n);
+    return __libc_realloc(p, n);
+}
+void* memalign(size_t align, size_t n) {
+    Timer timer(false, n);
+    return __libc_memalign(align, n);
+}
+void* aligned_alloc(size_t align, size_t n) {
+    Timer timer(false, n);
+    return __libc_memalign(align, n);
+}
+int posix_memalign(void** p, size_t align, size_t n) {
+    Timer timer(false, n);
+    void* mem = __libc_memalign(align, n);
+    if (mem == nullptr) return ENOMEM;
+    *p = mem;
+    return 0;
+}
+void free(void* p) {
+    if (p == nullptr) return;
+    Timer timer(true, 0);
+    __libc_free(p);
+    return;
+}
+
+}
@@ -0,0 +1,389 @@
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ Microbenchmarks for the parts of the simulations that take the most time.
+
+ Usage:
+     bench_kernels [--label <text>] [--stages 24,48,80] [--lines 1,4]
+                   [--patches 1,8] [--min-time <seconds>]
+
+ Results go to stdout as CSV with one row per kernel and combination of
+ # stages, lines, and patches:
+     label,kernel,n_stages,n_lines,n_patches,iters,ns_min,ns_median
+ Times are nanoseconds per call (min and median across 5 runs).
+ Use `--label` (e.g., a git commit) to combine results from different versions.
+
+ Kernels that change the state they work on (e.g., `aphid_update_*`) are
+ timed on a copy that's reset before every call, and the time to reset it
+ is subtracted.
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include <iostream>             // cout, cerr
+#include <string>               // string class
+#include <vector>               // vector class
+#include <sstream>              // string streams
+#include <chrono>               // steady_clock
+#include <algorithm>            // sort
+#include <stdexcept>            // runtime_error
+#include <pcg/pcg_random.hpp>   // pcg prng
+#include "rcpp_compat.hpp"      // arma namespace
+#include "clonewars_types.hpp"  // integer types
+#include "aphids.hpp"           // aphid classes
+#include "wasps.hpp"            // wasp classes
+#include "patches.hpp"          // patch classes
+#include "arena.hpp"            // arena_vector, RepArena
+#include "stages.hpp"           // stage_limits, stage_limit
+#include "rep_summary.hpp"      // RepSummary
+
+
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Stops the compiler from removing calls whose results aren't used:
+static volatile double sink = 0;
+
+
+struct BenchOptions {
+    std::string label = "";
+    std::vector<uint32> stages = {24, 48, 80};
+    std::vector<uint32> lines = {1, 4};
+    std::vector<uint32> patches = {1, 8};
+    double min_time = 0.1;
+};
+
+
+
+/*
+ Time `kernel` (after calling `reset` each time) and subtract the time for
+ `reset` alone.
+ The # iterations is increased until one run takes at least `min_time`
+ seconds, then 5 runs are done.
+ */
+template <typename R, typename K>
+void time_kernel__(const std::string& name,
+                   const BenchOptions& opts,
+                   const uint32& n_stages,
+                   const uint32& n_lines,
+                   const uint32& n_patches,
+                   R reset,
+                   K kernel,
+                   const uint64& max_iters = 1ULL << 30) {
+
+    auto run = [&](const uint64& iters, const bool& with_kernel) {
+        bench_clock::time_point t0 = bench_clock::now();
+        for (uint64 i = 0; i < iters; i++) {
+            reset();
+            if (with_kernel) kernel();
+        }
+        return std::chrono::duration<double>(bench_clock::now() - t0).count();
+    };
+
+    uint64 iters = 16;
+    while (iters < max_iters && run(iters, true) < opts.min_time) iters *= 2;
+    if (iters > max_iters) iters = max_iters;
+
+    std::vector<double> ns(5);
+    for (double& x : ns) {
+        double with = run(iters, true);
+        double without = run(iters, false);
+        x = 1e9 * std::max(with - without, 0.0) / static_cast<double>(iters);
+    }
+    std::sort(ns.begin(), ns.end());
+
+    std::cout << opts.label << ',' << name << ',' << n_stages << ',' << n_lines <<
+        ',' << n_patches << ',' << iters << ',' << ns.front() << ',' << ns[2] <<
+        std::endl;
+
+    return;
+}
+
+
+
+/*
+ Make a cage with made-up (but plausible) parameters, and simulate it for a
+ few days so that all stages have aphids.
+ `leslie_mat` is filled here and must outlive the cage.
+ */
+OneCage make_cage__(const uint32& n_stages,
+                    const uint32& n_lines,
+                    const uint32& n_patches,
+                    const bool& stochastic,
+                    std::vector<arma::cube>& leslie_mat,
+                    pcg32& eng) {
+
+    std::vector<std::string> aphid_name;
+    leslie_mat.clear();
+    for (uint32 i = 0; i < n_lines; i++) {
+        aphid_name.push_back("line" + std::to_string(i));
+        arma::cube L(n_stages, n_stages, 3, arma::fill::zeros);
+        for (uint32 s = 0; s < 3; s++) {
+            for (uint32 j = 1; j < n_stages; j++) L(j, j-1, s) = 0.95 - 0.01 * i;
+            L(n_stages-1, n_stages-1, s) = 0.9;
+            if (s < 2) {
+                for (uint32 j = (2 * n_stages) / 3; j < n_stages; j++) {
+                    L(0, j, s) = s == 0 ? 3.0 : 2.0;
+                }
+            }
+        }
+        leslie_mat.push_back(L);
+    }
+
+    std::vector<arma::cube> aphid_density_0;
+    for (uint32 j = 0; j < n_patches; j++) {
+        arma::cube X0(n_stages, 2, n_lines, arma::fill::zeros);
+        for (uint32 i = 0; i < n_lines; i++) X0(n_stages / 2, 0, i) = 10;
+        aphid_density_0.push_back(X0);
+    }
+
+    arma::mat attack_surv(2, n_lines, arma::fill::zeros);
+    arma::mat mum_density_0(10, n_patches, arma::fill::zeros);
+    arma::vec rel_attack(n_stages, arma::fill::ones);
+    rel_attack /= static_cast<double>(n_stages);
+
+    const double sigma = stochastic ? 0.2 : 0;
+    const double demog_mult = stochastic ? 1 : 0;
+
+    OneCage cage(sigma, sigma, 0.5, demog_mult, 1800, 0, 1, 0.8, 1, 0,
+                 attack_surv, aphid_name, leslie_mat, aphid_density_0,
+                 std::vector<double>(n_lines, -2), std::vector<double>(n_lines, 0.0005),
+                 std::vector<double>(n_lines, 0.1), std::vector<double>(n_lines, 0.1),
+                 std::vector<uint32>(n_lines, (2 * n_stages) / 3),
+                 std::vector<uint32>(n_lines, 20),
+                 std::vector<double>(n_patches, 0.01), 1, mum_density_0, 0,
+                 rel_attack, 2.3, 0.4, 0.03, 0, 0.5, 0.9, eng);
+    cage.wasps.Y = 1;
+
+    for (uint32 t = 0; t < 30; t++) {
+        cage.calc_dispersal<false>(eng);
+        cage.update<false, 0>(eng);
+    }
+
+    return cage;
+}
+
+
+// Call `AphidPop::update` with the right compile-time limit on # stages:
+template <bool proc_error>
+inline double aphid_update__(AphidPop& ap,
+                             const OnePatch& patch,
+                             const WaspPop& wasps,
+                             const arma::vec& zeros,
+                             pcg32& eng) {
+    switch (stage_limit(zeros.n_elem)) {
+    case stage_limits::up_to_32:
+        return ap.update<proc_error, stage_limits::up_to_32>(&patch, &wasps, zeros, zeros,
+                                                             eng);
+    case stage_limits::up_to_64:
+        return ap.update<proc_error, stage_limits::up_to_64>(&patch, &wasps, zeros, zeros,
+                                                             eng);
+    default:
+        return ap.update<proc_error, 0>(&patch, &wasps, zeros, zeros, eng);
+    }
+}
+
+
+
+void bench_all__(const BenchOptions& opts,
+                 const uint32& n_stages,
+                 const uint32& n_lines,
+                 const uint32& n_patches) {
+
+    pcg32 eng(42, 54);
+
+    std::vector<arma::cube> leslie_det, leslie_sto;
+    OneCage det_cage = make_cage__(n_stages, n_lines, n_patches, false,
+                                   leslie_det, eng);
+    OneCage sto_cage = make_cage__(n_stages, n_lines, n_patches, true,
+                                   leslie_sto, eng);
+    det_cage.wasps.x = 0;
+    for (uint32 j = 0; j < det_cage.size(); j++) {
+        det_cage.wasps.x += det_cage[j].total_unpar_aphids();
+    }
+    sto_cage.wasps.x = det_cage.wasps.x;
+
+    const arma::vec zeros(n_stages, arma::fill::zeros);
+
+    {
+        const OnePatch& patch(det_cage[0]);
+        AphidPop ap(patch[0]);
+        time_kernel__("aphid_update_det", opts, n_stages, n_lines, n_patches,
+                      [&]() { ap = patch[0]; },
+                      [&]() {
+                          sink += aphid_update__<false>(ap, patch, det_cage.wasps,
+                                                        zeros, eng);
+                      });
+    }
+    {
+        const OnePatch& patch(sto_cage[0]);
+        AphidPop ap(patch[0]);
+        time_kernel__("aphid_update_stoch", opts, n_stages, n_lines, n_patches,
+                      [&]() { ap = patch[0]; },
+                      [&]() {
+                          sink += aphid_update__<true>(ap, patch, sto_cage.wasps,
+                                                       zeros, eng);
+                      });
+    }
+    {
+        const OnePatch& patch(sto_cage[0]);
+        ApterousPop apt(patch[0].apterous);
+        std::normal_distribution<double> norm_distr(0, 1);
+        time_kernel__("process_error", opts, n_stages, n_lines, n_patches,
+                      [&]() { apt.X = patch[0].apterous.X; },
+                      [&]() {
+                          apt.process_error(patch.z, 0.2, 0.5, 1, norm_distr, eng);
+                          sink += apt.X(0);
+                      });
+    }
+    for (const bool disp_error : {false, true}) {
+        const OneCage& cage(disp_error ? sto_cage : det_cage);
+        const OnePatch& patch(cage[0]);
+        arma::mat emigrants(n_stages, n_patches, arma::fill::zeros);
+        arma::mat immigrants(n_stages, n_patches, arma::fill::zeros);
+        time_kernel__(disp_error ? "calc_dispersal_stoch" : "calc_dispersal_det",
+                      opts, n_stages, n_lines, n_patches,
+                      []() {},
+                      [&]() {
+                          if (disp_error) {
+                              sink += patch[0].calc_dispersal<true>(&patch, emigrants,
+                                                                    immigrants, eng);
+                          } else {
+                              sink += patch[0].calc_dispersal<false>(&patch, emigrants,
+                                                                     immigrants, eng);
+                          }
+                      });
+    }
+    {
+        const OnePatch& patch(det_cage[0]);
+        time_kernel__("carrying_capacity", opts, n_stages, n_lines, n_patches,
+                      []() {},
+                      [&]() { sink += patch.carrying_capacity(); });
+    }
+    {
+        arma::vec rel_attack(n_stages, arma::fill::ones);
+        rel_attack /= static_cast<double>(n_stages);
+        const WaspAttack attack(rel_attack, 2.3, 0.4, 0.03);
+        arma::vec attack_surv(2);
+        attack_surv(0) = 0.1;
+        attack_surv(1) = 0.05;
+        std::vector<double> out(n_stages);
+        time_kernel__("wasp_attack_A", opts, n_stages, n_lines, n_patches,
+                      []() {},
+                      [&]() {
+                          attack.A(1, 500, attack_surv, out.data());
+                          sink += out[0];
+                      });
+    }
+    {
+        MummyPop mummies(arma::vec(9, arma::fill::ones));
+        time_kernel__("mummy_update", opts, n_stages, n_lines, n_patches,
+                      []() {},
+                      [&]() {
+                          mummies.update(0.01, 1);
+                          sink += mummies.total_mummies();
+                      });
+    }
+    for (const bool partial : {false, true}) {
+        OneCage cage(det_cage);
+        double max_N = 0;
+        for (uint32 j = 0; j < det_cage.size(); j++) max_N += det_cage[j].total_aphids();
+        max_N /= (2.0 * det_cage.size());
+        time_kernel__(partial ? "clear_patches_partial" : "clear_patches",
+                      opts, n_stages, n_lines, n_patches,
+                      [&]() { cage = det_cage; },
+                      [&]() {
+                          if (partial) {
+                              cage.clear_patches<true>(max_N, 0.5, eng);
+                          } else cage.clear_patches<false>(max_N, 0, eng);
+                      });
+    }
+    {
+        OneCage cage(det_cage);
+        time_kernel__("cage_step_det", opts, n_stages, n_lines, n_patches,
+                      [&]() { cage = det_cage; },
+                      [&]() {
+                          cage.calc_dispersal<false>(eng);
+                          cage.update<false, 0>(eng);
+                      });
+    }
+    {
+        arena_vector<OneCage> cages;
+        cages.push_back(det_cage);
+        // Keep output to about a million rows:
+        const uint64 rows = 2 * n_patches * n_lines + n_patches;
+        const uint64 max_iters = std::max(1000000ULL / rows, 1ULL);
+        RepSummary summary;
+        summary.reserve(0, max_iters + 1, n_lines, 1, n_patches);
+        uint32 t = 0;
+        time_kernel__("rep_summary_push_back", opts, n_stages, n_lines, n_patches,
+                      [&]() {
+                          if (summary.N.size() + rows > summary.N.capacity()) {
+                              summary.clear();
+                              summary.reserve(0, max_iters + 1, n_lines, 1, n_patches);
+                          }
+                      },
+                      [&]() { summary.push_back(t++, cages); },
+                      max_iters);
+    }
+
+    return;
+}
+
+
+
+std::vector<uint32> parse_uints__(const std::string& x) {
+    std::vector<uint32> out;
+    std::stringstream ss(x);
+    std::string item;
+    while (std::getline(ss, item, ',')) out.push_back(std::stoul(item));
+    if (out.empty()) throw std::runtime_error("empty list of numbers");
+    return out;
+}
+
+
+int main(int argc, char* argv[]) {
+
+    BenchOptions opts;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg(argv[i]);
+            if (i + 1 >= argc) throw std::runtime_error("missing value for " + arg);
+            std::string val(argv[++i]);
+            if (arg == "--label") {
+                opts.label = val;
+            } else if (arg == "--stages") {
+                opts.stages = parse_uints__(val);
+            } else if (arg == "--lines") {
+                opts.lines = parse_uints__(val);
+            } else if (arg == "--patches") {
+                opts.patches = parse_uints__(val);
+            } else if (arg == "--min-time") {
+                opts.min_time = std::stod(val);
+            } else throw std::runtime_error("unknown argument " + arg);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "label,kernel,n_stages,n_lines,n_patches,iters,ns_min,ns_median" <<
+        std::endl;
+
+    for (const uint32& s : opts.stages) {
+        for (const uint32& l : opts.lines) {
+            for (const uint32& p : opts.patches) {
+                bench_all__(opts, s, l, p);
+                // Everything from this combination is gone now:
+                RepArena::local().reset();
+            }
+        }
+    }
+
+    RepArena::local().release();
+
+    return 0;
+}
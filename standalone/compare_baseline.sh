@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Compares the engine in `src` with the one from before the speed changes
+# (commit 3ddfa74, or the commit given as the first argument) by running the
+# same cages through both using `dump_states.cpp`, then comparing every value
+# on every day.
+#
+#     ./compare_baseline.sh [commit] > baseline.csv
+#
+# Output is CSV with one row per cage:
+#     n_stages,n_lines,n_patches,stochastic,clear_every,seed,days_baseline,
+#     days_now,n_values,n_differ,max_rel_diff,first_day
+# The exit status is 1 if any cage didn't last the same # days in both or
+# differs by more than rounding (`max_rel_diff` > 1e-12).
+# Sums now done in a different order (e.g., cached totals) make differences
+# of a few ULPs, so `n_differ` isn't usually zero.
+#
+# The old version's `src` is taken from git into a temporary folder.
+# Its `PatchClearingInfo` copy constructor didn't copy `wilted`, so which
+# patches got cleared could depend on uninitialized memory; that's fixed in
+# the copy so that both versions clear the same patches.
+#
+# Uses the same CXX, CPPFLAGS, CXXFLAGS, and LIBS as the Makefile.
+
+set -e
+
+BASE=${1:-3ddfa74}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2 -g}
+LIBS=${LIBS:--larmadillo -llapack -lblas}
+HERE=$(cd "$(dirname "$0")" && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+git -C "$HERE/.." archive "$BASE" src | tar -x -C "$TMP"
+sed 's/: ind(other.ind), N(other.N), thresh_info/: ind(other.ind), N(other.N), wilted(other.wilted), thresh_info/' \
+    "$TMP/src/patches.hpp" > "$TMP/patches.hpp"
+mv "$TMP/patches.hpp" "$TMP/src/patches.hpp"
+
+# The old version includes RcppArmadillo everywhere:
+mkdir "$TMP/include"
+cat > "$TMP/include/RcppArmadillo.h" << EOF
+#ifndef __CLONEWARS_BASELINE_SHIM_H
+#define __CLONEWARS_BASELINE_SHIM_H
+#include "$HERE/../src/rcpp_compat.hpp"
+#include <vector>
+#include <stdexcept>
+namespace Rcpp {
+    // Only used to seed from R's RNG:
+    inline std::vector<double> runif(int, double, double) {
+        throw std::runtime_error("no R RNG");
+    }
+    template <typename T> T as(const std::vector<double>& x) {
+        return T(x.begin(), x.end());
+    }
+}
+using namespace Rcpp;
+#endif
+EOF
+
+make -C "$HERE" -s libclonewars.a
+$CXX -std=c++11 $CPPFLAGS -DCLONEWARS_STANDALONE -I"$HERE/../src" -I"$HERE/../inst/include" \
+    $CXXFLAGS -o "$TMP/dump_now" "$HERE/dump_states.cpp" "$HERE/libclonewars.a" $LIBS
+$CXX -std=c++11 $CPPFLAGS -DCLONEWARS_STANDALONE -DCLONEWARS_BASELINE -I"$TMP/include" \
+    -I"$TMP/src" -I"$HERE/../inst/include" $CXXFLAGS -o "$TMP/dump_base" \
+    "$HERE/dump_states.cpp" "$TMP/src/aphids.cpp" "$TMP/src/patches.cpp" $LIBS
+
+echo "n_stages,n_lines,n_patches,stochastic,clear_every,seed,days_baseline,days_now,n_values,n_differ,max_rel_diff,first_day"
+
+status=0
+for cage in "20 1 1" "20 3 6" "40 1 1" "40 3 6" "70 2 4"; do
+    for stochastic in 0 1; do
+        for clear_every in 0 25; do
+            for seed in 11 12; do
+                "$TMP/dump_base" $cage $stochastic 150 $clear_every $seed > "$TMP/base.txt"
+                "$TMP/dump_now" $cage $stochastic 150 $clear_every $seed > "$TMP/now.txt"
+                row=$("$TMP/dump_now" compare "$TMP/base.txt" "$TMP/now.txt") || status=1
+                echo "$(echo $cage | tr ' ' ','),$stochastic,$clear_every,$seed,$row"
+                echo "$row" | awk -F, '$1 != $2 || $5 > 1e-12 { exit 1 }' || status=1
+            done
+        done
+    done
+done
+
+exit $status
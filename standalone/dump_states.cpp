@@ -0,0 +1,296 @@
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ Prints the full state of a cage after every day, so that two versions of the
+ engine can be compared value by value (see `compare_baseline.sh`).
+
+ Usage:
+     dump_states <n_stages> <n_lines> <n_patches> <stochastic> <days>
+                 <clear_every> <seed>
+     dump_states compare <file1> <file2>
+
+ The cage has the same made-up parameters as in `verify_engine`.
+ If `stochastic` is 1, it has process error and dispersal, demographic, and
+ environmental stochasticity; if 0, it has none.
+ Every `clear_every` days (never if 0), patches older than 20 days are
+ cleared, with 10% of aphids and mummies surviving.
+ Like in `one_rep__`, the run stops early if all patches are empty.
+
+ Each day is one line: the day, then for each patch the abundances of
+ apterous, alate, and parasitized aphids for each line, the mummies,
+ whether it's empty, whether it's wilted, and its age, then adult wasps and
+ the # unparasitized aphids they attacked.
+ Numbers are hex floats, so nothing is lost.
+
+ `compare` prints one line of CSV:
+     days_1,days_2,n_values,n_differ,max_rel_diff,first_day
+ It exits with status 1 if the files don't have the same shape.
+
+ Compiling with `-DCLONEWARS_BASELINE` builds this against the engine from
+ before the speed changes (see `compare_baseline.sh`), which had separate
+ deterministic and stochastic updates and no compile-time stage counts.
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include <cstdio>               // printf
+#include <iostream>             // cout, cerr
+#include <fstream>              // ifstream
+#include <sstream>              // string streams
+#include <string>               // string class
+#include <vector>               // vector class
+#include <cmath>                // abs
+#include <algorithm>            // max
+#include <stdexcept>            // runtime_error
+#include <pcg/pcg_random.hpp>   // pcg prng
+#ifndef CLONEWARS_BASELINE
+#include "rcpp_compat.hpp"      // arma namespace
+#include "stages.hpp"           // stage_limits, stage_limit
+#endif
+#include "clonewars_types.hpp"  // integer types
+#include "patches.hpp"          // patch classes
+
+
+
+void print_vec__(const arma::vec& x) {
+    for (uint32 i = 0; i < x.n_elem; i++) std::printf(" %a", x(i));
+    return;
+}
+
+void print_state__(const OneCage& cage, const uint32& t) {
+    std::printf("%u", static_cast<unsigned>(t));
+    for (uint32 j = 0; j < cage.size(); j++) {
+        const OnePatch& p(cage[j]);
+        for (uint32 i = 0; i < p.size(); i++) {
+            print_vec__(p[i].apterous.X);
+            print_vec__(p[i].alates.X);
+            print_vec__(p[i].paras.X);
+        }
+        print_vec__(p.mummies.Y);
+        std::printf(" %d %d %u", static_cast<int>(p.empty),
+                    static_cast<int>(p.wilted()), static_cast<unsigned>(p.age));
+    }
+    std::printf(" %a %a\n", cage.wasps.Y, cage.wasps.x);
+    return;
+}
+
+
+// Same parameters as `Scenario` in `verify_engine.cpp`
+OneCage make_cage__(const uint32& n_stages,
+                    const uint32& n_lines,
+                    const uint32& n_patches,
+                    const bool& stochastic,
+                    pcg32& eng) {
+
+    const uint32 adult = n_stages / 3;
+
+    arma::mat attack_surv(2, n_lines, arma::fill::zeros);
+    std::vector<std::string> aphid_name;
+    std::vector<arma::cube> leslie_mat;
+    std::vector<arma::cube> aphid_density_0;
+    std::vector<double> disp_rate;
+    std::vector<double> disp_mort;
+    std::vector<double> pred_rate;
+
+    for (uint32 i = 0; i < n_lines; i++) {
+        aphid_name.push_back("line" + std::to_string(i));
+        const double surv_juv = 0.97 - 0.02 * (i % 3);
+        const double repro = 4.0 - (i % 3);
+        arma::cube L(n_stages, n_stages, 3, arma::fill::zeros);
+        for (uint32 s = 0; s < 3; s++) {
+            for (uint32 j = 1; j < n_stages; j++) {
+                L(j, j-1, s) = (j <= adult) ? surv_juv : 0.9;
+            }
+            if (s < 2) {
+                for (uint32 j = adult; j < n_stages; j++) {
+                    L(0, j, s) = (s == 0) ? repro : (0.6 * repro);
+                }
+            }
+        }
+        leslie_mat.push_back(L);
+        if (i % 2 == 1) {
+            attack_surv(0, i) = 0.5;
+            attack_surv(1, i) = 0.1;
+        }
+        disp_rate.push_back(0.1 + 0.1 * (i % 3));
+        disp_mort.push_back((i % 2 == 0) ? 0.1 : 0);
+    }
+
+    for (uint32 j = 0; j < n_patches; j++) {
+        arma::cube X0(n_stages, 2, n_lines, arma::fill::zeros);
+        for (uint32 i = 0; i < n_lines; i++) {
+            if (n_patches > 1 && (i + j) % 2 == 1) continue;
+            X0(adult, 0, i) = (i == 2 && j == 0) ? 0.5 : 10;
+            X0(adult + 1, 1, i) = 2;
+        }
+        aphid_density_0.push_back(X0);
+        pred_rate.push_back(0.01 * (j % 3));
+    }
+
+    arma::mat mum_density_0(7, n_patches, arma::fill::zeros);
+    mum_density_0.col(0).fill(1);
+
+    arma::vec rel_attack(n_stages);
+    for (uint32 i = 0; i < n_stages; i++) rel_attack(i) = i + 1;
+    rel_attack /= arma::accu(rel_attack);
+
+    return OneCage(stochastic ? 0.2 : 0, stochastic ? 0.2 : 0, 0.5,
+                   stochastic ? 1 : 0, 1800, 600, 1 / 1.57, 0.25, 3.7, 5.8,
+                   attack_surv, aphid_name, leslie_mat, aphid_density_0,
+                   std::vector<double>(n_lines, -3),
+                   std::vector<double>(n_lines, 0.001),
+                   disp_rate, disp_mort, std::vector<uint32>(n_lines, adult),
+                   std::vector<uint32>(n_lines, 8), pred_rate, 1,
+                   mum_density_0, 1000, rel_attack, 2.3, 0.4, 0.03, 2, 0.5, 0.8,
+                   eng);
+}
+
+
+// One day, the same way as in `one_rep__` (see `simulations.cpp`)
+void step__(OneCage& cage, const bool& stochastic, pcg32& eng) {
+#ifdef CLONEWARS_BASELINE
+    if (stochastic) {
+        cage.calc_dispersal(eng);
+        cage.update(eng);
+    } else {
+        cage.calc_dispersal();
+        cage.update();
+    }
+#else
+    if (stochastic) {
+        cage.calc_dispersal<true>(eng);
+    } else cage.calc_dispersal<false>(eng);
+    switch (stage_limit(cage.emigrants.n_rows)) {
+    case stage_limits::up_to_32:
+        if (stochastic) {
+            cage.update<true, stage_limits::up_to_32>(eng);
+        } else cage.update<false, stage_limits::up_to_32>(eng);
+        break;
+    case stage_limits::up_to_64:
+        if (stochastic) {
+            cage.update<true, stage_limits::up_to_64>(eng);
+        } else cage.update<false, stage_limits::up_to_64>(eng);
+        break;
+    default:
+        if (stochastic) {
+            cage.update<true, 0>(eng);
+        } else cage.update<false, 0>(eng);
+    }
+#endif
+    return;
+}
+
+void clear__(OneCage& cage, pcg32& eng) {
+#ifdef CLONEWARS_BASELINE
+    cage.clear_patches(static_cast<uint32>(20), 0.1, eng);
+#else
+    cage.clear_patches<true>(static_cast<uint32>(20), 0.1, eng);
+#endif
+    return;
+}
+
+
+
+std::vector<std::vector<std::string>> read_states__(const std::string& fn) {
+    std::ifstream in(fn);
+    if (!in) throw std::runtime_error("can't open " + fn);
+    std::vector<std::vector<std::string>> out;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::stringstream ss(line);
+        std::vector<std::string> values;
+        std::string v;
+        while (ss >> v) values.push_back(v);
+        out.push_back(values);
+    }
+    return out;
+}
+
+// Returns false if the files don't have the same shape
+bool compare__(const std::string& fn1, const std::string& fn2) {
+
+    const std::vector<std::vector<std::string>> s1 = read_states__(fn1);
+    const std::vector<std::vector<std::string>> s2 = read_states__(fn2);
+
+    bool same_shape = s1.size() == s2.size();
+    uint64 n_values = 0, n_differ = 0;
+    double max_rel = 0;
+    sint64 first_day = -1;
+
+    for (uint32 t = 0; t < std::min(s1.size(), s2.size()); t++) {
+        if (s1[t].size() != s2[t].size()) {
+            same_shape = false;
+            break;
+        }
+        for (uint32 i = 0; i < s1[t].size(); i++) {
+            n_values++;
+            if (s1[t][i] == s2[t][i]) continue;
+            n_differ++;
+            if (first_day < 0) first_day = t;
+            const double x = std::stod(s1[t][i]);
+            const double y = std::stod(s2[t][i]);
+            const double m = std::max(std::abs(x), std::abs(y));
+            if (m > 0) max_rel = std::max(max_rel, std::abs(x - y) / m);
+        }
+    }
+
+    std::cout << s1.size() - 1 << ',' << s2.size() - 1 << ',' << n_values << ',' <<
+        n_differ << ',' << max_rel << ',';
+    if (first_day < 0) {
+        std::cout << "NA";
+    } else std::cout << first_day;
+    std::cout << std::endl;
+
+    return same_shape;
+}
+
+
+
+int main(int argc, char* argv[]) {
+
+    try {
+
+        if (argc == 4 && std::string(argv[1]) == "compare") {
+            return compare__(argv[2], argv[3]) ? 0 : 1;
+        }
+        if (argc != 8) throw std::runtime_error("wrong # arguments (see top of dump_states.cpp)");
+
+        const uint32 n_stages = std::stoul(argv[1]);
+        const uint32 n_lines = std::stoul(argv[2]);
+        const uint32 n_patches = std::stoul(argv[3]);
+        const bool stochastic = std::stoul(argv[4]) != 0;
+        const uint32 days = std::stoul(argv[5]);
+        const uint32 clear_every = std::stoul(argv[6]);
+        const uint64 seed = std::stoull(argv[7]);
+        if (n_stages < 4) throw std::runtime_error("n_stages must be >= 4");
+        if (n_lines == 0 || n_patches == 0) {
+            throw std::runtime_error("n_lines and n_patches must be >= 1");
+        }
+
+        pcg32 eng(seed, 7);
+        OneCage cage = make_cage__(n_stages, n_lines, n_patches, stochastic, eng);
+        print_state__(cage, 0);
+
+        for (uint32 t = 1; t <= days; t++) {
+            step__(cage, stochastic, eng);
+            print_state__(cage, t);
+            bool all_empty = true;
+            for (uint32 j = 0; j < cage.size(); j++) {
+                if (!cage[j].empty) {
+                    all_empty = false;
+                    break;
+                }
+            }
+            if (all_empty) break;
+            if (clear_every > 0 && t % clear_every == 0) clear__(cage, eng);
+        }
+
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
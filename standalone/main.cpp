@@ -0,0 +1,322 @@
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ Runs simulations without R.
+
+ Usage:
+     clonewars <config file> <output prefix>
+
+ The config file is written by `sim_clonewars(standalone_config = ...)` in R
+ (see `README.md` in this folder for its format).
+ Output goes to `<output prefix>_aphids.csv` and `<output prefix>_wasps.csv`
+ (which only have headers if the config has a `store_file`),
+ plus `<output prefix>_events.csv` for sparse output and
+ `<output prefix>_snapshot_<rep>.bin` when saving snapshots.
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include <iostream>             // cerr
+#include <fstream>              // file streams
+#include <sstream>              // string streams
+#include <string>               // string class
+#include <vector>               // vector class
+#include <deque>                // deque
+#include <map>                  // map
+#include <stdexcept>            // runtime_error
+#include "rcpp_compat.hpp"      // arma namespace, standalone_rng
+#include "clonewars_types.hpp"  // integer types
+#include "simulations.hpp"      // SimOutput, sim_clonewars__
+#include "phase_timer.hpp"      // phase::names
+
+
+
+/*
+ Each line of the config file is a name followed by its values, separated by
+ whitespace.
+ Names can be repeated for arguments that are lists of arrays (one line per
+ array).
+ Lines starting with `#` are ignored.
+ */
+class Config {
+
+    std::map<std::string, std::vector<std::vector<std::string>>> values;
+
+    const std::vector<std::string>& line__(const std::string& name) const {
+        auto iter = values.find(name);
+        if (iter == values.end() || iter->second.empty()) {
+            throw std::runtime_error("config is missing `" + name + "`");
+        }
+        return iter->second.front();
+    }
+    const std::vector<std::string>& one__(const std::string& name) const {
+        const std::vector<std::string>& x(line__(name));
+        if (x.size() != 1) {
+            throw std::runtime_error("config `" + name + "` should have one value");
+        }
+        return x;
+    }
+
+    static double dbl__(const std::string& x, const std::string& name) {
+        try {
+            return std::stod(x);
+        } catch (const std::exception&) {
+            throw std::runtime_error("config `" + name + "` has a value that " +
+                                     "isn't a number (" + x + ")");
+        }
+    }
+    static uint32 uint__(const std::string& x, const std::string& name) {
+        double d = dbl__(x, name);
+        if (d < 0) {
+            throw std::runtime_error("config `" + name + "` has a negative value");
+        }
+        return static_cast<uint32>(d);
+    }
+
+    /*
+     Arrays are stored as their dimensions followed by values
+     (in column-major order, like R and Armadillo).
+     */
+    static arma::cube cube__(const std::vector<std::string>& x,
+                             const std::string& name,
+                             const uint32& n_dims) {
+        if (x.size() < n_dims) {
+            throw std::runtime_error("config `" + name + "` is missing dimensions");
+        }
+        uint32 nr = uint__(x[0], name);
+        uint32 nc = n_dims > 1 ? uint__(x[1], name) : 1;
+        uint32 ns = n_dims > 2 ? uint__(x[2], name) : 1;
+        if (x.size() != n_dims + nr * nc * ns) {
+            throw std::runtime_error("config `" + name + "` has the wrong number " +
+                                     "of values for its dimensions");
+        }
+        arma::cube out(nr, nc, ns);
+        for (uint32 i = 0; i < out.n_elem; i++) out(i) = dbl__(x[n_dims + i], name);
+        return out;
+    }
+
+public:
+
+    Config(const std::string& fn) : values() {
+        std::ifstream in(fn);
+        if (!in.is_open()) throw std::runtime_error("can't open " + fn);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream ss(line);
+            std::string name, x;
+            if (!(ss >> name) || name[0] == '#') continue;
+            std::vector<std::string> vals;
+            while (ss >> x) vals.push_back(x);
+            values[name].push_back(vals);
+        }
+    }
+
+    double dbl(const std::string& name) const {
+        return dbl__(one__(name).front(), name);
+    }
+    uint32 uint(const std::string& name) const {
+        return uint__(one__(name).front(), name);
+    }
+    bool lgl(const std::string& name) const {
+        return uint(name) != 0;
+    }
+    // Strings can't contain whitespace; an empty string has no values.
+    std::string str(const std::string& name) const {
+        const std::vector<std::string>& x(line__(name));
+        if (x.size() > 1) {
+            throw std::runtime_error("config `" + name + "` should have one value");
+        }
+        return x.empty() ? std::string("") : x.front();
+    }
+    std::vector<std::string> strs(const std::string& name) const {
+        return line__(name);
+    }
+    std::vector<double> dbls(const std::string& name) const {
+        const std::vector<std::string>& x(line__(name));
+        std::vector<double> out;
+        out.reserve(x.size());
+        for (const std::string& y : x) out.push_back(dbl__(y, name));
+        return out;
+    }
+    std::vector<uint32> uints(const std::string& name) const {
+        const std::vector<std::string>& x(line__(name));
+        std::vector<uint32> out;
+        out.reserve(x.size());
+        for (const std::string& y : x) out.push_back(uint__(y, name));
+        return out;
+    }
+    arma::vec vec(const std::string& name) const {
+        arma::cube c = cube__(line__(name), name, 1);
+        arma::vec out(c.n_elem);
+        for (uint32 i = 0; i < c.n_elem; i++) out(i) = c(i);
+        return out;
+    }
+    arma::mat mat(const std::string& name) const {
+        arma::cube c = cube__(line__(name), name, 2);
+        return c.slice(0);
+    }
+    // For arguments that are lists of 3D arrays:
+    std::vector<arma::cube> cubes(const std::string& name) const {
+        line__(name);  // to check that it exists
+        std::vector<arma::cube> out;
+        for (const std::vector<std::string>& x : values.at(name)) {
+            out.push_back(cube__(x, name, 3));
+        }
+        return out;
+    }
+
+};
+
+
+
+
+void write_output__(const std::string& prefix, const SimOutput& output) {
+
+    std::ofstream aphids(prefix + "_aphids.csv");
+    if (!aphids.is_open()) throw std::runtime_error("can't write " + prefix + "_aphids.csv");
+    aphids.precision(17);
+    aphids << "rep,time,cage,patch,line,type,N\n";
+    for (uint32 i = 0; i < output.N.size(); i++) {
+        aphids << output.rep[i] << ',' << output.time[i] << ',' << output.cage[i] <<
+            ',' << output.patch[i] << ',' << output.line[i] << ',' <<
+            output.type[i] << ',' << output.N[i] << '\n';
+    }
+    aphids.close();
+
+    std::ofstream wasps(prefix + "_wasps.csv");
+    if (!wasps.is_open()) throw std::runtime_error("can't write " + prefix + "_wasps.csv");
+    wasps.precision(17);
+    wasps << "rep,time,cage,wasps\n";
+    for (uint32 i = 0; i < output.wasp_N.size(); i++) {
+        wasps << output.wasp_rep[i] << ',' << output.wasp_time[i] << ',' <<
+            output.wasp_cage[i] << ',' << output.wasp_N[i] << '\n';
+    }
+    wasps.close();
+
+    bool events_failed = false;
+    if (output.sparse) {
+        std::ofstream events(prefix + "_events.csv");
+        if (!events.is_open()) throw std::runtime_error("can't write " + prefix + "_events.csv");
+        events << "rep,time,cage,patch,line,event\n";
+        for (uint32 i = 0; i < output.event_time.size(); i++) {
+            events << output.event_rep[i] << ',' << output.event_time[i] << ',' <<
+                output.event_cage[i] << ',' << output.event_patch[i] << ',' <<
+                output.event_line[i] << ',' << output.event_type[i] << '\n';
+        }
+        events.close();
+        events_failed = events.fail();
+    }
+
+    bool summary_failed = false;
+    if (!output.summary_probs.empty()) {
+        std::ofstream summary(prefix + "_summary.csv");
+        if (!summary.is_open()) throw std::runtime_error("can't write " + prefix + "_summary.csv");
+        summary << "time,cage,line,type,n,mean";
+        for (const double& p : output.summary_probs) summary << ",q" << p * 100;
+        summary << '\n';
+        summary.precision(17);
+        for (uint32 i = 0; i < output.summary_time.size(); i++) {
+            summary << output.summary_time[i] << ',' << output.summary_cage[i] << ',' <<
+                output.summary_line[i] << ',' << output.summary_type[i] << ',' <<
+                output.summary_n[i] << ',' << output.summary_mean[i];
+            for (const std::vector<double>& q : output.summary_quantiles) summary << ',' << q[i];
+            summary << '\n';
+        }
+        summary.close();
+        summary_failed = summary.fail();
+    }
+
+    for (uint32 i = 0; i < output.snapshots.size(); i++) {
+        std::string fn = prefix + "_snapshot_" + std::to_string(i) + ".bin";
+        std::ofstream snap(fn, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!snap.is_open()) throw std::runtime_error("can't write " + fn);
+        snap.write(output.snapshots[i].data(), output.snapshots[i].size());
+    }
+
+    if (aphids.fail() || wasps.fail() || events_failed || summary_failed) {
+        throw std::runtime_error("problem writing output to " + prefix + "_*.csv");
+    }
+
+    return;
+}
+
+
+std::string read_file__(const std::string& fn) {
+    if (fn.empty()) return "";
+    std::ifstream in(fn, std::ios::in | std::ios::binary);
+    if (!in.is_open()) throw std::runtime_error("can't open " + fn);
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+
+
+
+int main(int argc, char* argv[]) {
+
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <config file> <output prefix>" <<
+            std::endl;
+        return 1;
+    }
+
+    try {
+
+        const Config cfg(argv[1]);
+
+        standalone_rng().seed(cfg.uint("seed"));
+
+        std::vector<uint32> cfc = cfg.uints("check_for_clear");
+        const std::deque<uint32> check_for_clear(cfc.begin(), cfc.end());
+
+        SimOutput output;
+
+        sim_clonewars__(cfg.uint("n_reps"), cfg.uint("n_cages"),
+                        cfg.uint("max_plant_age"), cfg.dbl("max_N"),
+                        check_for_clear, cfg.dbl("clear_surv"), cfg.uint("max_t"),
+                        cfg.uint("save_every"), cfg.dbl("mean_K"), cfg.dbl("sd_K"),
+                        cfg.dbl("K_y_mult"), cfg.dbl("death_prop"),
+                        cfg.dbl("shape1_death_mort"), cfg.dbl("shape2_death_mort"),
+                        cfg.mat("attack_surv"), cfg.lgl("disp_error"),
+                        cfg.lgl("demog_error"), cfg.dbl("sigma_x"),
+                        cfg.dbl("sigma_y"), cfg.dbl("rho"), cfg.dbl("extinct_N"),
+                        cfg.strs("aphid_name"), cfg.cubes("leslie_mat"),
+                        cfg.cubes("aphid_density_0"), cfg.dbls("alate_b0"),
+                        cfg.dbls("alate_b1"), cfg.dbl("alate_disp_prop"),
+                        cfg.dbls("disp_rate"), cfg.dbls("disp_mort"),
+                        cfg.uints("disp_start"), cfg.uints("living_days"),
+                        cfg.dbls("pred_rate"), cfg.mat("mum_density_0"),
+                        cfg.dbl("max_mum_density"), cfg.vec("rel_attack"),
+                        cfg.dbl("a"), cfg.dbl("k"), cfg.dbl("h"),
+                        cfg.dbls("wasp_density_0"), cfg.uint("wasp_delay"),
+                        cfg.dbl("sex_ratio"), cfg.dbl("s_y"),
+                        cfg.uints("perturb_when"), cfg.uints("perturb_who"),
+                        cfg.dbls("perturb_how"), cfg.str("checkpoint_dir"),
+                        cfg.uint("checkpoint_every"), cfg.lgl("snapshot"),
+                        read_file__(cfg.str("from_snapshot")), cfg.dbl("cycle_tol"),
+                        cfg.lgl("profile"), cfg.str("trace_file"),
+                        cfg.str("store_file"), cfg.lgl("store_compress"),
+                        cfg.lgl("sparse_output"),
+                        cfg.uints("save_days"), cfg.uint("event_window"),
+                        cfg.dbl("save_change"), cfg.uint("max_change_saves"),
+                        cfg.dbls("summary_probs"),
+                        cfg.uint("n_threads"), cfg.lgl("show_progress"), output);
+
+        write_output__(argv[2], output);
+
+        if (!output.phase_times.empty()) {
+            for (uint32 p = 0; p < phase::count; p++) {
+                std::cerr << phase::names[p] << '\t' << output.phase_times[p] << '\n';
+            }
+        }
+
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,1194 @@
+/*
+ *****************************************************************************
+ *****************************************************************************
+
+ Checks that the simulation engine (`OneCage`, `OnePatch`, and `AphidPop`
+ updates) still does what it did when the reference version below was
+ written, so that changes for speed don't change results.
+
+ Usage:
+     verify_engine [--stages 20,40,70] [--lines 1,3] [--patches 1,6]
+                   [--days 150] [--reps 200] [--alpha 0.001] [--seed 1]
+
+ For each combination of # stages, lines, and patches, a cage with made-up
+ parameters is simulated for `--days` days (dispersal, then aphid, mummy,
+ and wasp updates; no clearing or perturbations) by both the engine and the
+ reference, and three checks are done:
+
+ - `deterministic`: no stochasticity; every value in the state must be
+   identical after every day.
+ - `same_seed`: with stochasticity, both are run on the same seed and the
+   divergence is reported.
+   This is only for information, since changing the order that random
+   numbers are drawn in will make these differ without changing the model.
+ - `distribution`: with stochasticity, `--reps` runs of each are done on
+   independent seeds (but from the same starting states), and the final
+   totals for each line, mummies, and wasps are compared using two-sample
+   Kolmogorov-Smirnov tests.
+   A test fails if its p-value is below `--alpha` divided by the # tests
+   for that combination.
+
+ Results go to stdout as CSV:
+     check,n_stages,n_lines,n_patches,quantity,n_values,n_differ,max_abs_diff,
+     max_rel_diff,first_day,ks_D,ks_p,pass
+ The exit status is 1 if any check failed.
+
+ The reference is written out as directly as possible (no skipping extinct
+ lines or empty patches, no cached totals or carrying capacities,
+ no compile-time stage counts), but it does floating-point
+ operations in the same order as the engine, so deterministic results should
+ be bitwise identical.
+ If the engine's arithmetic is changed on purpose, change the reference
+ to match in the same commit.
+ Compilers that contract multiplies and adds into FMA instructions by default
+ (e.g., GCC on ARM) can make these differ in the last bits; add
+ `-ffp-contract=off` to CXXFLAGS if that happens.
+
+ *****************************************************************************
+ *****************************************************************************
+ */
+
+#include <iostream>             // cout, cerr
+#include <string>               // string class
+#include <vector>               // vector class
+#include <sstream>              // string streams
+#include <algorithm>            // sort, min
+#include <cmath>                // exp, pow, sqrt, abs, isnan
+#include <limits>               // infinity
+#include <random>               // distributions
+#include <stdexcept>            // runtime_error
+#include <pcg/pcg_random.hpp>   // pcg prng
+#include "rcpp_compat.hpp"      // arma namespace
+#include "clonewars_types.hpp"  // integer types
+#include "aphids.hpp"           // aphid classes
+#include "wasps.hpp"            // wasp classes
+#include "patches.hpp"          // patch classes
+#include "math.hpp"             // combine_leslies, inv_logit__
+#include "pcg.hpp"              // runif_01
+#include "arena.hpp"            // RepArena
+#include "stages.hpp"           // stage_limits, stage_limit
+
+
+
+struct VerifyOptions {
+    std::vector<uint32> stages = {20, 40, 70};
+    std::vector<uint32> lines = {1, 3};
+    std::vector<uint32> patches = {1, 6};
+    uint32 days = 150;
+    uint32 reps = 200;
+    double alpha = 0.001;
+    uint64 seed = 1;
+};
+
+
+
+
+/*
+ =====================================================================================
+ =====================================================================================
+ Parameters shared by the engine and the reference
+ =====================================================================================
+ =====================================================================================
+ */
+
+struct Scenario {
+
+    double sigma_x;
+    double sigma_y;
+    double rho;
+    double demog_mult;
+    double mean_K;
+    double sd_K;
+    double K_y_mult;
+    double death_prop;
+    double shape1_death_mort;
+    double shape2_death_mort;
+    arma::mat attack_surv;
+    std::vector<std::string> aphid_name;
+    std::vector<arma::cube> leslie_mat;
+    std::vector<arma::cube> aphid_density_0;
+    std::vector<double> alate_b0;
+    std::vector<double> alate_b1;
+    std::vector<double> disp_rate;
+    std::vector<double> disp_mort;
+    std::vector<uint32> disp_start;
+    std::vector<uint32> living_days;
+    std::vector<double> pred_rate;
+    double extinct_N;
+    arma::mat mum_density_0;
+    double max_mum_density;
+    arma::vec rel_attack;
+    double a;
+    double k;
+    double h;
+    double wasp_density_0;
+    double sex_ratio;
+    double s_y;
+
+    /*
+     Made-up (but plausible) parameters.
+     Lines differ in how fast they grow (so some plants wilt and some
+     don't), odd lines are resistant, and each line starts on only some
+     patches (one below `extinct_N`) so that dispersal re-colonizes others.
+     */
+    Scenario(const uint32& n_stages,
+             const uint32& n_lines,
+             const uint32& n_patches,
+             const bool& stochastic)
+        : sigma_x(stochastic ? 0.2 : 0),
+          sigma_y(stochastic ? 0.2 : 0),
+          rho(0.5),
+          demog_mult(stochastic ? 1 : 0),
+          mean_K(1800),
+          sd_K(600),
+          K_y_mult(1 / 1.57),
+          death_prop(0.25),
+          shape1_death_mort(3.7),
+          shape2_death_mort(5.8),
+          attack_surv(2, n_lines, arma::fill::zeros),
+          aphid_name(),
+          leslie_mat(),
+          aphid_density_0(),
+          alate_b0(n_lines, -3),
+          alate_b1(n_lines, 0.001),
+          disp_rate(),
+          disp_mort(),
+          disp_start(n_lines, n_stages / 3),
+          living_days(n_lines, 8),
+          pred_rate(),
+          extinct_N(1),
+          mum_density_0(7, n_patches, arma::fill::zeros),
+          max_mum_density(1000),
+          rel_attack(n_stages),
+          a(2.3),
+          k(0.4),
+          h(0.03),
+          wasp_density_0(2),
+          sex_ratio(0.5),
+          s_y(0.8) {
+
+        const uint32 adult = n_stages / 3;
+
+        for (uint32 i = 0; i < n_lines; i++) {
+            aphid_name.push_back("line" + std::to_string(i));
+            const double surv_juv = 0.97 - 0.02 * (i % 3);
+            const double repro = 4.0 - (i % 3);
+            arma::cube L(n_stages, n_stages, 3, arma::fill::zeros);
+            for (uint32 s = 0; s < 3; s++) {
+                for (uint32 j = 1; j < n_stages; j++) {
+                    L(j, j-1, s) = (j <= adult) ? surv_juv : 0.9;
+                }
+                if (s < 2) {
+                    for (uint32 j = adult; j < n_stages; j++) {
+                        L(0, j, s) = (s == 0) ? repro : (0.6 * repro);
+                    }
+                }
+            }
+            leslie_mat.push_back(L);
+            if (i % 2 == 1) {
+                attack_surv(0, i) = 0.5;
+                attack_surv(1, i) = 0.1;
+            }
+            disp_rate.push_back(0.1 + 0.1 * (i % 3));
+            disp_mort.push_back((i % 2 == 0) ? 0.1 : 0);
+        }
+
+        for (uint32 j = 0; j < n_patches; j++) {
+            arma::cube X0(n_stages, 2, n_lines, arma::fill::zeros);
+            for (uint32 i = 0; i < n_lines; i++) {
+                if (n_patches > 1 && (i + j) % 2 == 1) continue;
+                X0(adult, 0, i) = (i == 2 && j == 0) ? 0.5 : 10;
+                X0(adult + 1, 1, i) = 2;
+            }
+            aphid_density_0.push_back(X0);
+            pred_rate.push_back(0.01 * (j % 3));
+        }
+        mum_density_0.col(0).fill(1);
+
+        for (uint32 i = 0; i < n_stages; i++) rel_attack(i) = i + 1;
+        rel_attack /= arma::accu(rel_attack);
+
+    }
+
+    OneCage cage(pcg32& eng) const {
+        return OneCage(sigma_x, sigma_y, rho, demog_mult, mean_K, sd_K, K_y_mult,
+                       death_prop, shape1_death_mort, shape2_death_mort,
+                       attack_surv, aphid_name, leslie_mat, aphid_density_0,
+                       alate_b0, alate_b1, disp_rate, disp_mort, disp_start,
+                       living_days, pred_rate, extinct_N, mum_density_0,
+                       max_mum_density, rel_attack, a, k, h, wasp_density_0,
+                       sex_ratio, s_y, eng);
+    }
+
+};
+
+
+
+
+/*
+ =====================================================================================
+ =====================================================================================
+ Reference version
+ =====================================================================================
+ =====================================================================================
+ */
+
+namespace ref {
+
+struct TypePop {
+    std::vector<double> X;
+    double N;
+};
+
+struct Line {
+    arma::mat L_apterous;
+    arma::mat L_alates;
+    std::vector<double> s;          // survival of parasitized aphids
+    double alate_b0;
+    double alate_b1;
+    double disp_rate;
+    double disp_mort;
+    uint32 disp_start;
+    double surv_single;             // survival of singly attacked aphids
+    double surv_multi;              // survival of multiply attacked aphids
+    TypePop apterous;
+    TypePop alates;
+    TypePop paras;
+    bool extinct;
+    std::normal_distribution<double> norm_distr;
+    std::poisson_distribution<uint32> pois_distr;
+    std::binomial_distribution<uint32> bino_distr;
+
+    Line() : norm_distr(0, 1), pois_distr(1), bino_distr(1, 0.1) {};
+
+    double total() const {
+        return apterous.N + alates.N + paras.N;
+    }
+    void clear() {
+        for (TypePop* tp : {&apterous, &alates, &paras}) {
+            std::fill(tp->X.begin(), tp->X.end(), 0);
+            tp->N = 0;
+        }
+        extinct = true;
+        return;
+    }
+    void clear(const double& surv) {
+        for (TypePop* tp : {&apterous, &alates, &paras}) {
+            for (double& x : tp->X) x *= surv;
+            tp->N *= surv;
+        }
+        return;
+    }
+};
+
+struct Patch {
+    std::vector<Line> lines;
+    std::vector<double> mummies;
+    double mummies_N;
+    double pred_rate;
+    double K;
+    double K_y;
+    double death_prop;
+    double death_mort;
+    double extinct_N;
+    double max_mum_density;
+    double z;
+    double S;
+    double S_y;
+    bool wilted;
+    bool empty;
+    uint32 age;
+    double total_N;
+    double total_unpar_N;
+};
+
+struct Cage {
+
+    std::vector<Patch> patches;
+    double sigma_x;
+    double rho;
+    double demog_mult;
+    arma::vec rel_attack;
+    double a;
+    double k;
+    double h;
+    double sex_ratio;
+    double s_y;
+    double sigma_y;
+    double extinct_N;
+    double Y;                       // adult wasps
+    double x;                       // unparasitized aphids for wasp attack
+    std::normal_distribution<double> norm_distr;
+    arma::cube emigrants;
+    arma::cube immigrants;
+    double total_N;
+    double total_unpar_N;
+    bool empty;
+
+    /*
+     Starts from the state of `cage` (made from `sc`), so that both start
+     from exactly the same place (including random `K`s).
+     */
+    Cage(const Scenario& sc, const OneCage& cage)
+        : patches(),
+          sigma_x(sc.sigma_x),
+          rho(sc.rho),
+          demog_mult(sc.demog_mult),
+          rel_attack(sc.rel_attack),
+          a(sc.a),
+          k(sc.k),
+          h(sc.h),
+          sex_ratio(sc.sex_ratio),
+          s_y(sc.s_y),
+          sigma_y(sc.sigma_y),
+          extinct_N(sc.extinct_N),
+          Y(cage.wasps.Y),
+          x(cage.wasps.x),
+          norm_distr(0, 1),
+          emigrants(cage.emigrants.n_rows, cage.emigrants.n_cols,
+                    cage.emigrants.n_slices, arma::fill::zeros),
+          immigrants(cage.immigrants.n_rows, cage.immigrants.n_cols,
+                     cage.immigrants.n_slices, arma::fill::zeros),
+          total_N(cage.total_aphids()),
+          total_unpar_N(cage.total_unpar_aphids()),
+          empty(cage.empty()) {
+
+        for (uint32 j = 0; j < cage.size(); j++) {
+            const OnePatch& op(cage[j]);
+            Patch p;
+            for (uint32 i = 0; i < op.size(); i++) {
+                const AphidPop& ap(op[i]);
+                const arma::cube& L(sc.leslie_mat[i]);
+                Line ln;
+                ln.L_apterous = L.slice(0);
+                ln.L_alates = L.slice(1);
+                ln.s.assign(sc.living_days[i], 0);
+                for (uint32 d = 0; d < ln.s.size() && d + 1 < L.n_rows; d++) {
+                    ln.s[d] = L(d+1, d, 2);
+                }
+                ln.alate_b0 = sc.alate_b0[i];
+                ln.alate_b1 = sc.alate_b1[i];
+                ln.disp_rate = sc.disp_rate[i];
+                ln.disp_mort = sc.disp_mort[i];
+                ln.disp_start = sc.disp_start[i];
+                ln.surv_single = sc.attack_surv(0, i);
+                ln.surv_multi = sc.attack_surv(1, i);
+                ln.apterous.X.assign(ap.apterous.X.begin(), ap.apterous.X.end());
+                ln.apterous.N = ap.apterous.total_aphids();
+                ln.alates.X.assign(ap.alates.X.begin(), ap.alates.X.end());
+                ln.alates.N = ap.alates.total_aphids();
+                ln.paras.X.assign(ap.paras.X.begin(), ap.paras.X.end());
+                ln.paras.N = ap.paras.total_aphids();
+                ln.extinct = ap.extinct;
+                p.lines.push_back(ln);
+            }
+            p.mummies.assign(op.mummies.Y.begin(), op.mummies.Y.end());
+            p.mummies_N = op.total_mummies();
+            p.pred_rate = op.pred_rate;
+            p.K = op.K;
+            p.K_y = op.K_y;
+            p.death_prop = op.death_prop;
+            p.death_mort = op.death_mort;
+            p.extinct_N = op.extinct_N;
+            p.max_mum_density = op.max_mum_density;
+            p.z = op.z;
+            p.S = op.S;
+            p.S_y = op.S_y;
+            p.wilted = op.wilted();
+            p.empty = op.empty;
+            p.age = op.age;
+            p.total_N = op.total_aphids();
+            p.total_unpar_N = op.total_unpar_aphids();
+            patches.push_back(p);
+        }
+    }
+
+};
+
+
+
+inline double alate_prop(const Line& ln, const double& z) {
+    double ap;
+    inv_logit__(ln.alate_b0 + ln.alate_b1 * z, ap);
+    return ap;
+}
+
+
+// Proportion of each stage that isn't parasitized (eq. 6 in Meisner et al. 2014)
+void attack(const Cage& c, const Line& ln, std::vector<double>& A) {
+    const double denom = c.h * c.x + 1;
+    for (uint32 i = 0; i < A.size(); i++) {
+        double A_ = (c.a * c.rel_attack(i) * c.Y) / denom;
+        if (ln.surv_single + ln.surv_multi == 0) {
+            A[i] = std::pow(1 + A_ / c.k, -c.k);
+        } else {
+            double AA = 1 + A_ / c.k;
+            double none = std::pow(AA, -c.k);
+            double once = A_ * std::pow(AA, -c.k-1);
+            A[i] = none + ln.surv_single * once + ln.surv_multi * (1 - (none + once));
+        }
+    }
+    return;
+}
+
+
+/*
+ Log-normal process error with covariance `var * (rho * J + (1 - rho) * I)`.
+ The Cholesky factor comes from Armadillo, like in the engine, since doing it
+ any other way changes the last bits of every stochastic trajectory.
+ */
+void process_error(std::vector<double>& X,
+                   const double& z,
+                   const Cage& c,
+                   std::normal_distribution<double>& norm_distr,
+                   pcg32& eng) {
+
+    if (c.demog_mult == 0 || c.sigma_x == 0) return;
+    double var = c.sigma_x*c.sigma_x + c.demog_mult * std::min(0.5, 1 / std::abs(1 + z));
+    if (var <= 0) return;
+
+    const uint32 n = X.size();
+
+    // (Same as `var * (rho * J + (1 - rho) * I)` in Armadillo, to the last bit)
+    arma::mat Se(n, n);
+    for (uint32 j = 0; j < n; j++) {
+        for (uint32 i = 0; i < n; i++) {
+            Se(i, j) = var * (c.rho * 1.0 + (1 - c.rho) * ((i == j) ? 1.0 : 0.0));
+        }
+    }
+    arma::mat L = arma::chol(Se).t();
+
+    arma::vec E(n);
+    for (uint32 i = 0; i < n; i++) E(i) = norm_distr(eng);
+    E = L * E;
+
+    for (uint32 i = 0; i < n; i++) X[i] *= std::exp(E(i));
+
+    return;
+}
+
+
+// No stage can have more than the previous stage had yesterday
+double cap_stages(std::vector<double>& X, const std::vector<double>& Xt) {
+    double total = X[0];
+    for (uint32 i = 1; i < X.size(); i++) {
+        if (X[i] > Xt[i-1]) X[i] = Xt[i-1];
+        total += X[i];
+    }
+    return total;
+}
+
+
+// Dispersal of line `i` from patch `j` to all other patches
+void dispersal(Line& ln,
+               const uint32& j,
+               const uint32& i,
+               Cage& c,
+               const bool& disp_error,
+               pcg32& eng) {
+
+    const uint32 n_patches = c.patches.size();
+
+    if (ln.alates.N == 0 || n_patches == 1 || ln.disp_rate <= 0) return;
+
+    const std::vector<double>& X(ln.alates.X);
+    arma::mat& emigrants(c.emigrants.slice(i));
+    arma::mat& immigrants(c.immigrants.slice(i));
+    arma::rowvec n_leaving(n_patches);
+
+    for (uint32 s = ln.disp_start; s < X.size(); s++) {
+
+        if (disp_error) {
+            if (X[s] < 1) continue;
+        } else if (X[s] == 0) continue;
+
+        double lambda_ = ln.disp_rate * X[s] / static_cast<double>(n_patches - 1);
+
+        if (disp_error) {
+            ln.pois_distr.param(std::poisson_distribution<uint32>::param_type(lambda_));
+            for (uint32 jj = 0; jj < n_patches; jj++) {
+                if (jj == j) {
+                    n_leaving(jj) = 0;
+                } else n_leaving(jj) = ln.pois_distr(eng);
+            }
+            double total_emigrants = arma::accu(n_leaving);
+            if (total_emigrants > X[s]) {
+                double extras = total_emigrants - X[s];
+                std::vector<uint32> extra_inds;
+                for (uint32 jj = 0; jj < n_patches; jj++) {
+                    if (n_leaving(jj) > 0) extra_inds.push_back(jj);
+                }
+                while (extras > 0) {
+                    uint32 rnd = runif_01(eng) * extra_inds.size();
+                    n_leaving(extra_inds[rnd])--;
+                    if (n_leaving(extra_inds[rnd]) == 0) {
+                        extra_inds.erase(extra_inds.begin() + rnd);
+                    }
+                    extras--;
+                    total_emigrants--;
+                }
+            }
+            emigrants(s, j) = total_emigrants;
+        } else {
+            n_leaving.fill(lambda_);
+            n_leaving(j) = 0;
+            emigrants(s, j) = arma::accu(n_leaving);
+        }
+
+        if (ln.disp_mort <= 0) {
+            immigrants.row(s) += n_leaving;
+        } else if (ln.disp_mort < 1) {
+            if (disp_error) {
+                for (uint32 jj = 0; jj < n_patches; jj++) {
+                    if (jj == j || n_leaving(jj) == 0) continue;
+                    ln.bino_distr.param(std::binomial_distribution<uint32>::param_type(
+                            n_leaving(jj), 1 - ln.disp_mort));
+                    immigrants(s, jj) += static_cast<double>(ln.bino_distr(eng));
+                }
+            } else immigrants.row(s) += n_leaving * (1 - ln.disp_mort);
+        }
+
+    }
+
+    return;
+}
+
+
+// Update line `i` on patch `j`, returning # newly mummified
+double update_line(Line& ln,
+                   const uint32& j,
+                   const uint32& i,
+                   const Patch& p,
+                   const Cage& c,
+                   const bool& proc_error,
+                   pcg32& eng) {
+
+    const uint32 n = ln.apterous.X.size();
+    const uint32 n_paras = ln.paras.X.size();
+
+    ln.alates.N = 0;
+    for (uint32 s = 0; s < n; s++) {
+        ln.alates.X[s] -= c.emigrants(s, j, i);
+        ln.alates.X[s] += c.immigrants(s, j, i);
+        ln.alates.N += ln.alates.X[s];
+    }
+
+    double nm = 0;
+
+    if (ln.total() > 0) {
+
+        std::vector<double> A(n);
+        attack(c, ln, A);
+        const double pred_surv = 1 - p.pred_rate;
+
+        const std::vector<double> apterous_Xt(ln.apterous.X);
+        const std::vector<double> alates_Xt(ln.alates.X);
+        const std::vector<double> paras_Xt(ln.paras.X);
+
+        std::vector<double> LX_apterous(n, 0);
+        std::vector<double> LX_alates(n, 0);
+        for (uint32 col = 0; col < n; col++) {
+            for (uint32 row = 0; row < n; row++) {
+                LX_apterous[row] += ln.L_apterous(row, col) * ln.apterous.X[col];
+                LX_alates[row] += ln.L_alates(row, col) * ln.alates.X[col];
+            }
+        }
+
+        const double mult = pred_surv * p.S;
+        ln.apterous.N = 0;
+        ln.alates.N = 0;
+        for (uint32 s = 0; s < n; s++) {
+            ln.apterous.X[s] = mult * A[s] * LX_apterous[s];
+            ln.apterous.N += ln.apterous.X[s];
+        }
+        for (uint32 s = 0; s < n; s++) {
+            ln.alates.X[s] = mult * A[s] * LX_alates[s];
+            ln.alates.N += ln.alates.X[s];
+        }
+
+        double paras_apterous = 0, paras_alates = 0;
+        for (uint32 s = 0; s < n; s++) paras_apterous += (1 - A[s]) * LX_apterous[s];
+        for (uint32 s = 0; s < n; s++) paras_alates += (1 - A[s]) * LX_alates[s];
+        double np = 0;
+        np += pred_surv * p.S_y * paras_apterous;
+        np += pred_surv * p.S_y * paras_alates;
+
+        nm += pred_surv * ln.paras.X.back();
+
+        ln.paras.N = np;
+        if (n_paras > 1) {
+            double total = 0;
+            for (uint32 s = n_paras - 1; s > 0; s--) {
+                ln.paras.X[s] = pred_surv * ln.s[s] * p.S_y * ln.paras.X[s-1];
+                total += ln.paras.X[s];
+            }
+            ln.paras.N += total;
+        }
+        ln.paras.X.front() = np;
+
+        double new_alates = 0;
+        const double ap = alate_prop(ln, p.z);
+
+        if (proc_error) {
+            process_error(ln.apterous.X, p.z, c, ln.norm_distr, eng);
+            process_error(ln.alates.X, p.z, c, ln.norm_distr, eng);
+            process_error(ln.paras.X, p.z, c, ln.norm_distr, eng);
+            ln.apterous.N = cap_stages(ln.apterous.X, apterous_Xt);
+            ln.alates.N = cap_stages(ln.alates.X, alates_Xt);
+            ln.paras.N = cap_stages(ln.paras.X, paras_Xt);
+            if (ap > 0 && ln.apterous.X.front() > 0) {
+                double lambda_ = ap * ln.apterous.X.front();
+                ln.pois_distr.param(std::poisson_distribution<uint32>::param_type(lambda_));
+                new_alates = static_cast<double>(ln.pois_distr(eng));
+                if (new_alates > ln.apterous.X.front()) new_alates = ln.apterous.X.front();
+            }
+        } else new_alates = ap * ln.apterous.X.front();
+
+        // Alates' offspring are apterous, and new alates come from apterous:
+        const double apterous_0 = ln.apterous.X.front();
+        const double alates_0 = ln.alates.X.front();
+        ln.apterous.X.front() -= new_alates;
+        ln.apterous.X.front() += alates_0;
+        ln.alates.X.front() = new_alates;
+        ln.apterous.N += (ln.apterous.X.front() - apterous_0);
+        ln.alates.N += (new_alates - alates_0);
+
+    }
+
+    return nm;
+}
+
+
+// Weighted mean of each line's carrying capacity (no caching)
+double carrying_capacity(const Patch& p) {
+
+    const uint32 n_lines = p.lines.size();
+
+    arma::vec cc(n_lines, arma::fill::zeros);
+    arma::vec Ns(n_lines);
+    double total_N = 0;
+    for (uint32 i = 0; i < n_lines; i++) {
+        Ns[i] = p.lines[i].total();
+        total_N += Ns[i];
+    }
+
+    arma::mat L;
+    arma::cx_vec eigval;
+    for (uint32 i = 0; i < n_lines; i++) {
+        if (total_N > 0 && Ns[i] == 0) continue;
+        const Line& ln(p.lines[i]);
+        combine_leslies(L, ln.L_apterous, ln.L_alates, alate_prop(ln, p.z),
+                        ln.disp_rate, ln.disp_mort, ln.disp_start);
+        eigval = arma::eig_gen(L);
+        cc[i] = (eigval.max().real() - 1) * p.K;
+    }
+
+    if (total_N > 0) return arma::accu(cc % Ns / total_N);
+    return arma::mean(cc);
+}
+
+
+void update_patch(const uint32& j,
+                  Cage& c,
+                  const bool& proc_error,
+                  pcg32& eng) {
+
+    Patch& p(c.patches[j]);
+
+    p.z = p.total_N;
+    if (!p.wilted) p.wilted = carrying_capacity(p) >= (p.K * p.death_prop);
+
+    p.S = 1 / (1 + p.z / p.K);
+    p.S_y = 1 / (1 + p.z / p.K_y);
+
+    p.empty = true;
+    p.total_N = 0;
+    p.total_unpar_N = 0;
+
+    double nm = 0;
+
+    for (uint32 i = 0; i < p.lines.size(); i++) {
+        Line& ln(p.lines[i]);
+        nm += update_line(ln, j, i, p, c, proc_error, eng);
+        if (p.wilted) ln.clear(p.death_mort);
+        if (ln.total() < p.extinct_N) {
+            ln.clear();
+        } else {
+            p.empty = false;
+            ln.extinct = false;
+        }
+        double unpar = ln.apterous.N + ln.alates.N;
+        p.total_unpar_N += unpar;
+        p.total_N += unpar + ln.paras.N;
+    }
+
+    std::vector<double>& Y(p.mummies);
+    p.mummies_N = 0;
+    for (uint32 s = Y.size() - 1; s > 0; s--) {
+        Y[s] = (1 - p.pred_rate) * Y[s-1];
+        p.mummies_N += Y[s];
+    }
+    Y[0] = nm / 3;
+    Y[1] += (nm / 3);
+    Y[2] += (nm / 3);
+    p.mummies_N += nm;
+
+    const double mums = p.mummies_N;
+    if (mums < p.extinct_N) {
+        std::fill(Y.begin(), Y.end(), 0);
+        p.mummies_N = 0;
+    }
+    if (p.max_mum_density > 0 && mums > p.max_mum_density) {
+        const double surv = p.max_mum_density / mums;
+        for (double& y : Y) y *= surv;
+        p.mummies_N *= surv;
+    }
+
+    p.age++;
+
+    return;
+}
+
+
+// One day: dispersal, then aphids and mummies in each patch, then wasps
+void step(Cage& c,
+          const bool& disp_error,
+          const bool& proc_error,
+          pcg32& eng) {
+
+    c.emigrants.zeros();
+    c.immigrants.zeros();
+    for (uint32 j = 0; j < c.patches.size(); j++) {
+        for (uint32 i = 0; i < c.patches[j].lines.size(); i++) {
+            dispersal(c.patches[j].lines[i], j, i, c, disp_error, eng);
+        }
+    }
+
+    c.x = c.total_unpar_N;
+    double old_mums = 0;
+    for (const Patch& p : c.patches) old_mums += p.mummies.back();
+
+    for (uint32 j = 0; j < c.patches.size(); j++) update_patch(j, c, proc_error, eng);
+
+    c.total_N = 0;
+    c.total_unpar_N = 0;
+    c.empty = true;
+    for (const Patch& p : c.patches) {
+        c.total_N += p.total_N;
+        c.total_unpar_N += p.total_unpar_N;
+        if (!p.empty) c.empty = false;
+    }
+
+    double max_Y = old_mums + c.Y;
+    if (max_Y != 0) {
+        c.Y *= c.s_y;
+        c.Y += (c.sex_ratio * old_mums);
+        if (proc_error) {
+            c.Y *= std::exp(c.norm_distr(eng) * c.sigma_y);
+            if (c.Y > max_Y) c.Y = max_Y;
+        }
+    }
+    if (c.Y < c.extinct_N) c.Y = 0;
+
+    return;
+}
+
+}  // namespace ref
+
+
+
+
+/*
+ =====================================================================================
+ =====================================================================================
+ Running and comparing
+ =====================================================================================
+ =====================================================================================
+ */
+
+
+// One day for the engine, the same way as in `one_rep__` (see `simulations.cpp`)
+template <bool proc_error>
+void engine_step__(OneCage& cage, const bool& disp_error, pcg32& eng) {
+    if (disp_error) {
+        cage.calc_dispersal<true>(eng);
+    } else cage.calc_dispersal<false>(eng);
+    switch (stage_limit(cage.emigrants.n_rows)) {
+    case stage_limits::up_to_32:
+        cage.update<proc_error, stage_limits::up_to_32>(eng);
+        break;
+    case stage_limits::up_to_64:
+        cage.update<proc_error, stage_limits::up_to_64>(eng);
+        break;
+    default:
+        cage.update<proc_error, 0>(eng);
+    }
+    return;
+}
+
+
+
+/*
+ Everything in a cage's state, in the same order for the engine and the
+ reference.
+ */
+template <typename T>
+inline void append__(std::vector<double>& out, const T& x) {
+    out.insert(out.end(), x.begin(), x.end());
+    return;
+}
+
+std::vector<double> state__(const OneCage& cage) {
+    std::vector<double> out;
+    for (uint32 j = 0; j < cage.size(); j++) {
+        const OnePatch& p(cage[j]);
+        for (uint32 i = 0; i < p.size(); i++) {
+            const AphidPop& ap(p[i]);
+            append__(out, ap.apterous.X);
+            append__(out, ap.alates.X);
+            append__(out, ap.paras.X);
+            out.push_back(ap.apterous.total_aphids());
+            out.push_back(ap.alates.total_aphids());
+            out.push_back(ap.paras.total_aphids());
+            out.push_back(ap.extinct);
+        }
+        append__(out, p.mummies.Y);
+        out.push_back(p.total_mummies());
+        out.push_back(p.z);
+        out.push_back(p.S);
+        out.push_back(p.S_y);
+        out.push_back(p.wilted());
+        out.push_back(p.empty);
+        out.push_back(p.age);
+        out.push_back(p.total_aphids());
+        out.push_back(p.total_unpar_aphids());
+    }
+    out.push_back(cage.wasps.Y);
+    out.push_back(cage.wasps.x);
+    out.push_back(cage.total_aphids());
+    out.push_back(cage.total_unpar_aphids());
+    out.push_back(cage.empty());
+    return out;
+}
+
+std::vector<double> state__(const ref::Cage& cage) {
+    std::vector<double> out;
+    for (const ref::Patch& p : cage.patches) {
+        for (const ref::Line& ln : p.lines) {
+            append__(out, ln.apterous.X);
+            append__(out, ln.alates.X);
+            append__(out, ln.paras.X);
+            out.push_back(ln.apterous.N);
+            out.push_back(ln.alates.N);
+            out.push_back(ln.paras.N);
+            out.push_back(ln.extinct);
+        }
+        append__(out, p.mummies);
+        out.push_back(p.mummies_N);
+        out.push_back(p.z);
+        out.push_back(p.S);
+        out.push_back(p.S_y);
+        out.push_back(p.wilted);
+        out.push_back(p.empty);
+        out.push_back(p.age);
+        out.push_back(p.total_N);
+        out.push_back(p.total_unpar_N);
+    }
+    out.push_back(cage.Y);
+    out.push_back(cage.x);
+    out.push_back(cage.total_N);
+    out.push_back(cage.total_unpar_N);
+    out.push_back(cage.empty);
+    return out;
+}
+
+
+// Final totals compared in the `distribution` check (lines, then mummies and wasps)
+std::vector<double> totals__(const OneCage& cage) {
+    const uint32 n_lines = cage[0].size();
+    std::vector<double> out(n_lines + 2, 0);
+    for (uint32 j = 0; j < cage.size(); j++) {
+        for (uint32 i = 0; i < n_lines; i++) out[i] += cage[j][i].total_aphids();
+        out[n_lines] += cage[j].total_mummies();
+    }
+    out[n_lines + 1] = cage.wasps.Y;
+    return out;
+}
+std::vector<double> totals__(const ref::Cage& cage) {
+    const uint32 n_lines = cage.patches[0].lines.size();
+    std::vector<double> out(n_lines + 2, 0);
+    for (const ref::Patch& p : cage.patches) {
+        for (uint32 i = 0; i < n_lines; i++) out[i] += p.lines[i].total();
+        out[n_lines] += p.mummies_N;
+    }
+    out[n_lines + 1] = cage.Y;
+    return out;
+}
+
+
+
+// Differences between engine and reference states across days
+struct Divergence {
+
+    uint64 n_values = 0;
+    uint64 n_differ = 0;
+    double max_abs = 0;
+    double max_rel = 0;
+    sint64 first_day = -1;
+
+    void add(const std::vector<double>& engine,
+             const std::vector<double>& reference,
+             const uint32& day) {
+        if (engine.size() != reference.size()) {
+            throw std::runtime_error("engine and reference states have different sizes");
+        }
+        for (uint32 i = 0; i < engine.size(); i++) {
+            const double& x(engine[i]);
+            const double& y(reference[i]);
+            n_values++;
+            if (x == y || (std::isnan(x) && std::isnan(y))) continue;
+            n_differ++;
+            if (first_day < 0) first_day = day;
+            double d = std::abs(x - y);
+            double m = std::max(std::abs(x), std::abs(y));
+            if (std::isnan(d)) d = std::numeric_limits<double>::infinity();
+            if (d > max_abs) max_abs = d;
+            if (m > 0 && d / m > max_rel) max_rel = d / m;
+        }
+        return;
+    }
+
+};
+
+
+
+/*
+ Two-sample Kolmogorov-Smirnov statistic and its asymptotic p-value
+ (Press et al., Numerical Recipes, section 14.3).
+ Ties (e.g., lots of zeros from extinctions) make the p-value conservative.
+ */
+void ks_test__(std::vector<double> x,
+               std::vector<double> y,
+               double& D,
+               double& p) {
+
+    std::sort(x.begin(), x.end());
+    std::sort(y.begin(), y.end());
+    const double nx = x.size(), ny = y.size();
+
+    D = 0;
+    uint32 i = 0, j = 0;
+    while (i < x.size() && j < y.size()) {
+        const double v = std::min(x[i], y[j]);
+        while (i < x.size() && x[i] == v) i++;
+        while (j < y.size() && y[j] == v) j++;
+        D = std::max(D, std::abs(i / nx - j / ny));
+    }
+
+    const double ne = std::sqrt(nx * ny / (nx + ny));
+    const double lambda = (ne + 0.12 + 0.11 / ne) * D;
+    p = 1;
+    double sum = 0, sign = 1, last = 0;
+    for (uint32 k = 1; k <= 100; k++) {
+        double term = 2 * sign * std::exp(-2 * lambda * lambda * k * k);
+        sum += term;
+        if (std::abs(term) <= 1e-3 * last || std::abs(term) <= 1e-8 * sum) {
+            p = std::min(std::max(sum, 0.0), 1.0);
+            break;
+        }
+        sign = -sign;
+        last = std::abs(term);
+    }
+
+    return;
+}
+
+
+
+
+void print_divergence__(const std::string& check,
+                        const uint32& n_stages,
+                        const uint32& n_lines,
+                        const uint32& n_patches,
+                        const Divergence& div,
+                        const std::string& pass) {
+    std::cout << check << ',' << n_stages << ',' << n_lines << ',' << n_patches <<
+        ",state," << div.n_values << ',' << div.n_differ << ',' << div.max_abs <<
+        ',' << div.max_rel << ',';
+    if (div.first_day < 0) {
+        std::cout << "NA";
+    } else std::cout << div.first_day;
+    std::cout << ",NA,NA," << pass << std::endl;
+    return;
+}
+
+
+// Returns false if any check failed
+bool verify_all__(const VerifyOptions& opts,
+                  const uint32& n_stages,
+                  const uint32& n_lines,
+                  const uint32& n_patches) {
+
+    bool passed = true;
+
+    // Deterministic:
+    {
+        const Scenario sc(n_stages, n_lines, n_patches, false);
+        pcg32 eng(opts.seed, 1);
+        OneCage cage = sc.cage(eng);
+        ref::Cage ref_cage(sc, cage);
+        pcg32 ref_eng(eng);
+        Divergence div;
+        div.add(state__(cage), state__(ref_cage), 0);
+        for (uint32 t = 1; t <= opts.days; t++) {
+            engine_step__<false>(cage, false, eng);
+            ref::step(ref_cage, false, false, ref_eng);
+            div.add(state__(cage), state__(ref_cage), t);
+        }
+        print_divergence__("deterministic", n_stages, n_lines, n_patches, div,
+                           div.n_differ == 0 ? "1" : "0");
+        passed = passed && div.n_differ == 0;
+    }
+    RepArena::local().reset();
+
+    const Scenario sc(n_stages, n_lines, n_patches, true);
+
+    // Stochastic, same seeds (for information only):
+    {
+        pcg32 init_eng(opts.seed, 2);
+        OneCage cage = sc.cage(init_eng);
+        ref::Cage ref_cage(sc, cage);
+        pcg32 eng(opts.seed, 3);
+        pcg32 ref_eng(eng);
+        Divergence div;
+        div.add(state__(cage), state__(ref_cage), 0);
+        for (uint32 t = 1; t <= opts.days; t++) {
+            engine_step__<true>(cage, true, eng);
+            ref::step(ref_cage, true, true, ref_eng);
+            div.add(state__(cage), state__(ref_cage), t);
+        }
+        print_divergence__("same_seed", n_stages, n_lines, n_patches, div, "NA");
+    }
+    RepArena::local().reset();
+
+    // Stochastic, compared by distribution:
+    std::vector<std::vector<double>> engine_totals(n_lines + 2);
+    std::vector<std::vector<double>> ref_totals(n_lines + 2);
+    for (uint32 r = 0; r < opts.reps; r++) {
+        {
+            pcg32 init_eng(opts.seed + r, 4);
+            OneCage cage = sc.cage(init_eng);
+            ref::Cage ref_cage(sc, cage);
+            pcg32 eng(opts.seed + r, 5);
+            pcg32 ref_eng(opts.seed + r, 6);
+            for (uint32 t = 1; t <= opts.days; t++) {
+                engine_step__<true>(cage, true, eng);
+                ref::step(ref_cage, true, true, ref_eng);
+            }
+            std::vector<double> et = totals__(cage);
+            std::vector<double> rt = totals__(ref_cage);
+            for (uint32 q = 0; q < et.size(); q++) {
+                engine_totals[q].push_back(et[q]);
+                ref_totals[q].push_back(rt[q]);
+            }
+        }
+        RepArena::local().reset();
+    }
+    const double alpha = opts.alpha / static_cast<double>(n_lines + 2);
+    for (uint32 q = 0; q < (n_lines + 2); q++) {
+        double D, p;
+        ks_test__(engine_totals[q], ref_totals[q], D, p);
+        const bool ok = p >= alpha;
+        passed = passed && ok;
+        std::string quantity = (q < n_lines) ? sc.aphid_name[q] :
+            ((q == n_lines) ? "mummies" : "wasps");
+        std::cout << "distribution," << n_stages << ',' << n_lines << ',' <<
+            n_patches << ',' << quantity << ',' << opts.reps <<
+            ",NA,NA,NA,NA," << D << ',' << p << ',' << (ok ? "1" : "0") <<
+            std::endl;
+    }
+
+    return passed;
+}
+
+
+
+std::vector<uint32> parse_uints__(const std::string& x) {
+    std::vector<uint32> out;
+    std::stringstream ss(x);
+    std::string item;
+    while (std::getline(ss, item, ',')) out.push_back(std::stoul(item));
+    if (out.empty()) throw std::runtime_error("empty list of numbers");
+    return out;
+}
+
+
+int main(int argc, char* argv[]) {
+
+    VerifyOptions opts;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg(argv[i]);
+            if (i + 1 >= argc) throw std::runtime_error("missing value for " + arg);
+            std::string val(argv[++i]);
+            if (arg == "--stages") {
+                opts.stages = parse_uints__(val);
+            } else if (arg == "--lines") {
+                opts.lines = parse_uints__(val);
+            } else if (arg == "--patches") {
+                opts.patches = parse_uints__(val);
+            } else if (arg == "--days") {
+                opts.days = std::stoul(val);
+            } else if (arg == "--reps") {
+                opts.reps = std::stoul(val);
+            } else if (arg == "--alpha") {
+                opts.alpha = std::stod(val);
+            } else if (arg == "--seed") {
+                opts.seed = std::stoull(val);
+            } else throw std::runtime_error("unknown argument " + arg);
+        }
+        for (const uint32& s : opts.stages) {
+            if (s < 4) throw std::runtime_error("--stages must all be >= 4");
+        }
+        for (const uint32& l : opts.lines) {
+            if (l == 0) throw std::runtime_error("--lines must all be >= 1");
+        }
+        for (const uint32& p : opts.patches) {
+            if (p == 0) throw std::runtime_error("--patches must all be >= 1");
+        }
+        if (opts.reps < 2) throw std::runtime_error("--reps must be >= 2");
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "check,n_stages,n_lines,n_patches,quantity,n_values,n_differ," <<
+        "max_abs_diff,max_rel_diff,first_day,ks_D,ks_p,pass" << std::endl;
+
+    bool passed = true;
+
+    try {
+        for (const uint32& s : opts.stages) {
+            for (const uint32& l : opts.lines) {
+                for (const uint32& p : opts.patches) {
+                    passed = verify_all__(opts, s, l, p) && passed;
+                    RepArena::local().reset();
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    RepArena::local().release();
+
+    if (!passed) {
+        std::cerr << "The engine and the reference differ (see `pass` column)." <<
+            std::endl;
+        return 1;
+    }
+
+    return 0;
+}